@@ -0,0 +1,89 @@
+#define _GNU_SOURCE
+#include "../src/httpHandle.h"
+#include "../src/logger.h"
+#include "../src/socketUtils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_HOST "bench.invalid"
+#define BENCH_URL  "http://" BENCH_HOST "/"
+
+int countBody(void *userData, char *data, int length);
+
+/**
+ * Requests per second of a handle over a mock connection: building, sending
+ * and parsing without the network, the kernel or a server in the way.
+ * Usage: mockBench [REQUESTS] [BODY_BYTES], default 200000 requests of 1024 bytes
+ */
+int main(int argc, char **argv)
+{
+    int i, requests, bodySize, headLength;
+    long long received;
+    char *response;
+    double seconds;
+    struct timespec start, end;
+    httpHandle *handle;
+    httpError error;
+
+    silenceLogger();
+    requests = argc > 1 ? atoi(argv[1]) : 200000;
+    bodySize = argc > 2 ? atoi(argv[2]) : 1024;
+    if (requests <= 0 || bodySize < 0)
+    {
+        fprintf(stderr, "Usage: mockBench [REQUESTS] [BODY_BYTES]\n");
+
+        return 1;
+    }
+
+    response = malloc(128 + bodySize);
+    handle   = createHandle();
+    if (response == NULL || handle == NULL)
+    {
+        return 1;
+    }
+    headLength = sprintf(response, "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n\r\n", bodySize);
+    memset(response + headLength, 'a', bodySize);
+
+    // the handle finds a connection to the host of the url and keeps using it
+    error = createMockSocket(&handle->connection, BENCH_HOST, response, headLength + bodySize);
+
+    received = 0;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < requests && error == HTTP_OK; ++i)
+    {
+        resetHandle(handle);
+        setBodyCallback(handle, countBody, &received);
+
+        error = setUrl(handle, BENCH_URL);
+        if (error == HTTP_OK)
+        {
+            error = performRequest(handle);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (error != HTTP_OK)
+    {
+        fprintf(stderr, "Request %d failed: %s\n", i, errorDescription(error));
+    }
+    else
+    {
+        seconds = end.tv_sec - start.tv_sec + (end.tv_nsec - start.tv_nsec) / 1e9;
+        printf("%d requests in %.3f s: %.0f requests/s, %.0f MB/s of body\n",
+               requests, seconds, requests / seconds, received / seconds / 1e6);
+    }
+
+    destroyHandle(handle);
+    free(response);
+
+    return error == HTTP_OK ? 0 : 1;
+}
+
+int countBody(void *userData, char *data, int length)
+{
+    *(long long *)userData += length;
+
+    return 0;
+}
@@ -0,0 +1,158 @@
+#define _GNU_SOURCE
+#include "../src/fileSink.h"
+#include "../src/logger.h"
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// bytes written by every run, as a body of known size
+#define BENCH_SIZE (256LL * 1024 * 1024)
+// every durable write waits for the disk, less of them keep the run short
+#define BENCH_DURABLE_SIZE (32LL * 1024 * 1024)
+// slice handed over at a time, what a read from the socket gives
+#define BENCH_SLICE (16 * 1024)
+// bytes per second of the link the durable runs recive from
+#define BENCH_NETWORK_RATE (100LL * 1000 * 1000)
+
+double elapsedSeconds(struct timespec *start);
+void reciveSlice(int network);
+double benchSink(char *path, char *data, long long size, int flags);
+double benchWrite(char *path, char *data, long long size, int flags);
+
+/**
+ * Write the same body with the sink of a download and with a plain write loop,
+ * what the body callbacks did before the sink. Then the same with every write
+ * waiting for the disk and every slice waiting for the network first: the
+ * SINK_DURABLE sink recives the next slices while io_uring writes the previous
+ * ones, the write loop does one thing at a time.
+ * Usage: sinkBench [FILE], default './out/sinkBench.bin'
+ */
+int main(int argc, char **argv)
+{
+    int i;
+    char *path, *data;
+    double sinkTime, writeTime, durableTime, syncTime;
+
+    silenceLogger();
+    path = argc > 1 ? argv[1] : DEFAULT_LOG_DIR "/sinkBench.bin";
+    data = malloc(BENCH_SLICE);
+    if (data == NULL)
+    {
+        return 1;
+    }
+    for (i = 0; i < BENCH_SLICE; ++i)
+    {
+        data[i] = 'a' + i % 26;
+    }
+
+    // the first run of each warms the page cache the same way
+    for (i = 0; i < 3; ++i)
+    {
+        sinkTime    = benchSink(path, data, BENCH_SIZE, 0);
+        writeTime   = benchWrite(path, data, BENCH_SIZE, 0);
+        durableTime = benchSink(path, data, BENCH_DURABLE_SIZE, SINK_DURABLE);
+        syncTime    = benchWrite(path, data, BENCH_DURABLE_SIZE, O_DSYNC);
+        if (sinkTime < 0 || writeTime < 0 || durableTime < 0 || syncTime < 0)
+        {
+            fprintf(stderr, "Could not write '%s'\n", path);
+            free(data);
+
+            return 1;
+        }
+
+        printf("run %d: sink %.0f MB/s, write %.0f MB/s, durable sink %.0f MB/s, O_DSYNC write %.0f MB/s\n", i + 1,
+               BENCH_SIZE / sinkTime / 1e6, BENCH_SIZE / writeTime / 1e6,
+               BENCH_DURABLE_SIZE / durableTime / 1e6, BENCH_DURABLE_SIZE / syncTime / 1e6);
+    }
+
+    unlink(path);
+    free(data);
+
+    return 0;
+}
+
+// the time the link takes to bring a slice, spinning since a sleep is too coarse
+void reciveSlice(int network)
+{
+    struct timespec start;
+
+    if (network)
+    {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        while (elapsedSeconds(&start) < (double)BENCH_SLICE / BENCH_NETWORK_RATE)
+        {
+        }
+    }
+}
+
+double elapsedSeconds(struct timespec *start)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec - start->tv_sec + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+// seconds to write size bytes through openSink, -1 on error
+double benchSink(char *path, char *data, long long size, int flags)
+{
+    long long written;
+    struct timespec start;
+    fileSink *sink;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    sink = openSink(path, 0, size, flags);
+    if (sink == NULL)
+    {
+        return -1;
+    }
+    if ((flags & SINK_DURABLE) && sink->ring == -1)
+    {
+        fprintf(stderr, "io_uring not available, the sink writes with pwrite\n");
+    }
+
+    for (written = 0; written < size; written += BENCH_SLICE)
+    {
+        reciveSlice(flags & SINK_DURABLE);
+        if (sinkWrite(sink, data, BENCH_SLICE) == -1)
+        {
+            closeSink(sink);
+
+            return -1;
+        }
+    }
+
+    return closeSink(sink) == 0 ? elapsedSeconds(&start) : -1;
+}
+
+// seconds to write size bytes with a write call per slice, -1 on error
+double benchWrite(char *path, char *data, long long size, int flags)
+{
+    int descriptor;
+    long long written;
+    struct timespec start;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    descriptor = open(path, O_WRONLY | O_CREAT | O_TRUNC | flags, 0644);
+    if (descriptor == -1)
+    {
+        return -1;
+    }
+
+    for (written = 0; written < size; written += BENCH_SLICE)
+    {
+        reciveSlice(flags & O_DSYNC);
+        if (write(descriptor, data, BENCH_SLICE) != BENCH_SLICE)
+        {
+            close(descriptor);
+
+            return -1;
+        }
+    }
+
+    return close(descriptor) == 0 ? elapsedSeconds(&start) : -1;
+}
@@ -1,16 +1,52 @@
+#include "byteRanges.h"
+#include "fileSink.h"
 #include "httpLib.h"
 #include "logger.h"
+#include "rateLimit.h"
+#include "stream.h"
 #include "utils.h"
 #include <argp.h>
 #include <stdlib.h>
 #include <string.h>
 
+// keys of the options without a short version
+enum longOptions
+{
+    OPTION_DAEMON = 256,
+    OPTION_NO_DAEMON,
+    OPTION_LIMIT_RATE,
+    OPTION_GLOBAL_RATE,
+    OPTION_RATE_WEIGHT,
+    OPTION_SOCKET_PROFILE,
+    OPTION_CHECKSUM,
+    OPTION_EXPECT_CHECKSUM,
+    OPTION_SUMMARY,
+    OPTION_STATS,
+    OPTION_URL_LIST,
+    OPTION_THREADS,
+    OPTION_PIN_THREADS,
+    OPTION_MIRROR,
+    OPTION_TEMPLATE_DATA,
+    OPTION_CACERT,
+    OPTION_CAPATH,
+    OPTION_STREAM,
+    OPTION_UNIX_SOCKET,
+    OPTION_NO_COALESCE,
+    OPTION_RANGE,
+    OPTION_DURABLE
+};
+
+char *copyArgument(char *arg);
+
 error_t optionParser(int key, char *arg, struct argp_state *state)
 {
-    int i;
+    int i, rangeCount;
+    char *separator;
     httpRequest *req = state->input;
     httpForm *newForm;
     httpHeader *newHeader;
+    byteRange *ranges;
+    httpError error;
 
     switch (key)
     {
@@ -43,9 +79,13 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
         logDebug("(--header) %s", arg);
 
         newHeader = malloc(sizeof(httpHeader));
+        if (newHeader == NULL)
+        {
+            logPanic("Could not allocate header '%s'!", arg);
+        }
 
         newHeader->lineLength = strlen(arg);
-        newHeader->line       = strdup(arg);
+        newHeader->line       = copyArgument(arg);
 
         newHeader->next = req->headers;
         req->headers    = newHeader;
@@ -55,15 +95,20 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
     case 'f':
         if (req->type == NONE || req->type == FORM)
         {
-            newForm = malloc(sizeof(httpForm));
+            newForm = calloc(1, sizeof(httpForm));
+            if (newForm == NULL)
+            {
+                logPanic("Could not allocate form entry '%s'!", arg);
+            }
 
-            newForm->entry       = urlEncode(arg);
-            newForm->entryLength = strlen(newForm->entry);
+            // encoded later, straight into the request payload
+            newForm->entry       = copyArgument(arg);
+            newForm->entryLength = strlen(arg);
             newForm->next        = req->form;
             req->type            = FORM;
             req->form            = newForm;
 
-            logDebug("(--form) %s => %s", arg, newForm->entryLength);
+            logDebug("(--form) %s", arg);
         }
         else
         {
@@ -72,13 +117,45 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
 
         break;
 
+    case 'F':
+        logDebug("(--multipart) %s", arg);
+
+        separator = strchr(arg, '=');
+        if (separator == NULL)
+        {
+            logPanic("'%s' is not in the form name=value or name=@path!", arg);
+        }
+        *separator = '\0';
+
+        // name=@path uploads the file, name=value sends value as it is
+        if (separator[1] == '@')
+        {
+            error = addPart(req, arg, NULL, separator + 2);
+        }
+        else
+        {
+            error = addPart(req, arg, separator + 1, NULL);
+        }
+        *separator = '=';
+
+        if (error == ERR_INVALID)
+        {
+            logWarn("You cannot declare multiple types of body content! Ignoring multipart body");
+        }
+        else if (error != HTTP_OK)
+        {
+            logPanic("Could not add part '%s': %s", arg, errorDescription(error));
+        }
+
+        break;
+
     case 't':
         logDebug("--text %s", arg);
 
         if (req->type == NONE)
         {
             req->type = TEXT_PLAIN;
-            req->text = strdup(arg);
+            req->text = copyArgument(arg);
         }
         else
         {
@@ -93,7 +170,7 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
         if (req->type == NONE)
         {
             req->type = JSON;
-            req->text = strdup(arg);
+            req->text = copyArgument(arg);
         }
         else
         {
@@ -102,6 +179,249 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
 
         break;
 
+    case 'o':
+        logDebug("(--output) %s", arg);
+
+        free(req->outputPath);
+        req->outputPath = copyArgument(arg);
+
+        // the log lines must not end up in the body
+        if (!strcmp(arg, SINK_STDOUT))
+        {
+            setLogStream(stderr);
+        }
+
+        break;
+
+    case 'c':
+        req->resume = 1;
+
+        break;
+
+    case OPTION_DURABLE:
+        req->durable = 1;
+
+        break;
+
+    case OPTION_DAEMON:
+        req->daemon = 1;
+
+        break;
+
+    case OPTION_NO_DAEMON:
+        req->daemon = -1;
+
+        break;
+
+    case OPTION_NO_COALESCE:
+        req->noCoalesce = 1;
+
+        break;
+
+    case OPTION_LIMIT_RATE:
+        logDebug("(--limit-rate) %s", arg);
+
+        req->limitRate = parseRate(arg);
+        if (req->limitRate == -1)
+        {
+            logPanic("Invalid rate '%s'!", arg);
+        }
+
+        break;
+
+    case OPTION_GLOBAL_RATE:
+        logDebug("(--global-rate) %s", arg);
+
+        if (parseRate(arg) == -1)
+        {
+            logPanic("Invalid rate '%s'!", arg);
+        }
+        setGlobalRate(parseRate(arg));
+
+        break;
+
+    case OPTION_RATE_WEIGHT:
+        logDebug("(--rate-weight) %s", arg);
+
+        req->rateWeight = strtol(arg, &separator, 10);
+        if (*separator != '\0' || *arg == '\0' || req->rateWeight < 1)
+        {
+            logPanic("Invalid rate weight '%s'!", arg);
+        }
+
+        break;
+
+    case OPTION_SOCKET_PROFILE:
+        logDebug("(--socket-profile) %s", arg);
+
+        for (i = 0; i < SOCKET_PROFILE_MAX; ++i)
+        {
+            if (!strcasecmp(arg, socketProfileNames[i]))
+            {
+                req->socketProfile = i;
+
+                return 0;
+            }
+        }
+
+        logPanic("'%s' is not a socket profile!", arg);
+
+    case OPTION_CHECKSUM:
+        logDebug("(--checksum) %s", arg);
+
+        for (i = CHECKSUM_NONE + 1; i < CHECKSUM_MAX; ++i)
+        {
+            if (!strcasecmp(arg, checksumNames[i]))
+            {
+                req->checksum = i;
+
+                return 0;
+            }
+        }
+
+        logPanic("'%s' checksum not supported! Use sha256, sha512 or blake2b", arg);
+
+    case OPTION_EXPECT_CHECKSUM:
+        logDebug("(--expect-checksum) %s", arg);
+
+        free(req->expectedChecksum);
+        req->expectedChecksum = copyArgument(arg);
+
+        break;
+
+    case OPTION_SUMMARY:
+        logDebug("(--summary) %s", arg);
+
+        free(req->summaryPath);
+        req->summaryPath = copyArgument(arg);
+
+        break;
+
+    case OPTION_STATS:
+        logDebug("(--stats) %s", arg);
+
+        if (arg == NULL || !strcasecmp(arg, "text"))
+        {
+            req->stats = 1;
+        }
+        else if (!strcasecmp(arg, "json"))
+        {
+            req->stats = 2;
+        }
+        else
+        {
+            logPanic("'%s' stats format not supported! Use text or json", arg);
+        }
+
+        break;
+
+    case OPTION_URL_LIST:
+        logDebug("(--url-list) %s", arg);
+
+        free(req->urlList);
+        req->urlList = copyArgument(arg);
+
+        break;
+
+    case OPTION_THREADS:
+        logDebug("(--threads) %s", arg);
+
+        req->threads = strtol(arg, &separator, 10);
+        if (*separator != '\0' || req->threads < 1)
+        {
+            logPanic("Invalid number of threads '%s'!", arg);
+        }
+
+        break;
+
+    case OPTION_PIN_THREADS:
+        req->pinThreads = 1;
+
+        break;
+
+    case OPTION_MIRROR:
+        logDebug("(--mirror) %s", arg);
+
+        req->mirrorDepth = strtol(arg, &separator, 10);
+        if (*separator != '\0' || *arg == '\0' || req->mirrorDepth < 0)
+        {
+            logPanic("Invalid mirror depth '%s'!", arg);
+        }
+
+        break;
+
+    case OPTION_TEMPLATE_DATA:
+        logDebug("(--template-data) %s", arg);
+
+        free(req->templateData);
+        req->templateData = copyArgument(arg);
+
+        break;
+
+    case OPTION_CACERT:
+        logDebug("(--cacert) %s", arg);
+
+        free(req->caFile);
+        req->caFile = copyArgument(arg);
+
+        break;
+
+    case OPTION_CAPATH:
+        logDebug("(--capath) %s", arg);
+
+        free(req->caPath);
+        req->caPath = copyArgument(arg);
+
+        break;
+
+    case OPTION_UNIX_SOCKET:
+        logDebug("(--unix-socket) %s", arg);
+
+        free(req->unixSocket);
+        req->unixSocket = copyArgument(arg);
+
+        break;
+
+    case 'k':
+        req->insecure = 1;
+
+        break;
+
+    case OPTION_RANGE:
+        logDebug("(--range) %s", arg);
+
+        if (parseRanges(arg, &ranges, &rangeCount) != HTTP_OK)
+        {
+            logPanic("'%s' is not a list of byte ranges! Use e.g. 0-1023,4096-8191,-512", arg);
+        }
+        free(ranges);
+
+        free(req->ranges);
+        req->ranges = copyArgument(arg);
+
+        break;
+
+    case OPTION_STREAM:
+        logDebug("(--stream) %s", arg);
+
+        if (arg == NULL || !strcasecmp(arg, "events"))
+        {
+            req->stream = STREAM_EVENTS;
+        }
+        else if (!strcasecmp(arg, "raw"))
+        {
+            req->stream = STREAM_RAW;
+        }
+        else
+        {
+            logPanic("'%s' stream mode not supported! Use events or raw", arg);
+        }
+
+        // the log lines must not end up in the stream
+        setLogStream(stderr);
+
+        break;
+
     case ARGP_KEY_ARG:
         logDebug("(non option arg) %s", arg);
 
@@ -112,17 +432,217 @@ error_t optionParser(int key, char *arg, struct argp_state *state)
             break;
         }
 
-        parseUrl(arg, req);
+        if (parseUrl(arg, req) != HTTP_OK)
+        {
+            argp_usage(state);
+        }
 
         break;
 
     case ARGP_KEY_END:
+        if (req->daemon == 1)
+        {
+            // the daemon verifies the servers of every client, they would all get the weaker trust
+            if (req->insecure || req->caFile != NULL || req->caPath != NULL)
+            {
+                logError("--daemon verifies the servers with the system certificates, "
+                         "it does not work with --insecure, --cacert and --capath!");
+                argp_usage(state);
+            }
+
+            break;
+        }
+
+        // only POST, PUT and DELETE send a body, a GET one would announce it and never send it
+        if (req->type != NONE && req->method == GET)
+        {
+            logVerbose("A body is sent with POST, using it instead of GET");
+            req->method = POST;
+        }
+        else if (req->type != NONE && req->method != POST && req->method != PUT && req->method != DELETE)
+        {
+            logError("%s requests can not have a body!", methodNames[req->method]);
+            argp_usage(state);
+        }
+
+        if ((req->urlList != NULL) + (req->mirrorDepth >= 0) + (req->templateData != NULL) + (req->stream != 0) +
+                (req->ranges != NULL) > 1)
+        {
+            logError("Only one of --url-list, --mirror, --template-data, --stream and --range can be used!");
+            argp_usage(state);
+        }
+
+        if (req->ranges != NULL)
+        {
+            if (req->resume || req->checksum != CHECKSUM_NONE || req->expectedChecksum != NULL || req->summaryPath != NULL ||
+                (req->outputPath != NULL && !strcmp(req->outputPath, SINK_STDOUT)))
+            {
+                logError("--range writes the ranges at their offset in a file, it does not work with --continue, "
+                         "--checksum, --expect-checksum, --summary and --output -!");
+                argp_usage(state);
+            }
+
+            if (req->method != GET || req->type != NONE)
+            {
+                logError("Ranges can only be asked with GET and no body!");
+                argp_usage(state);
+            }
+
+            if (req->hostLength == 0 || req->pathLength == 0)
+            {
+                logError("Missing/Invalid url!");
+                argp_usage(state);
+            }
+
+            if (req->threads != 0)
+            {
+                logWarn("--threads only applies to --url-list, --mirror and --template-data, ignoring it");
+            }
+
+            break;
+        }
+
+        if (req->stream != 0)
+        {
+            if (req->outputPath != NULL || req->resume || req->checksum != CHECKSUM_NONE ||
+                req->expectedChecksum != NULL || req->summaryPath != NULL)
+            {
+                logError("--stream prints the body to stdout, it does not work with --output, --continue, "
+                         "--checksum, --expect-checksum and --summary!");
+                argp_usage(state);
+            }
+
+            if (req->type == MULTIPART)
+            {
+                logError("Files can not be uploaded with --stream!");
+                argp_usage(state);
+            }
+
+            if (req->hostLength == 0 || req->pathLength == 0)
+            {
+                logError("Missing/Invalid url!");
+                argp_usage(state);
+            }
+
+            if (req->threads != 0)
+            {
+                logWarn("--threads only applies to --url-list, --mirror and --template-data, ignoring it");
+            }
+
+            break;
+        }
+
+        if (req->templateData != NULL)
+        {
+            if (req->outputPath != NULL || req->resume || req->expectedChecksum != NULL || req->summaryPath != NULL)
+            {
+                logError("--output, --continue, --expect-checksum and --summary work on a single url, not with --template-data!");
+                argp_usage(state);
+            }
+
+            if (req->type == FORM || req->type == MULTIPART)
+            {
+                logError("Only --text and --json bodies can be templates!");
+                argp_usage(state);
+            }
+
+            if (req->hostLength == 0)
+            {
+                logError("Missing/Invalid url!");
+                argp_usage(state);
+            }
+
+            if (req->threads == 0)
+            {
+                req->threads = 1;
+            }
+
+            break;
+        }
+
+        if (req->urlList != NULL)
+        {
+            if (req->outputPath != NULL || req->resume || req->expectedChecksum != NULL || req->summaryPath != NULL)
+            {
+                logError("--output, --continue, --expect-checksum and --summary work on a single url, not with --url-list!");
+                argp_usage(state);
+            }
+
+            if (req->type == FORM || req->type == MULTIPART)
+            {
+                logError("Only --text and --json bodies can be sent with --url-list!");
+                argp_usage(state);
+            }
+
+            if (req->hostLength != 0)
+            {
+                logWarn("Downloading the urls of '%s', ignoring the url argument", req->urlList);
+            }
+
+            if (req->threads == 0)
+            {
+                req->threads = 1;
+            }
+
+            break;
+        }
+
+        if (req->mirrorDepth >= 0)
+        {
+            if (req->resume || req->expectedChecksum != NULL || req->summaryPath != NULL)
+            {
+                logError("--continue, --expect-checksum and --summary work on a single url, not with --mirror!");
+                argp_usage(state);
+            }
+
+            if (req->outputPath != NULL && !strcmp(req->outputPath, SINK_STDOUT))
+            {
+                logError("--mirror saves a directory tree, --output must be a directory!");
+                argp_usage(state);
+            }
+
+            if (req->type == FORM || req->type == MULTIPART)
+            {
+                logError("Only --text and --json bodies can be sent with --mirror!");
+                argp_usage(state);
+            }
+
+            if (req->hostLength == 0)
+            {
+                logError("Missing/Invalid url!");
+                argp_usage(state);
+            }
+
+            if (req->threads == 0)
+            {
+                req->threads = 1;
+            }
+
+            break;
+        }
+
+        if (req->threads != 0)
+        {
+            logWarn("--threads only applies to --url-list, --mirror and --template-data, ignoring it");
+        }
+
         if (req->hostLength == 0 || req->pathLength == 0)
         {
             logError("Missing/Invalid url!");
             argp_usage(state);
         }
 
+        if (req->resume && (req->outputPath == NULL || !strcmp(req->outputPath, SINK_STDOUT)))
+        {
+            logError("--continue needs --output to know which file to continue!");
+            argp_usage(state);
+        }
+
+        if (req->expectedChecksum != NULL && req->checksum == CHECKSUM_NONE)
+        {
+            req->checksum = CHECKSUM_SHA256;
+        }
+
         break;
 
     default:
@@ -139,15 +659,87 @@ void parseArguments(int argc, char **argv, httpRequest *req)
         {"verbose", 'v', 0, 0, "Enable verbose console output"},
         {"quiet", 'q', 0, 0, "Suppress all console output except errors"},
         {"method", 'm', "METHOD", 0, "Choose the method of the HTTP/S request. \n"
-                                     "Methods available GET (default), HEAD, OPTIONS, POST, PUT, DELETE"},
+                                     "Methods available GET (default, POST with a body), HEAD, OPTIONS, POST, PUT, DELETE"},
         {"header", 'h', "'name: value'", 0, "Add the name value pair as header to the request, can be used multiple times."},
         {"form", 'f', "'key=value'", 0, "Add an html form body, can be used multiple times to add multiple key value pairs"},
+        {"multipart", 'F', "'name=@path'", 0, "Add a multipart/form-data part with the content of the file at path, "
+                                              "or with value if given as name=value. Can be used multiple times, "
+                                              "files are streamed while sending"},
         {"text", 't', "'content'", 0, "Add a text body to the request"},
         {"json", 'j', "'json string'", 0, "Add a json body to the request.\n"
                                           "It also add the header with the correct encoding."},
+        {"output", 'o', "FILE", 0, "Save the response body to FILE instead of the './out' directory, "
+                                   "- for stdout. Plain http bodies go from the socket to a file or pipe with splice"},
+        {"continue", 'c', 0, 0, "Continue a partial download previously saved with --output"},
+        {"durable", OPTION_DURABLE, 0, 0, "Return from every write of the body only once it is on the disk, "
+                                          "keeping several writes in flight with io_uring"},
+        {"checksum", OPTION_CHECKSUM, "ALGORITHM", 0, "Hash the body while it arrives and print the digest. \n"
+                                                      "Algorithms available sha256, sha512, blake2b"},
+        {"expect-checksum", OPTION_EXPECT_CHECKSUM, "DIGEST", 0, "Fail if the hex digest of the body is not DIGEST, "
+                                                                 "uses sha256 if --checksum is not given"},
+        {"summary", OPTION_SUMMARY, "FILE", 0, "Write a JSON summary of the transfer to FILE, - for stdout"},
+        {"stats", OPTION_STATS, "FORMAT", OPTION_ARG_OPTIONAL, "Print allocations, copies, syscalls and peak memory "
+                                                               "on exit, as text (default) or json. "
+                                                               "They are also added to the --summary"},
+        {"daemon", OPTION_DAEMON, 0, 0, "Stay in the foreground serving the requests of the other wannabeCurl "
+                                        "processes of the user, several at a time, keeping connections and TLS "
+                                        "sessions open between them"},
+        {"no-daemon", OPTION_NO_DAEMON, 0, 0, "Do not hand the request to a running daemon"},
+        {"limit-rate", OPTION_LIMIT_RATE, "RATE", 0, "Transfer at most RATE bytes per second, "
+                                                     "suffixes K, M and G are allowed (e.g. 200K)"},
+        {"cacert", OPTION_CACERT, "FILE", 0, "Trust the certificates in the PEM bundle FILE instead of the system ones"},
+        {"capath", OPTION_CAPATH, "DIR", 0, "Trust the certificates in DIR, hashed with 'openssl rehash', "
+                                            "instead of the system ones"},
+        {"insecure", 'k', 0, 0, "Do not verify the server certificate"},
+        {"unix-socket", OPTION_UNIX_SOCKET, "PATH", 0, "Connect to the unix socket PATH instead of the host of URL, "
+                                                       "@name for the abstract namespace"},
+        {"stream", OPTION_STREAM, "MODE", OPTION_ARG_OPTIONAL, "Print the body to stdout while it arrives. "
+                                                               "events (default): print the data of every "
+                                                               "text/event-stream event on its own line, "
+                                                               "reconnecting with Last-Event-ID when the stream ends. "
+                                                               "raw: print the body as it is"},
+        {"range", OPTION_RANGE, "RANGES", 0, "Fetch only the byte RANGES of URL (e.g. 0-1023,4096-8191,-512) in a single "
+                                             "request, writing each one at its offset in --output, a sparse file"},
+        {"socket-profile", OPTION_SOCKET_PROFILE, "PROFILE", 0, "Tune the sockets for the transfer. "
+                                                                "Profiles available default, low-latency (no delay, quick ack, "
+                                                                "fast open, busy polling), bulk (fast open, 4 MB buffers)"},
+        {"global-rate", OPTION_GLOBAL_RATE, "RATE", 0, "Share RATE bytes per second among all the transfers, "
+                                                       "useful with --daemon"},
+        {"rate-weight", OPTION_RATE_WEIGHT, "N", 0, "Give the transfers N times the --global-rate share of a "
+                                                   "transfer of weight 1. What a transfer leaves unused goes "
+                                                   "to the others. Default 1"},
+        {"url-list", OPTION_URL_LIST, "FILE", 0, "Download every url in FILE (one per line, - for stdin) "
+                                                 "instead of URL, saving the bodies in './out'"},
+        {"threads", OPTION_THREADS, "N", 0, "Share the urls of --url-list, --mirror or --template-data among N threads, "
+                                           "each with its own connections. Default 1"},
+        {"pin-threads", OPTION_PIN_THREADS, 0, 0, "Bind every --threads thread to its own CPU"},
+        {"no-coalesce", OPTION_NO_COALESCE, 0, 0, "Download every copy of a url of --url-list, by default a GET or HEAD "
+                                                  "of a url already in flight shares its transfer and its body is linked"},
+        {"mirror", OPTION_MIRROR, "DEPTH", 0, "Download URL and the pages and files of the same site it links to, "
+                                              "up to DEPTH links away, saving them as host/path in --output "
+                                              "(default './out')"},
+        {"template-data", OPTION_TEMPLATE_DATA, "FILE", 0, "Send a request for every row of FILE (CSV with a header "
+                                                           "line or JSON Lines, - for stdin), filling the {{column}} "
+                                                           "placeholders of the URL path, headers and body"},
         {0}};
 
     struct argp argp = {options, optionParser, "URL"};
 
     argp_parse(&argp, argc, argv, 0, 0, req);
 }
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// the options are parsed once at start, without memory there is nothing to do
+char *copyArgument(char *arg)
+{
+    char *copy;
+
+    copy = strdup(arg);
+    if (copy == NULL)
+    {
+        logPanic("Could not allocate the argument '%s'!", arg);
+    }
+
+    return copy;
+}
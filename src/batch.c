@@ -0,0 +1,1045 @@
+#define _GNU_SOURCE
+#include "batch.h"
+#include "checksum.h"
+#include "dnsCache.h"
+#include "fileSink.h"
+#include "httpHandle.h"
+#include "linkScanner.h"
+#include "logger.h"
+#include "rateLimit.h"
+#include "recordReader.h"
+#include "requestTemplate.h"
+#include "stats.h"
+#include "urlSet.h"
+#include "utils.h"
+#include "workQueue.h"
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+typedef struct batchJob
+{
+    /** NULL for the requests of a template */
+    char *url;
+    /** values for the template, NULL for urls */
+    templateRecord *record;
+    /** order in which the url was queued, tells apart the files of the same host */
+    int index;
+    /** links followed from the first page to reach this one */
+    int depth;
+    /** next job attached to the same flight */
+    struct batchJob *next;
+} batchJob;
+
+/** Transfer of a url in progress, the jobs of the same url taken meanwhile share its result */
+typedef struct batchFlight
+{
+    /** url with the scheme and host in lowercase and the path normalized, as resolveUrl writes it */
+    char *key;
+    /** index of the job making the transfer */
+    int index;
+    /** jobs waiting for the result, finished by the worker of the transfer */
+    batchJob *followers;
+    struct batchFlight *next;
+} batchFlight;
+
+/** Shared by every worker, the jobs of a mirror are added while others run */
+typedef struct batchState
+{
+    httpRequest *req;
+    workQueue *queue;
+
+    pthread_mutex_t lock;
+    /** signaled when a job is added and when the last one ends */
+    pthread_cond_t changed;
+    /** jobs queued or running, the workers stop when none is left */
+    int pending;
+    int queued;
+
+    // MIRROR
+    /** urls already queued, never downloaded twice */
+    urlSet visited;
+    /** 'scheme://host' of the first page or of the template, links to other sites are not followed */
+    char *origin;
+    int originLength;
+    /** directory the site is saved in */
+    char *root;
+    /** held while a worker makes the directories of a page and opens it, another
+     *  one could move the page out of the way of a directory in between */
+    pthread_mutex_t pathLock;
+
+    // TEMPLATE
+    requestTemplate *compiled;
+    /** rows of the data file, read while the workers send the ones before */
+    recordReader records;
+    /** 1 while rows are still being queued, the workers wait for them */
+    int feeding;
+
+    // COALESCING
+    /** transfers in progress that the jobs of the same url attach to */
+    batchFlight *flights;
+    /** jobs that shared the transfer of another one */
+    int coalesced;
+} batchState;
+
+typedef struct batchWorker
+{
+    int id;
+    pthread_t thread;
+    batchState *batch;
+    /** connections of this worker only, never touched by the others */
+    handleSlot pool[BATCH_POOL_SIZE];
+    long jobs;
+    int failed;
+
+    // TRANSFER IN PROGRESS
+    batchJob *job;
+    httpHandle *handle;
+    fileSink *sink;
+    char *outputPath;
+    /** links of the page, NULL unless it is mirrored deeper */
+    linkScanner *scanner;
+    /** requests filled from the template, reused by every job */
+    byteBuffer payload;
+    /** flight of the job, NULL if its url can not be shared */
+    batchFlight *flight;
+} batchWorker;
+
+int queueUrlList(batchState *batch, int threads);
+void prefetchUrl(char *url);
+httpError openTemplate(batchState *batch);
+httpError queueRecords(batchState *batch, int threads);
+httpError addJob(batchState *batch, int worker, char *url, templateRecord *record, int depth);
+batchJob *nextJob(batchWorker *worker);
+void finishJob(batchState *batch);
+void *runWorker(void *data);
+int joinFlight(batchWorker *worker, batchJob *job);
+void landFlight(batchWorker *worker, int status, httpError error, char *digest);
+int runJob(batchWorker *worker, batchJob *job);
+httpError setupJob(batchWorker *worker, batchJob *job);
+int saveBody(void *userData, char *data, int length);
+char *listPath(char *host, int index, contentType type);
+char *mirrorPath(batchState *batch, char *url);
+int makeParents(char **path);
+int queueLink(void *userData, char *link, int length);
+
+int runBatch(httpRequest *req)
+{
+    int i, threads, started, failed;
+    char *start;
+    batchState batch;
+    batchWorker *workers;
+    batchJob *job;
+    httpError error;
+
+    memset(&batch, 0, sizeof(batch));
+    batch.req = req;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_cond_init(&batch.changed, NULL);
+    pthread_mutex_init(&batch.pathLock, NULL);
+    initUrlSet(&batch.visited);
+
+    threads     = req->threads;
+    batch.queue = createWorkQueue(threads);
+    workers     = calloc(threads, sizeof(batchWorker));
+    error       = batch.queue != NULL && workers != NULL ? HTTP_OK : ERR_MEMORY;
+
+    // a mirror and the requests of a template stay on the host of the url
+    if (error == HTTP_OK && req->urlList == NULL)
+    {
+        batch.originLength = asprintf(&batch.origin, "%s://%s", req->secure ? "https" : "http", req->host);
+        if (batch.originLength == -1)
+        {
+            batch.origin = NULL;
+            error        = ERR_MEMORY;
+        }
+        else
+        {
+            lowerString(batch.origin);
+        }
+    }
+
+    if (error == HTTP_OK && req->mirrorDepth >= 0)
+    {
+        batch.root = req->outputPath != NULL ? req->outputPath : "./out";
+
+        // the first page is written as every link to it will be
+        start = resolveUrl(batch.origin, req->path, req->pathLength);
+        error = start != NULL ? addJob(&batch, 0, start, NULL, 0) : ERR_INVALID;
+    }
+    else if (error == HTTP_OK && req->templateData != NULL)
+    {
+        error = openTemplate(&batch);
+    }
+    else if (error == HTTP_OK && queueUrlList(&batch, threads) == -1)
+    {
+        error = ERR_INVALID;
+    }
+
+    started = 0;
+    if (error != HTTP_OK)
+    {
+        logError("Could not queue the urls: %s", errorDescription(error));
+    }
+    else
+    {
+        if (req->mirrorDepth >= 0)
+        {
+            logInfo("Mirroring %s to depth %d in '%s' with %d threads", batch.origin, req->mirrorDepth, batch.root, threads);
+        }
+        else if (req->templateData != NULL)
+        {
+            logInfo("Sending the rows of '%s' to %s with %d threads", req->templateData, batch.origin, threads);
+        }
+        else
+        {
+            logInfo("Downloading %d urls with %d threads", batch.queued, threads);
+        }
+
+        // the jobs of a worker that could not start are stolen by the others
+        for (; started < threads; ++started)
+        {
+            workers[started].id    = started;
+            workers[started].batch = &batch;
+
+            if (pthread_create(&workers[started].thread, NULL, runWorker, &workers[started]) != 0)
+            {
+                logError("Could not start worker thread %d!", started);
+
+                break;
+            }
+        }
+    }
+
+    // the rows are queued while the workers send them
+    if (batch.feeding)
+    {
+        if (started > 0 && error == HTTP_OK)
+        {
+            error = queueRecords(&batch, started);
+            if (error != HTTP_OK)
+            {
+                logError("Could not queue the rows: %s", errorDescription(error));
+            }
+        }
+
+        pthread_mutex_lock(&batch.lock);
+        batch.feeding = 0;
+        pthread_cond_broadcast(&batch.changed);
+        pthread_mutex_unlock(&batch.lock);
+        closeRecords(&batch.records);
+    }
+
+    failed = 0;
+    for (i = 0; i < started; ++i)
+    {
+        pthread_join(workers[i].thread, NULL);
+        failed += workers[i].failed;
+    }
+
+    // left over when no worker could start
+    while (batch.queue != NULL && (job = takeWork(batch.queue, 0)) != NULL)
+    {
+        ++failed;
+        free(job->url);
+        free(job->record);
+        free(job);
+    }
+
+    if (error == HTTP_OK)
+    {
+        logInfo("Downloaded %d of %d urls", batch.queued - failed, batch.queued);
+        if (batch.coalesced > 0)
+        {
+            logInfo("%d of them shared the transfer of the same url", batch.coalesced);
+        }
+    }
+    else
+    {
+        failed = -1;
+    }
+
+    destroyWorkQueue(batch.queue);
+    free(workers);
+    free(batch.origin);
+    destroyTemplate(batch.compiled);
+    freeUrlSet(&batch.visited);
+    pthread_cond_destroy(&batch.changed);
+    pthread_mutex_destroy(&batch.pathLock);
+    pthread_mutex_destroy(&batch.lock);
+
+    return failed;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// one url per line, empty lines and lines starting with '#' are skipped, -1 if not all could be queued
+int queueUrlList(batchState *batch, int threads)
+{
+    int length, failed;
+    char *line, *url, *path;
+    size_t lineCapacity;
+    FILE *fp;
+
+    path = batch->req->urlList;
+    fp   = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (fp == NULL)
+    {
+        logError("Could not open url list '%s'!", path);
+
+        return -1;
+    }
+
+    line         = NULL;
+    lineCapacity = 0;
+    failed       = 0;
+    while ((length = getline(&line, &lineCapacity, fp)) != -1)
+    {
+        while (length > 0 && (line[length - 1] == '\n' || line[length - 1] == '\r' || line[length - 1] == ' '))
+        {
+            line[--length] = '\0';
+        }
+        if (length == 0 || line[0] == '#')
+        {
+            continue;
+        }
+
+        // the connection of the job starts with its host already resolved
+        if (batch->req->unixSocket == NULL)
+        {
+            prefetchUrl(line);
+        }
+
+        // every worker starts from its own slice of the list, in order
+        url = strdup(line);
+        if (url == NULL || addJob(batch, batch->queued % threads, url, NULL, 0) != HTTP_OK)
+        {
+            logError("Could not allocate the url list!");
+            failed = 1;
+
+            break;
+        }
+    }
+
+    free(line);
+    if (fp != stdin)
+    {
+        fclose(fp);
+    }
+
+    if (batch->queued == 0 && !failed)
+    {
+        logError("No url found in '%s'!", path);
+    }
+
+    return batch->queued > 0 && !failed ? 0 : -1;
+}
+
+// resolve the host of url in background, while the jobs before it run
+void prefetchUrl(char *url)
+{
+    httpRequest parsedUrl;
+
+    memset(&parsedUrl, 0, sizeof(parsedUrl));
+    if (parseUrl(url, &parsedUrl) == HTTP_OK)
+    {
+        prefetchHost(parsedUrl.host, parsedUrl.secure ? HTTPS_PORT : HTTP_PORT);
+    }
+    free(parsedUrl.host);
+    free(parsedUrl.path);
+}
+
+// every row of the data file is a request, compiled once and filled by the workers
+httpError openTemplate(batchState *batch)
+{
+    httpError error;
+
+    error = generateHeaders(batch->req);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    // closed once the rows are queued, or right away on errors
+    batch->feeding = 1;
+
+    error = openRecords(&batch->records, batch->req->templateData);
+    if (error == HTTP_OK)
+    {
+        error = compileTemplate(batch->req, &batch->records, &batch->compiled);
+    }
+
+    return error;
+}
+
+// at most BATCH_QUEUED_ROWS rows per thread wait in the queue, the file is never loaded whole
+httpError queueRecords(batchState *batch, int threads)
+{
+    templateRecord *record;
+    httpError error;
+
+    while ((error = readRecord(&batch->records, &record)) == HTTP_OK && record != NULL)
+    {
+        pthread_mutex_lock(&batch->lock);
+        while (batch->pending >= threads * BATCH_QUEUED_ROWS)
+        {
+            pthread_cond_wait(&batch->changed, &batch->lock);
+        }
+        pthread_mutex_unlock(&batch->lock);
+
+        error = addJob(batch, batch->queued % threads, NULL, record, 0);
+        if (error != HTTP_OK)
+        {
+            break;
+        }
+    }
+
+    if (error == HTTP_OK && batch->queued == 0)
+    {
+        logError("No rows found in '%s'!", batch->req->templateData);
+
+        return ERR_PARSE;
+    }
+
+    return error;
+}
+
+// queue url or record on worker, they are owned by the job or freed if the url was already seen
+httpError addJob(batchState *batch, int worker, char *url, templateRecord *record, int depth)
+{
+    int isNew;
+    batchJob *job;
+    httpError error;
+
+    job   = NULL;
+    error = HTTP_OK;
+
+    pthread_mutex_lock(&batch->lock);
+    isNew = batch->req->mirrorDepth >= 0 ? addUrl(&batch->visited, url) : 1;
+    if (isNew == 1)
+    {
+        job   = malloc(sizeof(batchJob));
+        error = job != NULL ? HTTP_OK : ERR_MEMORY;
+    }
+    else if (isNew == -1)
+    {
+        error = ERR_MEMORY;
+    }
+
+    if (job != NULL)
+    {
+        job->url    = url;
+        job->record = record;
+        job->index  = batch->queued + 1;
+        job->depth  = depth;
+
+        error = pushWork(batch->queue, worker, job);
+        if (error == HTTP_OK)
+        {
+            ++batch->queued;
+            ++batch->pending;
+            pthread_cond_broadcast(&batch->changed);
+        }
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (job == NULL || error != HTTP_OK)
+    {
+        free(url);
+        free(record);
+        free(job);
+    }
+
+    return error;
+}
+
+// a worker with nothing to do waits while the running jobs may still add links
+batchJob *nextJob(batchWorker *worker)
+{
+    batchState *batch = worker->batch;
+    batchJob *job;
+
+    job = takeWork(batch->queue, worker->id);
+    if (job != NULL)
+    {
+        return job;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    while ((job = takeWork(batch->queue, worker->id)) == NULL && (batch->pending > 0 || batch->feeding))
+    {
+        pthread_cond_wait(&batch->changed, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    return job;
+}
+
+void finishJob(batchState *batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    // the rows of a template wait for room in the queue
+    if (--batch->pending == 0 || batch->feeding)
+    {
+        pthread_cond_broadcast(&batch->changed);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void *runWorker(void *data)
+{
+    batchWorker *worker = data;
+    batchJob *job;
+    cpu_set_t cpus;
+
+    if (worker->batch->req->pinThreads)
+    {
+        CPU_ZERO(&cpus);
+        CPU_SET(worker->id % sysconf(_SC_NPROCESSORS_ONLN), &cpus);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus) != 0)
+        {
+            logWarn("Could not pin worker thread %d to a CPU", worker->id);
+        }
+    }
+
+    initBuffer(&worker->payload);
+    while ((job = nextJob(worker)) != NULL)
+    {
+        // finished with the transfer it attached to
+        if (joinFlight(worker, job))
+        {
+            continue;
+        }
+
+        if (runJob(worker, job) == -1)
+        {
+            ++worker->failed;
+        }
+
+        free(job->url);
+        free(job->record);
+        free(job);
+        finishJob(worker->batch);
+    }
+
+    destroyPool(worker->pool, BATCH_POOL_SIZE);
+    freeBuffer(&worker->payload);
+
+    return NULL;
+}
+
+/**
+ * A GET or HEAD of a url already being transferred attaches to that transfer,
+ * 1 if it did: the job is finished by the worker of the transfer. Otherwise
+ * the job starts a flight of its own when its url can be shared.
+ * Every job of a url list sends the same headers, the normalized url is the
+ * whole key.
+ */
+int joinFlight(batchWorker *worker, batchJob *job)
+{
+    int index;
+    char *key;
+    batchState *batch = worker->batch;
+    httpRequest *req  = batch->req;
+    batchFlight *flight;
+
+    worker->flight = NULL;
+    if (req->noCoalesce || job->url == NULL || req->mirrorDepth >= 0 || (req->method != GET && req->method != HEAD))
+    {
+        return 0;
+    }
+
+    // without memory, or for a url that does not parse, the url is just not shared
+    key = resolveUrl(job->url, job->url, strlen(job->url));
+    if (key == NULL)
+    {
+        return 0;
+    }
+
+    pthread_mutex_lock(&batch->lock);
+    for (flight = batch->flights; flight != NULL && strcmp(flight->key, key); flight = flight->next)
+    {
+    }
+
+    if (flight != NULL)
+    {
+        // the flight is freed by its worker as soon as the lock is released
+        index             = flight->index;
+        job->next         = flight->followers;
+        flight->followers = job;
+        ++batch->coalesced;
+        countStat(coalescedRequests, 1);
+        pthread_mutex_unlock(&batch->lock);
+
+        logVerbose("[%d] %s shares the transfer of [%d]", job->index, job->url, index);
+        free(key);
+
+        return 1;
+    }
+
+    flight = calloc(1, sizeof(batchFlight));
+    if (flight != NULL)
+    {
+        flight->key    = key;
+        flight->index  = job->index;
+        flight->next   = batch->flights;
+        batch->flights = flight;
+        worker->flight = flight;
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (flight == NULL)
+    {
+        free(key);
+    }
+
+    return 0;
+}
+
+// the result of the transfer is the result of every job attached, the body is linked to their files
+void landFlight(batchWorker *worker, int status, httpError error, char *digest)
+{
+    int failed;
+    char *path;
+    batchState *batch   = worker->batch;
+    batchFlight *flight = worker->flight;
+    batchFlight **slot;
+    batchJob *follower;
+
+    // unlinked first, the jobs taken from now on make a new transfer
+    pthread_mutex_lock(&batch->lock);
+    for (slot = &batch->flights; *slot != flight; slot = &(*slot)->next)
+    {
+    }
+    *slot = flight->next;
+    pthread_mutex_unlock(&batch->lock);
+
+    while ((follower = flight->followers) != NULL)
+    {
+        flight->followers = follower->next;
+
+        path   = NULL;
+        failed = error != HTTP_OK || status >= 400;
+        if (error != HTTP_OK)
+        {
+            logError("[%d] %s: %s, shared with [%d]", follower->index, follower->url, errorDescription(error), flight->index);
+        }
+        else if (worker->outputPath == NULL)
+        {
+            logInfo("[%d] Status %d: no body, shared with [%d]", follower->index, status, flight->index);
+        }
+        else
+        {
+            path = listPath(worker->handle->req->host, follower->index, worker->handle->res->type);
+            if (path == NULL || link(worker->outputPath, path) == -1)
+            {
+                logError("[%d] Could not link the body of [%d] to '%s'!", follower->index, flight->index,
+                         path != NULL ? path : "");
+                failed = 1;
+            }
+            else
+            {
+                logInfo("[%d] Status %d: body of [%d] linked to '%s'", follower->index, status, flight->index, path);
+            }
+        }
+        if (digest != NULL)
+        {
+            logInfo("[%d] %s: %s", follower->index, checksumNames[batch->req->checksum], digest);
+        }
+        worker->failed += failed;
+
+        free(path);
+        free(follower->url);
+        free(follower->record);
+        free(follower);
+        finishJob(batch);
+    }
+
+    free(flight->key);
+    free(flight);
+    worker->flight = NULL;
+}
+
+// download a single url, -1 on failure or error status
+int runJob(batchWorker *worker, batchJob *job)
+{
+    int status;
+    char *digest, *url;
+    httpRequest *req = worker->batch->req;
+    httpResponse *res;
+    linkScanner scanner;
+    httpError error;
+
+    worker->job        = job;
+    worker->sink       = NULL;
+    worker->outputPath = NULL;
+    worker->scanner    = NULL;
+    url                = job->url != NULL ? job->url : worker->batch->origin;
+
+    // the links of the last level would not be downloaded
+    if (job->depth < req->mirrorDepth)
+    {
+        initScanner(&scanner);
+        worker->scanner = &scanner;
+    }
+
+    error = setupJob(worker, job);
+    if (error == HTTP_OK)
+    {
+        logInfo("[%d] %s %s", job->index, methodNames[req->method], url);
+
+        error = performRequest(worker->handle);
+    }
+    if (worker->scanner != NULL)
+    {
+        freeScanner(worker->scanner);
+    }
+    if (worker->handle == NULL)
+    {
+        logError("[%d] %s: %s", job->index, url, errorDescription(error));
+        if (worker->flight != NULL)
+        {
+            landFlight(worker, 0, error, NULL);
+        }
+
+        return -1;
+    }
+    res = worker->handle->res;
+
+    // idle handles must not take a share of the global rate
+    removeRateLimit(worker->handle);
+
+    if (worker->sink != NULL && closeSink(worker->sink) == -1 && error == HTTP_OK)
+    {
+        error = ERR_FILE;
+    }
+
+    digest = NULL;
+    if (res->digest != NULL)
+    {
+        if (error == HTTP_OK)
+        {
+            digest = finishDigest(res->digest);
+        }
+        else
+        {
+            EVP_MD_CTX_free(res->digest);
+        }
+        res->digest = NULL;
+    }
+
+    status = res->status;
+    if (error != HTTP_OK)
+    {
+        logError("[%d] %s: %s", job->index, url, errorDescription(error));
+    }
+    else if (worker->outputPath != NULL)
+    {
+        logInfo("[%d] Status %d: %lld bytes saved to '%s'", job->index, status, res->contentLength, worker->outputPath);
+    }
+    else
+    {
+        logInfo("[%d] Status %d: no body", job->index, status);
+    }
+
+    if (digest != NULL)
+    {
+        logInfo("[%d] %s: %s", job->index, checksumNames[req->checksum], digest);
+    }
+
+    if (worker->flight != NULL)
+    {
+        landFlight(worker, status, error, digest);
+    }
+
+    free(digest);
+    free(worker->outputPath);
+    worker->outputPath = NULL;
+
+    return error == HTTP_OK && status < 400 ? 0 : -1;
+}
+
+// pick a handle of the worker and fill it from the request options
+httpError setupJob(batchWorker *worker, batchJob *job)
+{
+    char *url;
+    httpRequest *req = worker->batch->req;
+    httpRequest parsedUrl;
+    httpHeader *header;
+    httpError error;
+
+    memset(&parsedUrl, 0, sizeof(parsedUrl));
+    worker->handle = NULL;
+    url            = job->url != NULL ? job->url : worker->batch->origin;
+
+    error = parseUrl(url, &parsedUrl);
+    if (error == HTTP_OK)
+    {
+        worker->handle = pickHandle(worker->pool, BATCH_POOL_SIZE, parsedUrl.host, parsedUrl.secure, req->socketProfile,
+                                    ++worker->jobs);
+        error          = worker->handle != NULL ? HTTP_OK : ERR_MEMORY;
+    }
+    free(parsedUrl.host);
+    free(parsedUrl.path);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    resetHandle(worker->handle);
+    setBodyCallback(worker->handle, saveBody, worker);
+
+    error = setUrl(worker->handle, url);
+    if (error == HTTP_OK)
+    {
+        error = setMethod(worker->handle, req->method);
+    }
+    if (error == HTTP_OK)
+    {
+        error = setSocketProfile(worker->handle, req->socketProfile);
+    }
+    if (error == HTTP_OK)
+    {
+        error = setUnixSocket(worker->handle, req->unixSocket);
+    }
+
+    // the template already holds headers and body
+    if (job->record != NULL)
+    {
+        consumeBuffer(&worker->payload, bufferLength(&worker->payload));
+        if (error == HTTP_OK)
+        {
+            error = fillTemplate(worker->batch->compiled, job->record, &worker->payload);
+        }
+        if (error == HTTP_OK)
+        {
+            borrowRequestPayload(worker->handle, bufferData(&worker->payload), bufferLength(&worker->payload));
+        }
+    }
+    for (header = req->headers; header != NULL && job->record == NULL && error == HTTP_OK; header = header->next)
+    {
+        error = addRequestHeader(worker->handle, header->line);
+    }
+    if (error == HTTP_OK && req->text != NULL && job->record == NULL)
+    {
+        error = setBody(worker->handle, req->type, req->text);
+    }
+    if (error == HTTP_OK && (req->limitRate > 0 || globalRate() > 0))
+    {
+        error = setRateLimit(worker->handle, req->limitRate, req->rateWeight);
+    }
+    if (error == HTTP_OK && req->checksum != CHECKSUM_NONE)
+    {
+        worker->handle->res->digest = createDigest(req->checksum);
+        if (worker->handle->res->digest == NULL)
+        {
+            error = ERR_MEMORY;
+        }
+    }
+
+    return error;
+}
+
+// the file is opened with the first bytes, once the content type is known
+int saveBody(void *userData, char *data, int length)
+{
+    int mirror;
+    batchWorker *worker = userData;
+    httpRequest *req    = worker->handle->req;
+    httpResponse *res   = worker->handle->res;
+
+    if (worker->sink == NULL)
+    {
+        mirror = worker->batch->req->mirrorDepth >= 0;
+        if (mirror)
+        {
+            // error pages are not part of the site
+            if (res->status >= 400)
+            {
+                return 0;
+            }
+
+            worker->outputPath = mirrorPath(worker->batch, worker->job->url);
+            if (worker->outputPath == NULL)
+            {
+                return 1;
+            }
+
+            // once open the page can be moved, its writes follow it
+            pthread_mutex_lock(&worker->batch->pathLock);
+            if (makeParents(&worker->outputPath) == -1)
+            {
+                pthread_mutex_unlock(&worker->batch->pathLock);
+
+                return 1;
+            }
+        }
+        else
+        {
+            worker->outputPath = listPath(req->host, worker->job->index, res->type);
+            if (worker->outputPath == NULL)
+            {
+                return 1;
+            }
+        }
+
+        // a chunked body only knows its size so far, the sink trims what is not written
+        worker->sink = openSink(worker->outputPath, 0, res->contentLength, worker->batch->req->durable ? SINK_DURABLE : 0);
+        if (mirror)
+        {
+            pthread_mutex_unlock(&worker->batch->pathLock);
+        }
+        if (worker->sink == NULL)
+        {
+            logError("Could not open '%s' to save the response!", worker->outputPath);
+
+            return 1;
+        }
+
+        // only pages are scanned, their links are queued while the rest arrives
+        if (res->type != TEXT_HTML && worker->scanner != NULL)
+        {
+            freeScanner(worker->scanner);
+            worker->scanner = NULL;
+        }
+    }
+
+    if (worker->scanner != NULL && feedScanner(worker->scanner, data, length, queueLink, worker) != HTTP_OK)
+    {
+        return 1;
+    }
+
+    return sinkWrite(worker->sink, data, length) == -1 ? 1 : 0;
+}
+
+// file of the body of a job of the url list, host-index and the time
+char *listPath(char *host, int index, contentType type)
+{
+    int nameLength;
+    char *name, *path;
+
+    nameLength = snprintf(NULL, 0, "%s-%d", host, index);
+    name       = malloc(nameLength + 1);
+    if (name == NULL)
+    {
+        return NULL;
+    }
+    snprintf(name, nameLength + 1, "%s-%d", host, index);
+
+    path = logFilename(name, nameLength, contentTypeToExtension[type], contentTypeToLength[type]);
+    free(name);
+
+    return path;
+}
+
+// root/host/path of url, 'index.html' for the directories and '/' in the query replaced by '_'
+char *mirrorPath(batchState *batch, char *url)
+{
+    int pathLength;
+    char *path, *host, *query;
+
+    // every queued url is the origin followed by a normalized path
+    host       = batch->origin + strcspn(batch->origin, ":") + 3;
+    url        = url + batch->originLength;
+    pathLength = strcspn(url, "?");
+
+    if (asprintf(&path, "%s/%s%.*s%s%s", batch->root, host, pathLength, url,
+                 url[pathLength - 1] == '/' ? "index.html" : "", url + pathLength) == -1)
+    {
+        logError("Could not allocate the path of '%s'!", url);
+
+        return NULL;
+    }
+
+    for (query = strchr(path + strlen(batch->root) + strlen(host) + 1, '?'); query != NULL && *query != '\0'; ++query)
+    {
+        if (*query == '/')
+        {
+            *query = '_';
+        }
+    }
+
+    return path;
+}
+
+/**
+ * mkdir -p of the directories of path. A page whose path is also a directory,
+ * /a/b next to /a/b/, is saved as 'b_' whichever of the two comes first, path
+ * is changed then. Called with pathLock held.
+ */
+int makeParents(char **path)
+{
+    int error;
+    char *slash, *moved;
+    struct stat info;
+
+    for (slash = strchr(*path + 1, '/'); slash != NULL; slash = strchr(slash + 1, '/'))
+    {
+        *slash = '\0';
+        error  = mkdir(*path, 0755) == -1 ? errno : 0;
+
+        // the page saved there first makes room for the directory
+        if (error == EEXIST && stat(*path, &info) == 0 && !S_ISDIR(info.st_mode))
+        {
+            error = asprintf(&moved, "%s_", *path) == -1 ? ENOMEM : 0;
+            if (error == 0)
+            {
+                error = rename(*path, moved) == 0 && mkdir(*path, 0755) == 0 ? 0 : errno;
+                logVerbose("'%s' moved to '%s' to make a directory of it", *path, moved);
+                free(moved);
+            }
+        }
+
+        if (error != 0 && error != EEXIST)
+        {
+            logError("Could not create directory '%s': %s", *path, strerror(error));
+            *slash = '/';
+
+            return -1;
+        }
+        *slash = '/';
+    }
+
+    if (stat(*path, &info) == 0 && S_ISDIR(info.st_mode))
+    {
+        if (asprintf(&moved, "%s_", *path) == -1)
+        {
+            return -1;
+        }
+        free(*path);
+        *path = moved;
+    }
+
+    return 0;
+}
+
+// links of the same site are queued on the worker that found them, the others steal them
+int queueLink(void *userData, char *link, int length)
+{
+    char *url;
+    batchWorker *worker = userData;
+    batchState *batch   = worker->batch;
+
+    url = resolveUrl(worker->job->url, link, length);
+    if (url == NULL)
+    {
+        return 0;
+    }
+
+    if (strncmp(url, batch->origin, batch->originLength) != 0 ||
+        (url[batch->originLength] != '/' && url[batch->originLength] != '?' && url[batch->originLength] != '\0'))
+    {
+        free(url);
+
+        return 0;
+    }
+
+    logDebug("[%d] Link %s", worker->job->index, url);
+
+    return addJob(batch, worker->id, url, NULL, worker->job->depth + 1) == ERR_MEMORY ? 1 : 0;
+}
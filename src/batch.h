@@ -0,0 +1,28 @@
+#pragma once
+
+#include "httpLib.h"
+
+/** connections kept open by every worker thread */
+#define BATCH_POOL_SIZE 4
+/** rows of --template-data read ahead for every worker thread */
+#define BATCH_QUEUED_ROWS 64
+
+/**
+ * Download every url of req->urlList with req->threads worker threads.
+ * Method, headers, text or json body, socket profile, rate limit and checksum
+ * of req are used for every url, the bodies are saved in './out'.
+ * A GET or HEAD of a url already in flight shares that transfer unless
+ * req->noCoalesce is set, its file is a hard link to the same body.
+ *
+ * With req->mirrorDepth >= 0 the url of req is mirrored instead: the links of
+ * the html pages to the same site are followed up to mirrorDepth links away
+ * and every page is saved once under req->outputPath (default './out') as
+ * host/path, a page whose path is also a directory as host/path_.
+ *
+ * With req->templateData the request of req is compiled once as a template
+ * and sent to its host for every row of the data file, see requestTemplate.h.
+ * The rows are read while the requests of the ones before are sent.
+ *
+ * @return Number of urls that could not be downloaded, -1 if the list could not be read
+ */
+int runBatch(httpRequest *req);
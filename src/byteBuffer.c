@@ -0,0 +1,203 @@
+#include "byteBuffer.h"
+#include "logger.h"
+#include "stats.h"
+#include <limits.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+httpError growBuffer(byteBuffer *buffer, int capacity);
+
+void initBuffer(byteBuffer *buffer)
+{
+    memset(buffer, 0, sizeof(byteBuffer));
+}
+
+httpError initFixedBuffer(byteBuffer *buffer, int capacity)
+{
+    httpError error;
+
+    initBuffer(buffer);
+
+    error = growBuffer(buffer, capacity);
+    if (error == HTTP_OK)
+    {
+        buffer->fixed = 1;
+    }
+
+    return error;
+}
+
+httpError reserveBuffer(byteBuffer *buffer, int extra)
+{
+    int needed, capacity;
+
+    // + 1 for the null termination, the sizes are ints
+    if (extra > INT_MAX - 1 - buffer->length)
+    {
+        logError("Could not grow buffer of %.2f KB by %d bytes!", buffer->length / 1024.0, extra);
+
+        return ERR_MEMORY;
+    }
+    needed = buffer->length + extra + 1;
+    if (needed <= buffer->capacity)
+    {
+        return HTTP_OK;
+    }
+
+    // consumed bytes are reclaimed before growing, fixed buffers can only do this
+    if (buffer->readOffset > 0 && (buffer->fixed || buffer->readOffset >= buffer->length / 2))
+    {
+        memmove(buffer->data, bufferData(buffer), bufferLength(buffer) + 1);
+        countStat(bytesCopied, bufferLength(buffer));
+
+        needed -= buffer->readOffset;
+        buffer->length -= buffer->readOffset;
+        buffer->readOffset = 0;
+
+        if (needed <= buffer->capacity)
+        {
+            return HTTP_OK;
+        }
+    }
+
+    if (buffer->fixed)
+    {
+        return ERR_INVALID;
+    }
+
+    // doubling past 1 GB would overflow, the buffer grows to the largest int instead
+    capacity = buffer->capacity <= INT_MAX / 2 ? buffer->capacity * 2 : INT_MAX;
+    if (capacity < BUFFER_MIN_CAPACITY)
+    {
+        capacity = BUFFER_MIN_CAPACITY;
+    }
+    if (capacity < needed)
+    {
+        capacity = needed;
+    }
+
+    return growBuffer(buffer, capacity);
+}
+
+void commitBuffer(byteBuffer *buffer, int length)
+{
+    buffer->length += length;
+    buffer->data[buffer->length] = '\0';
+}
+
+httpError appendBuffer(byteBuffer *buffer, const char *data, int length)
+{
+    httpError error;
+
+    error = reserveBuffer(buffer, length);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    memcpy(bufferSpace(buffer), data, length);
+    countStat(bytesCopied, length);
+    commitBuffer(buffer, length);
+
+    return HTTP_OK;
+}
+
+httpError appendFormat(byteBuffer *buffer, const char *fmt, ...)
+{
+    int length;
+    va_list args;
+    httpError error;
+
+    va_start(args, fmt);
+    length = vsnprintf(NULL, 0, fmt, args);
+    va_end(args);
+
+    error = reserveBuffer(buffer, length);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    va_start(args, fmt);
+    vsnprintf(bufferSpace(buffer), length + 1, fmt, args);
+    va_end(args);
+
+    countStat(bytesCopied, length);
+    commitBuffer(buffer, length);
+
+    return HTTP_OK;
+}
+
+void consumeBuffer(byteBuffer *buffer, int length)
+{
+    buffer->readOffset += length < bufferLength(buffer) ? length : bufferLength(buffer);
+
+    // once everything is consumed the next append starts from the front again
+    if (buffer->readOffset == buffer->length)
+    {
+        buffer->readOffset = buffer->length = 0;
+        if (buffer->data != NULL)
+        {
+            buffer->data[0] = '\0';
+        }
+    }
+}
+
+char *detachBuffer(byteBuffer *buffer)
+{
+    char *data;
+
+    if (buffer->readOffset > 0)
+    {
+        memmove(buffer->data, bufferData(buffer), bufferLength(buffer) + 1);
+        countStat(bytesCopied, bufferLength(buffer));
+    }
+
+    data = buffer->data;
+    initBuffer(buffer);
+
+    return data;
+}
+
+void freeBuffer(byteBuffer *buffer)
+{
+    free(buffer->data);
+    initBuffer(buffer);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+httpError growBuffer(byteBuffer *buffer, int capacity)
+{
+    char *data;
+
+    data = realloc(buffer->data, capacity);
+    if (data == NULL)
+    {
+        logError("Could not grow buffer to %.2f KB!", capacity / 1024.0);
+
+        return ERR_MEMORY;
+    }
+
+    if (buffer->data == NULL)
+    {
+        countStat(allocations, 1);
+        data[0] = '\0';
+    }
+    else
+    {
+        countStat(reallocations, 1);
+        // a moved buffer means the old content was copied
+        if (data != buffer->data)
+        {
+            countStat(bytesCopied, buffer->length);
+        }
+    }
+
+    buffer->data     = data;
+    buffer->capacity = capacity;
+
+    return HTTP_OK;
+}
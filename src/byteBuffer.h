@@ -0,0 +1,56 @@
+#pragma once
+
+#include "httpError.h"
+
+#define BUFFER_MIN_CAPACITY 1024
+
+/**
+ * Growable array of bytes. Data is appended at data + length and consumed
+ * from data + readOffset, growing capacity geometrically so that reaching
+ * N bytes takes O(log N) reallocations.
+ * The data is always followed by a null byte, so text can be used as a string.
+ */
+typedef struct byteBuffer
+{
+    char *data;
+    /** bytes stored, counted from the start of data, consumed ones included */
+    int length;
+    int capacity;
+    /** bytes already consumed from the front */
+    int readOffset;
+    /** 1 if capacity never grows: appends fail when full and the space
+     *  freed by consumeBuffer is reclaimed instead, like a ring */
+    int fixed;
+} byteBuffer;
+
+#define bufferData(buffer)   ((buffer)->data + (buffer)->readOffset)
+#define bufferLength(buffer) ((buffer)->length - (buffer)->readOffset)
+/** free space after the data, valid after reserveBuffer */
+#define bufferSpace(buffer) ((buffer)->data + (buffer)->length)
+
+/** Start an empty growable buffer, nothing is allocated until the first append */
+void initBuffer(byteBuffer *buffer);
+/** Start an empty buffer that never holds more than capacity bytes */
+httpError initFixedBuffer(byteBuffer *buffer, int capacity);
+
+/**
+ * Make room for at least extra more bytes after the data.
+ *
+ * @return ERR_MEMORY if the allocation failed, ERR_INVALID if a fixed buffer has no room
+ */
+httpError reserveBuffer(byteBuffer *buffer, int extra);
+/** Mark length bytes written in bufferSpace as part of the data */
+void commitBuffer(byteBuffer *buffer, int length);
+httpError appendBuffer(byteBuffer *buffer, const char *data, int length);
+/** Append printf style formatted text */
+httpError appendFormat(byteBuffer *buffer, const char *fmt, ...);
+/** Drop length bytes from the front of the data */
+void consumeBuffer(byteBuffer *buffer, int length);
+
+/**
+ * Take ownership of the unconsumed data, leaving the buffer empty.
+ *
+ * @return Null terminated data, the caller must free it. NULL if the buffer never allocated
+ */
+char *detachBuffer(byteBuffer *buffer);
+void freeBuffer(byteBuffer *buffer);
@@ -0,0 +1,436 @@
+#define _GNU_SOURCE
+#include "byteRanges.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+// where the parser is in the body
+enum rangesState
+{
+    // preamble, or the line break after the data of a part
+    RANGES_DELIMITER,
+    RANGES_HEADERS,
+    RANGES_DATA,
+    // epilogue, ignored
+    RANGES_END
+};
+
+int compareRanges(const void *first, const void *second);
+httpError parseRangeLine(rangeParser *parser);
+
+httpError parseRanges(char *spec, byteRange **ranges, int *count)
+{
+    int capacity;
+    char *digitsEnd;
+    byteRange range, *grown;
+    httpError error;
+
+    *ranges  = NULL;
+    *count   = 0;
+    capacity = 0;
+    error    = HTTP_OK;
+
+    while (error == HTTP_OK)
+    {
+        for (; *spec == ' '; ++spec)
+        {
+        }
+
+        // -N, the last N bytes
+        if (*spec == '-')
+        {
+            range.first = -strtoll(spec + 1, &digitsEnd, 10);
+            range.last  = -1;
+            if (digitsEnd == spec + 1 || range.first >= 0 || spec[1] == '+' || spec[1] == '-')
+            {
+                error = ERR_INVALID;
+            }
+        }
+        else
+        {
+            range.first = strtoll(spec, &digitsEnd, 10);
+            if (digitsEnd == spec || *digitsEnd != '-' || *spec == '+')
+            {
+                error = ERR_INVALID;
+            }
+            else
+            {
+                spec       = digitsEnd + 1;
+                range.last = strtoll(spec, &digitsEnd, 10);
+                if (digitsEnd == spec)
+                {
+                    range.last = -1;
+                }
+                else if (range.last < range.first || *spec == '-' || *spec == '+')
+                {
+                    error = ERR_INVALID;
+                }
+            }
+        }
+
+        for (spec = digitsEnd; *spec == ' '; ++spec)
+        {
+        }
+        if (error != HTTP_OK || (*spec != ',' && *spec != '\0'))
+        {
+            error = ERR_INVALID;
+
+            break;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity > 0 ? capacity * 2 : 8;
+            grown    = realloc(*ranges, capacity * sizeof(byteRange));
+            if (grown == NULL)
+            {
+                error = ERR_MEMORY;
+
+                break;
+            }
+            *ranges = grown;
+        }
+        (*ranges)[(*count)++] = range;
+
+        if (*spec++ == '\0')
+        {
+            break;
+        }
+    }
+
+    if (error != HTTP_OK)
+    {
+        free(*ranges);
+        *ranges = NULL;
+        *count  = 0;
+    }
+
+    return error;
+}
+
+int coalesceRanges(byteRange *ranges, int count, long long gap)
+{
+    int i, merged;
+
+    // the last bytes of the file sort at the end, the longest first
+    qsort(ranges, count, sizeof(byteRange), compareRanges);
+
+    for (i = 1, merged = 0; i < count; ++i)
+    {
+        if (ranges[i].first < 0)
+        {
+            // a shorter tail is part of the longest one
+            if (ranges[merged].first >= 0)
+            {
+                ranges[++merged] = ranges[i];
+            }
+
+            continue;
+        }
+
+        if (ranges[merged].last == -1)
+        {
+            continue;
+        }
+
+        if (ranges[i].first <= ranges[merged].last + 1 + gap)
+        {
+            if (ranges[i].last == -1 || ranges[i].last > ranges[merged].last)
+            {
+                ranges[merged].last = ranges[i].last;
+            }
+        }
+        else
+        {
+            ranges[++merged] = ranges[i];
+        }
+    }
+
+    return count > 0 ? merged + 1 : 0;
+}
+
+char *formatRanges(byteRange *ranges, int count)
+{
+    int i;
+    byteBuffer value;
+    httpError error;
+
+    initBuffer(&value);
+    error = appendFormat(&value, "bytes=");
+    for (i = 0; i < count && error == HTTP_OK; ++i)
+    {
+        if (ranges[i].first < 0)
+        {
+            error = appendFormat(&value, "%s%lld", i > 0 ? ",-" : "-", -ranges[i].first);
+        }
+        else if (ranges[i].last == -1)
+        {
+            error = appendFormat(&value, "%s%lld-", i > 0 ? "," : "", ranges[i].first);
+        }
+        else
+        {
+            error = appendFormat(&value, "%s%lld-%lld", i > 0 ? "," : "", ranges[i].first, ranges[i].last);
+        }
+    }
+
+    if (error != HTTP_OK)
+    {
+        freeBuffer(&value);
+
+        return NULL;
+    }
+
+    return detachBuffer(&value);
+}
+
+httpError parseContentRange(char *value, byteRange *range, long long *total)
+{
+    char *digitsEnd;
+
+    for (; *value == ' '; ++value)
+    {
+    }
+    if (strncasecmp(value, "bytes ", 6))
+    {
+        return ERR_PARSE;
+    }
+
+    range->first = strtoll(value + 6, &digitsEnd, 10);
+    if (digitsEnd == value + 6 || *digitsEnd != '-' || range->first < 0)
+    {
+        return ERR_PARSE;
+    }
+
+    value       = digitsEnd + 1;
+    range->last = strtoll(value, &digitsEnd, 10);
+    if (digitsEnd == value || *digitsEnd != '/' || range->last < range->first)
+    {
+        return ERR_PARSE;
+    }
+
+    value = digitsEnd + 1;
+    if (*value == '*')
+    {
+        *total    = -1;
+        digitsEnd = value + 1;
+    }
+    else
+    {
+        *total = strtoll(value, &digitsEnd, 10);
+        if (digitsEnd == value || *value == '-' || *value == '+' || *total <= range->last)
+        {
+            return ERR_PARSE;
+        }
+    }
+    for (; *digitsEnd == ' ' || *digitsEnd == '\t'; ++digitsEnd)
+    {
+    }
+
+    return *digitsEnd == '\0' ? HTTP_OK : ERR_PARSE;
+}
+
+httpError initRanges(rangeParser *parser, char *contentType)
+{
+    int boundaryLength;
+    char *boundary;
+
+    memset(parser, 0, sizeof(rangeParser));
+    parser->state = RANGES_DELIMITER;
+    parser->total = -1;
+    initBuffer(&parser->line);
+
+    boundary = contentType != NULL ? strcasestr(contentType, "boundary=") : NULL;
+    if (boundary == NULL)
+    {
+        logError("multipart/byteranges response without a boundary!");
+
+        return ERR_PARSE;
+    }
+
+    boundary += 9;
+    if (*boundary == '"')
+    {
+        ++boundary;
+        boundaryLength = strcspn(boundary, "\"");
+    }
+    else
+    {
+        boundaryLength = strcspn(boundary, "; \t");
+    }
+
+    if (boundaryLength == 0 || asprintf(&parser->delimiter, "--%.*s", boundaryLength, boundary) == -1)
+    {
+        parser->delimiter = NULL;
+
+        return boundaryLength == 0 ? ERR_PARSE : ERR_MEMORY;
+    }
+    parser->delimiterLength = boundaryLength + 2;
+
+    return HTTP_OK;
+}
+
+httpError feedRanges(rangeParser *parser, char *data, int length, rangeCallback onPart, void *userData)
+{
+    int i, step;
+    char *lineEnd;
+    httpError error;
+
+    i = 0;
+    while (i < length && parser->state != RANGES_END)
+    {
+        // the data of a part goes on as it is
+        if (parser->state == RANGES_DATA)
+        {
+            step = parser->remaining < length - i ? parser->remaining : length - i;
+            if (onPart(userData, parser->offset, data + i, step) != 0)
+            {
+                return ERR_ABORTED;
+            }
+
+            parser->offset += step;
+            parser->remaining -= step;
+            i += step;
+            if (parser->remaining == 0)
+            {
+                parser->state = RANGES_DELIMITER;
+            }
+
+            continue;
+        }
+
+        lineEnd = memchr(data + i, '\n', length - i);
+        step    = lineEnd != NULL ? lineEnd - (data + i) : length - i;
+        error   = appendBuffer(&parser->line, data + i, step);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+        i += step;
+
+        if (bufferLength(&parser->line) > RANGE_MAX_LINE)
+        {
+            logError("multipart/byteranges line longer than %d bytes!", RANGE_MAX_LINE);
+
+            return ERR_PARSE;
+        }
+
+        // the rest of the line comes with the next slice
+        if (lineEnd == NULL)
+        {
+            break;
+        }
+        ++i;
+
+        error = parseRangeLine(parser);
+        consumeBuffer(&parser->line, bufferLength(&parser->line));
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+httpError finishRanges(rangeParser *parser)
+{
+    if (parser->state != RANGES_END)
+    {
+        logError("multipart/byteranges body ended after %d parts, before its last delimiter!", parser->parts);
+
+        return ERR_PARSE;
+    }
+
+    return HTTP_OK;
+}
+
+void freeRanges(rangeParser *parser)
+{
+    freeBuffer(&parser->line);
+    free(parser->delimiter);
+    parser->delimiter = NULL;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+int compareRanges(const void *first, const void *second)
+{
+    const byteRange *a = first, *b = second;
+
+    if ((a->first < 0) != (b->first < 0))
+    {
+        return a->first < 0 ? 1 : -1;
+    }
+
+    return a->first < b->first ? -1 : a->first > b->first;
+}
+
+// a delimiter or a part header, without its line break
+httpError parseRangeLine(rangeParser *parser)
+{
+    int length;
+    long long total;
+    char *line;
+    byteRange range;
+
+    length = bufferLength(&parser->line);
+    line   = bufferData(&parser->line);
+    if (length > 0 && line[length - 1] == '\r')
+    {
+        line[--length] = '\0';
+    }
+
+    if (parser->state == RANGES_DELIMITER)
+    {
+        if (length >= parser->delimiterLength && !memcmp(line, parser->delimiter, parser->delimiterLength))
+        {
+            // a part starts, or all of them ended
+            parser->state     = strncmp(line + parser->delimiterLength, "--", 2) ? RANGES_HEADERS : RANGES_END;
+            parser->remaining = -1;
+        }
+        // only the preamble can have something else
+        else if (length > 0 && parser->parts > 0)
+        {
+            logError("Part %d of multipart/byteranges longer than its Content-Range!", parser->parts);
+
+            return ERR_PARSE;
+        }
+
+        return HTTP_OK;
+    }
+
+    // the empty line after the headers
+    if (length == 0)
+    {
+        if (parser->remaining < 0)
+        {
+            logError("Part %d of multipart/byteranges without a Content-Range!", parser->parts + 1);
+
+            return ERR_PARSE;
+        }
+
+        ++parser->parts;
+        parser->state = RANGES_DATA;
+
+        return HTTP_OK;
+    }
+
+    if (!strncasecmp(line, "Content-Range:", 14))
+    {
+        if (parseContentRange(line + 14, &range, &total) != HTTP_OK)
+        {
+            logError("Invalid Content-Range in multipart/byteranges: '%s'", line);
+
+            return ERR_PARSE;
+        }
+
+        if (total != -1)
+        {
+            parser->total = total;
+        }
+        parser->offset    = range.first;
+        parser->remaining = range.last - range.first + 1;
+    }
+
+    return HTTP_OK;
+}
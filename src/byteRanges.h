@@ -0,0 +1,90 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+
+// a part header longer than this is not a part header
+#define RANGE_MAX_LINE 8192
+// ranges closer than this are asked as one, the bytes between cost less than one more request
+#define RANGE_COALESCE_GAP (64 * 1024)
+
+/** Byte range of a file, as in a Range header */
+typedef struct byteRange
+{
+    /** below 0 for the last -first bytes of the file */
+    long long first;
+    /** -1 up to the end of the file */
+    long long last;
+} byteRange;
+
+/**
+ * Called with every piece of a part of a multipart/byteranges body, in order.
+ *
+ * @param offset where data goes in the remote file
+ * @return 0 to keep parsing, anything else to stop
+ */
+typedef int (*rangeCallback)(void *userData, long long offset, char *data, int length);
+
+/**
+ * Streaming parser of multipart/byteranges bodies, the answer of a server to
+ * a request of several ranges. It is fed the body in slices of any size, the
+ * data of the parts is passed on without being copied.
+ */
+typedef struct rangeParser
+{
+    /** "--boundary" of the Content-Type */
+    char *delimiter;
+    int delimiterLength;
+    int state;
+    /** line being read outside of the data of a part */
+    byteBuffer line;
+
+    // PART BEING READ
+    long long offset;
+    long long remaining;
+
+    /** size of the remote file, -1 until a part tells it */
+    long long total;
+    int parts;
+} rangeParser;
+
+/**
+ * Parse a list of ranges like "0-1023,-4096,1048576-".
+ *
+ * @param ranges set to a new array to free
+ * @return ERR_INVALID if spec is not a list of ranges
+ */
+httpError parseRanges(char *spec, byteRange **ranges, int *count);
+/**
+ * Sort the ranges with a known start and merge the ones that overlap or are
+ * less than gap bytes apart. The last bytes of the file are left as they are.
+ *
+ * @return New number of ranges
+ */
+int coalesceRanges(byteRange *ranges, int count, long long gap);
+/** @return "bytes=..." value of a Range header, NULL if out of memory */
+char *formatRanges(byteRange *ranges, int count);
+/**
+ * Parse the value of the Content-Range header of a part, "bytes FIRST-LAST/TOTAL"
+ * where TOTAL can be "*".
+ *
+ * @param total set to the size of the remote file, -1 if not told
+ * @return ERR_PARSE if value is not a range of bytes
+ */
+httpError parseContentRange(char *value, byteRange *range, long long *total);
+
+/**
+ * @param contentType value of the Content-Type header of the response, the
+ *                    boundary of the parts is taken from it
+ * @return ERR_PARSE if it has no boundary
+ */
+httpError initRanges(rangeParser *parser, char *contentType);
+/**
+ * Parse the next slice of the body, onPart is called with the data of the parts.
+ *
+ * @return ERR_ABORTED if onPart asked to stop, ERR_PARSE if the body is not multipart/byteranges
+ */
+httpError feedRanges(rangeParser *parser, char *data, int length, rangeCallback onPart, void *userData);
+/** @return ERR_PARSE if the body ended before its closing delimiter */
+httpError finishRanges(rangeParser *parser);
+void freeRanges(rangeParser *parser);
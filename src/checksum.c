@@ -0,0 +1,116 @@
+#include "checksum.h"
+#include "logger.h"
+#include <fcntl.h>
+#include <openssl/evp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define HASH_BLOCK_SIZE (64 * 1024)
+
+const char *checksumNames[] = {
+    [CHECKSUM_NONE]    = "none",
+    [CHECKSUM_SHA256]  = "sha256",
+    [CHECKSUM_SHA512]  = "sha512",
+    [CHECKSUM_BLAKE2B] = "blake2b"};
+
+const EVP_MD *(*checksumAlgorithms[])(void) = {
+    [CHECKSUM_NONE]    = NULL,
+    [CHECKSUM_SHA256]  = EVP_sha256,
+    [CHECKSUM_SHA512]  = EVP_sha512,
+    [CHECKSUM_BLAKE2B] = EVP_blake2b512};
+
+EVP_MD_CTX *createDigest(checksumType type)
+{
+    EVP_MD_CTX *digest;
+
+    if (type <= CHECKSUM_NONE || type >= CHECKSUM_MAX)
+    {
+        return NULL;
+    }
+
+    digest = EVP_MD_CTX_new();
+    if (digest == NULL)
+    {
+        logError("Could not allocate %s context!", checksumNames[type]);
+
+        return NULL;
+    }
+
+    if (!EVP_DigestInit_ex(digest, checksumAlgorithms[type](), NULL))
+    {
+        logError("Could not initialize %s!", checksumNames[type]);
+        EVP_MD_CTX_free(digest);
+
+        return NULL;
+    }
+
+    return digest;
+}
+
+int hashFilePrefix(EVP_MD_CTX *digest, char *path, long long length)
+{
+    int fileDescriptor, lastRead;
+    char *buffer;
+
+    buffer         = malloc(HASH_BLOCK_SIZE);
+    fileDescriptor = open(path, O_RDONLY);
+    if (buffer == NULL || fileDescriptor == -1)
+    {
+        logError("Could not read '%s' to hash it!", path);
+        free(buffer);
+        if (fileDescriptor != -1)
+        {
+            close(fileDescriptor);
+        }
+
+        return -1;
+    }
+
+    while (length > 0)
+    {
+        lastRead = read(fileDescriptor, buffer, length < HASH_BLOCK_SIZE ? length : HASH_BLOCK_SIZE);
+        if (lastRead <= 0)
+        {
+            logError("Could not read '%s' to hash it!", path);
+
+            break;
+        }
+
+        EVP_DigestUpdate(digest, buffer, lastRead);
+        length -= lastRead;
+    }
+
+    close(fileDescriptor);
+    free(buffer);
+
+    return length == 0 ? 0 : -1;
+}
+
+char *finishDigest(EVP_MD_CTX *digest)
+{
+    unsigned int i, length;
+    unsigned char value[EVP_MAX_MD_SIZE];
+    char *hex;
+
+    if (!EVP_DigestFinal_ex(digest, value, &length))
+    {
+        EVP_MD_CTX_free(digest);
+
+        return NULL;
+    }
+    EVP_MD_CTX_free(digest);
+
+    hex = malloc(length * 2 + 1);
+    if (hex == NULL)
+    {
+        return NULL;
+    }
+
+    for (i = 0; i < length; ++i)
+    {
+        sprintf(hex + i * 2, "%02x", value[i]);
+    }
+
+    return hex;
+}
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <openssl/evp.h>
+
+// don't forget to update the const arrays in checksum.c
+typedef enum checksumType
+{
+    CHECKSUM_NONE,
+    CHECKSUM_SHA256,
+    CHECKSUM_SHA512,
+    CHECKSUM_BLAKE2B,
+    CHECKSUM_MAX
+} checksumType;
+
+extern const char *checksumNames[];
+
+/** @return New digest context for type, NULL on error */
+EVP_MD_CTX *createDigest(checksumType type);
+
+/**
+ * Hash the first length bytes of the file at path, used for the part of a
+ * resumed download that is already on disk.
+ *
+ * @return 0 on success, -1 if the file could not be read
+ */
+int hashFilePrefix(EVP_MD_CTX *digest, char *path, long long length);
+
+/**
+ * Finish the digest and free its context.
+ *
+ * @return Newly allocated lowercase hex digest, NULL on error
+ */
+char *finishDigest(EVP_MD_CTX *digest);
@@ -0,0 +1,657 @@
+#define _GNU_SOURCE
+#include "daemon.h"
+#include "byteBuffer.h"
+#include "httpHandle.h"
+#include "httpLib.h"
+#include "logger.h"
+#include "rateLimit.h"
+#include "stats.h"
+#include "utils.h"
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// accepted clients handed to the workers
+typedef struct daemonQueue
+{
+    pthread_mutex_t lock;
+    /** signaled when a client is queued */
+    pthread_cond_t filled;
+    /** signaled when a worker takes a client */
+    pthread_cond_t emptied;
+    int clients[DAEMON_QUEUED_CLIENTS];
+    long jobs[DAEMON_QUEUED_CLIENTS];
+    int first;
+    int queued;
+} daemonQueue;
+
+int daemonSocketPath(struct sockaddr_un *address, int create);
+int samePeer(int descriptor);
+void *runDaemonWorker(void *data);
+void serveClient(int client, handleSlot *pool, long job);
+int relayHeader(void *userData, char *line, int length);
+int relayBody(void *userData, char *data, int length);
+httpError sendFrame(int descriptor, char type, char *data, uint32_t length);
+httpError sendAll(int descriptor, char *data, int length);
+httpError reciveAll(int descriptor, char *data, int length);
+httpError reciveFrame(int descriptor, char *type, char **data, uint32_t *length);
+
+httpError runDaemon()
+{
+    int i, listener, client;
+    long job;
+    struct sockaddr_un address;
+    struct timeval requestTimeout, clientTimeout;
+    pthread_t thread;
+    daemonQueue queue;
+
+    memset(&queue, 0, sizeof(queue));
+    pthread_mutex_init(&queue.lock, NULL);
+    pthread_cond_init(&queue.filled, NULL);
+    pthread_cond_init(&queue.emptied, NULL);
+
+    if (daemonSocketPath(&address, 1) == -1)
+    {
+        return ERR_INVALID;
+    }
+
+    // a socket file nobody answers on is left over by a daemon that died
+    client = connectDaemon();
+    if (client != -1)
+    {
+        close(client);
+        logError("A daemon is already listening on '%s'!", address.sun_path);
+
+        return ERR_INVALID;
+    }
+    unlink(address.sun_path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener == -1)
+    {
+        logError("Could not create daemon socket!");
+
+        return ERR_CONNECT;
+    }
+
+    if (bind(listener, (struct sockaddr *)&address, sizeof(address)) == -1 ||
+        listen(listener, DAEMON_POOL_SIZE) == -1)
+    {
+        logError("Could not listen on '%s': %s", address.sun_path, strerror(errno));
+        close(listener);
+
+        return ERR_CONNECT;
+    }
+
+    // they run as long as the daemon, never joined
+    for (i = 0; i < DAEMON_WORKERS; ++i)
+    {
+        if (pthread_create(&thread, NULL, runDaemonWorker, &queue) != 0)
+        {
+            logError("Could not start daemon worker %d!", i);
+            close(listener);
+
+            return ERR_MEMORY;
+        }
+        pthread_detach(thread);
+    }
+
+    logInfo("Daemon listening on '%s'", address.sun_path);
+
+    requestTimeout.tv_sec  = DAEMON_REQUEST_TIMEOUT;
+    requestTimeout.tv_usec = 0;
+    clientTimeout.tv_sec   = DAEMON_CLIENT_TIMEOUT;
+    clientTimeout.tv_usec  = 0;
+    for (job = 1;; ++job)
+    {
+        client = accept(listener, NULL, NULL);
+        if (client == -1)
+        {
+            if (errno != EINTR)
+            {
+                logWarn("Could not accept client: %s", strerror(errno));
+            }
+
+            continue;
+        }
+
+        // the requests carry the credentials of the user, only they can hand them over
+        if (!samePeer(client))
+        {
+            logWarn("Refused a client run by another user");
+            close(client);
+
+            continue;
+        }
+
+        // a client that stops sending or reading must not hold a worker forever
+        setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &requestTimeout, sizeof(requestTimeout));
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &clientTimeout, sizeof(clientTimeout));
+
+        pthread_mutex_lock(&queue.lock);
+        while (queue.queued == DAEMON_QUEUED_CLIENTS)
+        {
+            pthread_cond_wait(&queue.emptied, &queue.lock);
+        }
+        queue.clients[(queue.first + queue.queued) % DAEMON_QUEUED_CLIENTS] = client;
+        queue.jobs[(queue.first + queue.queued) % DAEMON_QUEUED_CLIENTS]    = job;
+        ++queue.queued;
+        pthread_cond_signal(&queue.filled);
+        pthread_mutex_unlock(&queue.lock);
+    }
+}
+
+int connectDaemon()
+{
+    int daemonSocket;
+    struct sockaddr_un address;
+
+    if (daemonSocketPath(&address, 0) == -1)
+    {
+        return -1;
+    }
+
+    daemonSocket = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (daemonSocket == -1)
+    {
+        return -1;
+    }
+
+    if (connect(daemonSocket, (struct sockaddr *)&address, sizeof(address)) == -1)
+    {
+        close(daemonSocket);
+
+        return -1;
+    }
+
+    // anything else could read the request and forge the response
+    if (!samePeer(daemonSocket))
+    {
+        logWarn("The daemon on '%s' is run by another user, ignoring it", address.sun_path);
+        close(daemonSocket);
+
+        return -1;
+    }
+
+    logVerbose("Found a daemon on '%s'", address.sun_path);
+
+    return daemonSocket;
+}
+
+httpError daemonSendRequest(int daemonSocket, httpRequest *req)
+{
+    char *url;
+    uint32_t fields[5];
+    int urlLength;
+    httpError error;
+
+    // proto + :// + host + path
+    urlLength = (req->secure ? 5 : 4) + 3 + req->hostLength + req->pathLength;
+    url       = malloc(urlLength + 1);
+    if (url == NULL)
+    {
+        return ERR_MEMORY;
+    }
+    snprintf(url, urlLength + 1, "%s://%s%s", req->secure ? "https" : "http", req->host, req->path);
+
+    fields[0] = req->method;
+    fields[1] = urlLength;
+    fields[2] = req->limitRate < UINT32_MAX ? req->limitRate : UINT32_MAX;
+    fields[3] = req->socketProfile;
+    fields[4] = req->rateWeight;
+
+    error = sendAll(daemonSocket, (char *)fields, sizeof(fields));
+    if (error == HTTP_OK)
+    {
+        error = sendAll(daemonSocket, url, urlLength);
+    }
+    if (error == HTTP_OK)
+    {
+        fields[0] = req->payloadSize;
+        error     = sendAll(daemonSocket, (char *)fields, sizeof(uint32_t));
+    }
+    if (error == HTTP_OK)
+    {
+        error = sendAll(daemonSocket, req->payload, req->payloadSize);
+    }
+
+    free(url);
+
+    return error;
+}
+
+httpError daemonReciveHeaders(int daemonSocket, httpResponse *res)
+{
+    char type, *data;
+    uint32_t length;
+    byteBuffer headers;
+    httpError error;
+
+    initBuffer(&headers);
+
+    logInfo("Reciving and parsing response headers from the daemon..");
+    while (1)
+    {
+        error = reciveFrame(daemonSocket, &type, &data, &length);
+        if (error != HTTP_OK)
+        {
+            freeBuffer(&headers);
+
+            return error;
+        }
+
+        if (type == FRAME_END)
+        {
+            // the daemon could not get the headers from the server
+            error = length == sizeof(uint32_t) ? *(uint32_t *)data : ERR_PARSE;
+            free(data);
+            freeBuffer(&headers);
+
+            return error != HTTP_OK ? error : ERR_PARSE;
+        }
+
+        error = appendBuffer(&headers, data, length);
+        if (error == HTTP_OK)
+        {
+            error = appendBuffer(&headers, CRLF, 2);
+        }
+        free(data);
+
+        if (error != HTTP_OK)
+        {
+            freeBuffer(&headers);
+
+            return error;
+        }
+
+        if (type == FRAME_HEADERS_DONE)
+        {
+            break;
+        }
+    }
+
+    if (res->filename != NULL)
+    {
+        logFile(DEBUG, res->filename, res->filenameLength, "res.txt", 7, "%s", bufferData(&headers));
+    }
+    error = parseHeaders(res, bufferData(&headers));
+    freeBuffer(&headers);
+
+    return error;
+}
+
+httpError daemonReciveBody(int daemonSocket, httpResponse *res)
+{
+    char type, *data;
+    uint32_t length;
+    long long stored;
+    byteBuffer content;
+    httpError error;
+
+    stored = 0;
+    initBuffer(&content);
+    while (1)
+    {
+        error = reciveFrame(daemonSocket, &type, &data, &length);
+        if (error != HTTP_OK)
+        {
+            freeBuffer(&content);
+
+            return error;
+        }
+
+        if (type == FRAME_END)
+        {
+            error = length == sizeof(uint32_t) ? *(uint32_t *)data : ERR_PARSE;
+            free(data);
+
+            break;
+        }
+
+        if (res->digest != NULL)
+        {
+            EVP_DigestUpdate(res->digest, data, length);
+        }
+
+        if (res->sink != NULL)
+        {
+            error = sinkWrite(res->sink, data, length) == -1 ? ERR_FILE : HTTP_OK;
+        }
+        else if (res->onBody != NULL)
+        {
+            error = res->onBody(res->bodyData, data, length) != 0 ? ERR_ABORTED : HTTP_OK;
+        }
+        else
+        {
+            error = appendBuffer(&content, data, length);
+        }
+
+        stored += length;
+        free(data);
+
+        if (error != HTTP_OK)
+        {
+            freeBuffer(&content);
+
+            return error;
+        }
+    }
+
+    res->content = detachBuffer(&content);
+
+    // chunked bodies and those ending with the connection are measured while they arrive
+    if (res->contentLength < 0)
+    {
+        res->contentLength = stored;
+    }
+
+    return error;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// path of the socket in a directory only the user can enter, created if create is set. -1 if there is none
+int daemonSocketPath(struct sockaddr_un *address, int create)
+{
+    int length;
+    char *runtime, directory[sizeof(address->sun_path)];
+    struct stat info;
+
+    memset(address, 0, sizeof(*address));
+    address->sun_family = AF_UNIX;
+
+    runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime != NULL && runtime[0] == '/')
+    {
+        length = snprintf(directory, sizeof(directory), "%s", runtime);
+    }
+    else
+    {
+        length = snprintf(directory, sizeof(directory), DAEMON_DIRECTORY_FORMAT, (int)getuid());
+        if (create && mkdir(directory, 0700) == -1 && errno != EEXIST)
+        {
+            logError("Could not create '%s': %s", directory, strerror(errno));
+
+            return -1;
+        }
+    }
+
+    // another user could have made it first, or left it open
+    if (length >= (int)sizeof(directory) || lstat(directory, &info) == -1)
+    {
+        return -1;
+    }
+    if (!S_ISDIR(info.st_mode) || info.st_uid != getuid() || (info.st_mode & 077) != 0)
+    {
+        logWarn("'%s' is not a directory only you can enter, not using it for the daemon!", directory);
+
+        return -1;
+    }
+
+    if (length >= (int)sizeof(directory) ||
+        snprintf(address->sun_path, sizeof(address->sun_path), "%s/%s", directory, DAEMON_SOCKET_NAME) >=
+            (int)sizeof(address->sun_path))
+    {
+        logError("'%s' is too long for the daemon socket!", directory);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// 1 if the other end of the unix socket descriptor runs as the same user
+int samePeer(int descriptor)
+{
+    struct ucred peer;
+    socklen_t length;
+
+    length = sizeof(peer);
+    if (getsockopt(descriptor, SOL_SOCKET, SO_PEERCRED, &peer, &length) == -1)
+    {
+        return 0;
+    }
+
+    return peer.uid == getuid();
+}
+
+void *runDaemonWorker(void *data)
+{
+    int client;
+    long job;
+    daemonQueue *queue = data;
+    handleSlot pool[DAEMON_POOL_SIZE];
+
+    memset(pool, 0, sizeof(pool));
+    while (1)
+    {
+        pthread_mutex_lock(&queue->lock);
+        while (queue->queued == 0)
+        {
+            pthread_cond_wait(&queue->filled, &queue->lock);
+        }
+        client       = queue->clients[queue->first];
+        job          = queue->jobs[queue->first];
+        queue->first = (queue->first + 1) % DAEMON_QUEUED_CLIENTS;
+        --queue->queued;
+        pthread_cond_signal(&queue->emptied);
+        pthread_mutex_unlock(&queue->lock);
+
+        serveClient(client, pool, job);
+        close(client);
+    }
+
+    return NULL;
+}
+
+void serveClient(int client, handleSlot *pool, long job)
+{
+    char *url, *payload;
+    uint32_t fields[5], payloadSize;
+    httpHandle *handle;
+    httpRequest parsedUrl;
+    httpError error;
+
+    url = payload = NULL;
+    memset(&parsedUrl, 0, sizeof(parsedUrl));
+
+    // method, url length, rate limit, socket profile and rate weight, url, payload size, payload
+    error = reciveAll(client, (char *)fields, sizeof(fields));
+    if (error == HTTP_OK && (fields[0] >= METHODS_MAX || fields[3] >= SOCKET_PROFILE_MAX || fields[4] > INT_MAX))
+    {
+        error = ERR_INVALID;
+    }
+    if (error == HTTP_OK)
+    {
+        url   = calloc(1, fields[1] + 1);
+        error = url == NULL ? ERR_MEMORY : reciveAll(client, url, fields[1]);
+    }
+    if (error == HTTP_OK)
+    {
+        error = reciveAll(client, (char *)&payloadSize, sizeof(payloadSize));
+    }
+    if (error == HTTP_OK)
+    {
+        payload = malloc(payloadSize);
+        error   = payload == NULL ? ERR_MEMORY : reciveAll(client, payload, payloadSize);
+    }
+    if (error == HTTP_OK)
+    {
+        error = parseUrl(url, &parsedUrl);
+    }
+
+    if (error != HTTP_OK)
+    {
+        logWarn("Invalid request from client: %s", errorDescription(error));
+        sendFrame(client, FRAME_END, (char *)&error, sizeof(uint32_t));
+        free(url);
+        free(payload);
+        free(parsedUrl.host);
+        free(parsedUrl.path);
+
+        return;
+    }
+
+    logInfo("Job %ld: %s %s", job, methodNames[fields[0]], url);
+
+    handle = pickHandle(pool, DAEMON_POOL_SIZE, parsedUrl.host, parsedUrl.secure, fields[3], job);
+    if (handle == NULL)
+    {
+        error = ERR_MEMORY;
+    }
+    else
+    {
+        resetHandle(handle);
+        setUrl(handle, url);
+        setMethod(handle, fields[0]);
+        setSocketProfile(handle, fields[3]);
+        setHeaderCallback(handle, relayHeader, &client);
+        setBodyCallback(handle, relayBody, &client);
+
+        error = setRequestPayload(handle, payload, payloadSize);
+        if (error == HTTP_OK && (fields[2] > 0 || globalRate() > 0))
+        {
+            error = setRateLimit(handle, fields[2], fields[4]);
+        }
+        if (error == HTTP_OK)
+        {
+            error = performRequest(handle);
+        }
+
+        // idle handles must not take a share of the global rate
+        removeRateLimit(handle);
+    }
+
+    logInfo("Job %ld: %s", job, errorDescription(error));
+    sendFrame(client, FRAME_END, (char *)&error, sizeof(uint32_t));
+
+    free(url);
+    free(payload);
+    free(parsedUrl.host);
+    free(parsedUrl.path);
+}
+
+int relayHeader(void *userData, char *line, int length)
+{
+    int client = *(int *)userData;
+
+    if (length == 0)
+    {
+        return sendFrame(client, FRAME_HEADERS_DONE, "", 0) != HTTP_OK;
+    }
+
+    return sendFrame(client, FRAME_HEADER, line, length) != HTTP_OK;
+}
+
+int relayBody(void *userData, char *data, int length)
+{
+    return sendFrame(*(int *)userData, FRAME_BODY, data, length) != HTTP_OK;
+}
+
+httpError sendFrame(int descriptor, char type, char *data, uint32_t length)
+{
+    char frameHeader[1 + sizeof(uint32_t)];
+    httpError error;
+
+    frameHeader[0] = type;
+    memcpy(frameHeader + 1, &length, sizeof(uint32_t));
+
+    error = sendAll(descriptor, frameHeader, sizeof(frameHeader));
+    if (error == HTTP_OK)
+    {
+        error = sendAll(descriptor, data, length);
+    }
+
+    return error;
+}
+
+httpError sendAll(int descriptor, char *data, int length)
+{
+    int sent;
+
+    while (length > 0)
+    {
+        sent = send(descriptor, data, length, MSG_NOSIGNAL);
+        countStat(sendCalls, 1);
+        if (sent == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            return ERR_SEND;
+        }
+
+        data += sent;
+        length -= sent;
+    }
+
+    return HTTP_OK;
+}
+
+httpError reciveAll(int descriptor, char *data, int length)
+{
+    int lastRead;
+
+    while (length > 0)
+    {
+        lastRead = recv(descriptor, data, length, MSG_WAITALL);
+        countStat(recvCalls, 1);
+        if (lastRead == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        else if (lastRead <= 0)
+        {
+            return lastRead == 0 ? ERR_CLOSED : ERR_RECIVE;
+        }
+
+        data += lastRead;
+        length -= lastRead;
+    }
+
+    return HTTP_OK;
+}
+
+httpError reciveFrame(int descriptor, char *type, char **data, uint32_t *length)
+{
+    char frameHeader[1 + sizeof(uint32_t)];
+    httpError error;
+
+    error = reciveAll(descriptor, frameHeader, sizeof(frameHeader));
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    *type = frameHeader[0];
+    memcpy(length, frameHeader + 1, sizeof(uint32_t));
+
+    // + 1 so header lines can be used as strings
+    *data = malloc(*length + 1);
+    if (*data == NULL)
+    {
+        return ERR_MEMORY;
+    }
+    countStat(allocations, 1);
+    (*data)[*length] = '\0';
+
+    error = reciveAll(descriptor, *data, *length);
+    if (error != HTTP_OK)
+    {
+        free(*data);
+        *data = NULL;
+    }
+
+    return error;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "httpLib.h"
+
+// the socket goes in $XDG_RUNTIME_DIR, or in a directory of /tmp only its user can enter
+#define DAEMON_SOCKET_NAME      "wannabeCurl.sock"
+#define DAEMON_DIRECTORY_FORMAT "/tmp/wannabeCurl-%d"
+#define DAEMON_POOL_SIZE     16
+// clients served at the same time, each worker with its own pool of connections
+#define DAEMON_WORKERS 4
+// accepted clients waiting for a worker
+#define DAEMON_QUEUED_CLIENTS 64
+// seconds a client has to send its request, it is built before connecting
+#define DAEMON_REQUEST_TIMEOUT 2
+// seconds a client can stop reading the response before it is dropped
+#define DAEMON_CLIENT_TIMEOUT 10
+
+// frames sent by the daemon to the client: type, 4 bytes length, data
+#define FRAME_HEADER       'H'
+#define FRAME_HEADERS_DONE 'D'
+#define FRAME_BODY         'B'
+#define FRAME_END          'E'
+
+/**
+ * Listen on the daemon unix socket and serve the requests of the clients on
+ * DAEMON_WORKERS threads, each keeping a pool of open connections between
+ * them. Only clients of the same user are served. Runs in the foreground,
+ * returns only if the socket cannot be set up.
+ */
+httpError runDaemon();
+
+/** @return Descriptor connected to a running daemon of the same user, -1 if there is none */
+int connectDaemon();
+
+/** Hand the built request to the daemon, req->payload must be already built */
+httpError daemonSendRequest(int daemonSocket, httpRequest *req);
+/** Same as reciveHeaders, reading from the daemon instead of the server */
+httpError daemonReciveHeaders(int daemonSocket, httpResponse *res);
+/** Same as reciveBody, reading from the daemon instead of the server */
+httpError daemonReciveBody(int daemonSocket, httpResponse *res);
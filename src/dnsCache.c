@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+#include "dnsCache.h"
+#include "logger.h"
+#include "stats.h"
+#include <ctype.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+/** Answer for a host and port, the request stays here while getaddrinfo_a runs */
+typedef struct dnsEntry
+{
+    char *host;
+    char *port;
+    struct addrinfo hints;
+    struct gaicb request;
+    /** 1 until getaddrinfo_a calls back */
+    int pending;
+
+    struct sockaddr_in *addresses;
+    int count;
+    /** getaddrinfo error of the answer, 0 if resolved */
+    int error;
+    /** monotonic seconds after which the answer is asked again */
+    time_t expires;
+    /** of host and port, tells the bucket */
+    unsigned long long hash;
+    /** next entry of the same bucket */
+    struct dnsEntry *next;
+} dnsEntry;
+
+/** chained hash table, the entries never move while getaddrinfo_a holds them */
+dnsEntry **dnsBuckets = NULL;
+int dnsBucketCount = 0;
+int dnsEntryCount = 0;
+pthread_mutex_t dnsLock = PTHREAD_MUTEX_INITIALIZER;
+// signaled every time an answer arrives
+pthread_cond_t dnsResolved = PTHREAD_COND_INITIALIZER;
+
+dnsEntry *findEntry(char *host, char *port, time_t now);
+unsigned long long hashHost(char *host, char *port);
+void growBuckets();
+int startLookup(dnsEntry *entry);
+void finishLookup(union sigval value);
+time_t monotonicSeconds();
+
+void prefetchHost(char *host, char *port)
+{
+    pthread_mutex_lock(&dnsLock);
+    findEntry(host, port, monotonicSeconds());
+    pthread_mutex_unlock(&dnsLock);
+}
+
+httpError resolveHost(char *host, char *port, struct sockaddr_in **addresses, int *count)
+{
+    dnsEntry *entry;
+    httpError error;
+
+    *addresses = NULL;
+    *count     = 0;
+
+    pthread_mutex_lock(&dnsLock);
+    entry = findEntry(host, port, monotonicSeconds());
+    if (entry == NULL)
+    {
+        pthread_mutex_unlock(&dnsLock);
+
+        return ERR_RESOLVE;
+    }
+
+    if (entry->pending)
+    {
+        logVerbose("Waiting for the answer of '%s'...", host);
+    }
+    while (entry->pending)
+    {
+        pthread_cond_wait(&dnsResolved, &dnsLock);
+    }
+
+    error = HTTP_OK;
+    if (entry->error != 0)
+    {
+        logVerbose("'%s' could not be resolved: %s", host, gai_strerror(entry->error));
+        error = ERR_RESOLVE;
+    }
+    else
+    {
+        *addresses = malloc(entry->count * sizeof(struct sockaddr_in));
+        if (*addresses == NULL)
+        {
+            error = ERR_MEMORY;
+        }
+        else
+        {
+            countStat(allocations, 1);
+            memcpy(*addresses, entry->addresses, entry->count * sizeof(struct sockaddr_in));
+            *count = entry->count;
+        }
+    }
+    pthread_mutex_unlock(&dnsLock);
+
+    return error;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// entry of host, a lookup is started when missing or expired, NULL if none could be. Called with dnsLock held
+dnsEntry *findEntry(char *host, char *port, time_t now)
+{
+    unsigned long long hash;
+    dnsEntry *entry, **link;
+
+    if (dnsEntryCount >= dnsBucketCount)
+    {
+        growBuckets();
+    }
+    if (dnsBucketCount == 0)
+    {
+        return NULL;
+    }
+
+    hash = hashHost(host, port);
+    for (link = &dnsBuckets[hash & (dnsBucketCount - 1)]; (entry = *link) != NULL;)
+    {
+        if (entry->hash == hash && !strcasecmp(entry->host, host) && !strcmp(entry->port, port))
+        {
+            break;
+        }
+
+        // the others of the bucket past their time are dropped while walking by
+        if (!entry->pending && entry->expires <= now)
+        {
+            *link = entry->next;
+            free(entry->host);
+            free(entry->port);
+            free(entry->addresses);
+            free(entry);
+            --dnsEntryCount;
+
+            continue;
+        }
+
+        link = &entry->next;
+    }
+
+    if (entry != NULL && (entry->pending || entry->expires > now))
+    {
+        return entry;
+    }
+
+    if (entry == NULL)
+    {
+        entry = calloc(1, sizeof(dnsEntry));
+        if (entry == NULL)
+        {
+            return NULL;
+        }
+
+        entry->host = strdup(host);
+        entry->port = strdup(port);
+        if (entry->host == NULL || entry->port == NULL)
+        {
+            free(entry->host);
+            free(entry->port);
+            free(entry);
+
+            return NULL;
+        }
+
+        entry->hash = hash;
+        entry->next = dnsBuckets[hash & (dnsBucketCount - 1)];
+
+        dnsBuckets[hash & (dnsBucketCount - 1)] = entry;
+        ++dnsEntryCount;
+    }
+
+    return startLookup(entry) == 0 ? entry : NULL;
+}
+
+// FNV-1a of the lowercase host and of the port, finished with the splitmix64 mixer as hashUrl
+unsigned long long hashHost(char *host, char *port)
+{
+    unsigned long long hash;
+
+    hash = 14695981039346656037ULL;
+    for (; *host != '\0'; ++host)
+    {
+        hash ^= (unsigned char)tolower((unsigned char)*host);
+        hash *= 1099511628211ULL;
+    }
+    for (hash ^= ':', hash *= 1099511628211ULL; *port != '\0'; ++port)
+    {
+        hash ^= (unsigned char)*port;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+
+    return hash;
+}
+
+// twice the buckets, the entries keep their address. Without memory the chains just get longer
+void growBuckets()
+{
+    int i, capacity;
+    dnsEntry **buckets, *entry;
+
+    capacity = dnsBucketCount > 0 ? dnsBucketCount * 2 : DNS_CACHE_MIN_BUCKETS;
+    buckets  = calloc(capacity, sizeof(dnsEntry *));
+    if (buckets == NULL)
+    {
+        return;
+    }
+    countStat(allocations, 1);
+
+    for (i = 0; i < dnsBucketCount; ++i)
+    {
+        while ((entry = dnsBuckets[i]) != NULL)
+        {
+            dnsBuckets[i] = entry->next;
+            entry->next   = buckets[entry->hash & (capacity - 1)];
+
+            buckets[entry->hash & (capacity - 1)] = entry;
+        }
+    }
+
+    free(dnsBuckets);
+    dnsBuckets     = buckets;
+    dnsBucketCount = capacity;
+}
+
+int startLookup(dnsEntry *entry)
+{
+    int error;
+    struct gaicb *requests[1];
+    struct sigevent notify;
+
+    free(entry->addresses);
+    entry->addresses = NULL;
+    entry->count     = 0;
+
+    memset(&entry->hints, 0, sizeof(entry->hints));
+    entry->hints.ai_family   = AF_INET;
+    entry->hints.ai_socktype = SOCK_STREAM;
+
+    memset(&entry->request, 0, sizeof(entry->request));
+    entry->request.ar_name    = entry->host;
+    entry->request.ar_service = entry->port;
+    entry->request.ar_request = &entry->hints;
+    requests[0]               = &entry->request;
+
+    memset(&notify, 0, sizeof(notify));
+    notify.sigev_notify          = SIGEV_THREAD;
+    notify.sigev_notify_function = finishLookup;
+    notify.sigev_value.sival_ptr = entry;
+
+    entry->pending = 1;
+    error          = getaddrinfo_a(GAI_NOWAIT, requests, 1, &notify);
+    if (error != 0)
+    {
+        logError("Could not start resolving '%s': %s", entry->host, gai_strerror(error));
+
+        entry->pending = 0;
+        entry->error   = error;
+        entry->expires = 0;
+
+        return -1;
+    }
+
+    logDebug("Resolving '%s' in background", entry->host);
+
+    return 0;
+}
+
+// run by getaddrinfo_a on a thread of its own
+void finishLookup(union sigval value)
+{
+    int i, count;
+    struct addrinfo *result;
+    dnsEntry *entry = value.sival_ptr;
+
+    pthread_mutex_lock(&dnsLock);
+    entry->error = gai_error(&entry->request);
+    if (entry->error == 0)
+    {
+        for (count = 0, result = entry->request.ar_result; result != NULL; result = result->ai_next)
+        {
+            ++count;
+        }
+
+        entry->addresses = malloc(count * sizeof(struct sockaddr_in));
+        if (entry->addresses == NULL || count == 0)
+        {
+            entry->error = EAI_MEMORY;
+        }
+        for (i = 0, result = entry->request.ar_result; entry->addresses != NULL && result != NULL; result = result->ai_next)
+        {
+            memcpy(&entry->addresses[i++], result->ai_addr, sizeof(struct sockaddr_in));
+        }
+        entry->count = i;
+
+        freeaddrinfo(entry->request.ar_result);
+        entry->request.ar_result = NULL;
+    }
+
+    entry->expires = monotonicSeconds() + (entry->error == 0 ? DNS_CACHE_TTL : DNS_NEGATIVE_TTL);
+    entry->pending = 0;
+    pthread_cond_broadcast(&dnsResolved);
+    pthread_mutex_unlock(&dnsLock);
+}
+
+time_t monotonicSeconds()
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec;
+}
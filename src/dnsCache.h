@@ -0,0 +1,30 @@
+#pragma once
+
+#include "httpError.h"
+#include <netinet/in.h>
+
+// getaddrinfo does not tell the TTL of the records, every answer is kept this long
+#define DNS_CACHE_TTL 60
+// seconds a host that could not be resolved is not asked again
+#define DNS_NEGATIVE_TTL 10
+// buckets of the cache at first, doubled when there are more hosts
+#define DNS_CACHE_MIN_BUCKETS 64
+
+/**
+ * Start resolving host in the background, the answer goes in the cache of
+ * the process for resolveHost to find. Nothing is done if host is already
+ * cached or being resolved.
+ *
+ * @param port service of the addresses, e.g. HTTP_PORT
+ */
+void prefetchHost(char *host, char *port);
+/**
+ * IPv4 addresses of host, from the cache when they are fresh, waiting for a
+ * prefetch in progress, or resolved now and cached. Failures are cached too,
+ * for DNS_NEGATIVE_TTL seconds.
+ *
+ * @param addresses set to a copy to free, with the port already set
+ *
+ * @return HTTP_OK or ERR_RESOLVE
+ */
+httpError resolveHost(char *host, char *port, struct sockaddr_in **addresses, int *count);
@@ -0,0 +1,215 @@
+#include "eventStream.h"
+#include "logger.h"
+#include <stdlib.h>
+#include <string.h>
+
+httpError parseField(eventParser *events, eventCallback onEvent, void *userData);
+httpError dispatchEvent(eventParser *events, eventCallback onEvent, void *userData);
+
+void initEvents(eventParser *events)
+{
+    events->afterCR    = 0;
+    events->bomMatched = 0;
+    events->lastId     = NULL;
+    events->retry      = -1;
+    initBuffer(&events->line);
+    initBuffer(&events->data);
+    initBuffer(&events->type);
+}
+
+httpError feedEvents(eventParser *events, char *data, int length, eventCallback onEvent, void *userData)
+{
+    int i, step;
+    char *lineEnd;
+    httpError error;
+
+    // the byte order mark can be split between two slices too
+    for (i = 0; events->bomMatched < 3 && i < length; ++i)
+    {
+        if (data[i] != EVENT_BOM[events->bomMatched])
+        {
+            // not a mark after all, the bytes matched start the first line
+            error = appendBuffer(&events->line, EVENT_BOM, events->bomMatched);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            events->bomMatched = 3;
+
+            break;
+        }
+
+        ++events->bomMatched;
+    }
+
+    while (i < length)
+    {
+        // the LF of a CRLF split between two slices
+        if (events->afterCR)
+        {
+            events->afterCR = 0;
+            if (data[i] == '\n')
+            {
+                ++i;
+
+                continue;
+            }
+        }
+
+        for (lineEnd = data + i; lineEnd < data + length && *lineEnd != '\n' && *lineEnd != '\r'; ++lineEnd)
+        {
+        }
+
+        step  = lineEnd - (data + i);
+        error = appendBuffer(&events->line, data + i, step);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+        i += step;
+
+        if (bufferLength(&events->line) > EVENT_MAX_SIZE)
+        {
+            logError("Event stream line longer than %d MB!", EVENT_MAX_SIZE / 1024 / 1024);
+
+            return ERR_PARSE;
+        }
+
+        // the rest of the line comes with the next slice
+        if (i == length)
+        {
+            break;
+        }
+
+        events->afterCR = data[i] == '\r';
+        ++i;
+
+        error = parseField(events, onEvent, userData);
+        consumeBuffer(&events->line, bufferLength(&events->line));
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+void resetEvents(eventParser *events)
+{
+    events->afterCR    = 0;
+    events->bomMatched = 0;
+    consumeBuffer(&events->line, bufferLength(&events->line));
+    consumeBuffer(&events->data, bufferLength(&events->data));
+    consumeBuffer(&events->type, bufferLength(&events->type));
+}
+
+void freeEvents(eventParser *events)
+{
+    freeBuffer(&events->line);
+    freeBuffer(&events->data);
+    freeBuffer(&events->type);
+    free(events->lastId);
+    events->lastId = NULL;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// 'name: value' line, an empty line ends the event
+httpError parseField(eventParser *events, eventCallback onEvent, void *userData)
+{
+    int nameLength, valueLength;
+    char *line, *colon, *value, *digitsEnd;
+    long retry;
+    httpError error;
+
+    line = bufferData(&events->line);
+    if (bufferLength(&events->line) == 0)
+    {
+        return dispatchEvent(events, onEvent, userData);
+    }
+
+    // comments, servers send them to keep idle connections open
+    if (line[0] == ':')
+    {
+        return HTTP_OK;
+    }
+
+    colon      = memchr(line, ':', bufferLength(&events->line));
+    nameLength = colon != NULL ? colon - line : bufferLength(&events->line);
+    value      = colon != NULL ? colon + 1 : line + nameLength;
+    if (colon != NULL && *value == ' ')
+    {
+        ++value;
+    }
+    valueLength = line + bufferLength(&events->line) - value;
+
+    if (nameLength == 4 && !memcmp(line, "data", 4))
+    {
+        error = appendBuffer(&events->data, value, valueLength);
+        if (error == HTTP_OK)
+        {
+            error = appendBuffer(&events->data, "\n", 1);
+        }
+        if (error == HTTP_OK && bufferLength(&events->data) > EVENT_MAX_SIZE)
+        {
+            logError("Event longer than %d MB!", EVENT_MAX_SIZE / 1024 / 1024);
+
+            error = ERR_PARSE;
+        }
+
+        return error;
+    }
+    else if (nameLength == 5 && !memcmp(line, "event", 5))
+    {
+        consumeBuffer(&events->type, bufferLength(&events->type));
+
+        return appendBuffer(&events->type, value, valueLength);
+    }
+    // an id with a null byte is ignored, an empty one clears the last id
+    else if (nameLength == 2 && !memcmp(line, "id", 2) && memchr(value, '\0', valueLength) == NULL)
+    {
+        free(events->lastId);
+        events->lastId = strndup(value, valueLength);
+
+        return events->lastId != NULL ? HTTP_OK : ERR_MEMORY;
+    }
+    else if (nameLength == 5 && !memcmp(line, "retry", 5) && valueLength > 0)
+    {
+        retry = strtol(value, &digitsEnd, 10);
+        if (digitsEnd == value + valueLength && *value >= '0' && *value <= '9')
+        {
+            logVerbose("Server asked to reconnect after %ld ms", retry);
+            events->retry = retry;
+        }
+    }
+
+    // unknown fields are ignored
+    return HTTP_OK;
+}
+
+httpError dispatchEvent(eventParser *events, eventCallback onEvent, void *userData)
+{
+    int stop;
+    serverEvent event;
+
+    // an event without data is not dispatched, but its type is forgotten
+    if (bufferLength(&events->data) == 0)
+    {
+        consumeBuffer(&events->type, bufferLength(&events->type));
+
+        return HTTP_OK;
+    }
+
+    event.type       = bufferLength(&events->type) > 0 ? bufferData(&events->type) : "message";
+    event.data       = bufferData(&events->data);
+    event.dataLength = bufferLength(&events->data) - 1;
+    event.id         = events->lastId;
+
+    stop = onEvent(userData, &event);
+
+    consumeBuffer(&events->data, bufferLength(&events->data));
+    consumeBuffer(&events->type, bufferLength(&events->type));
+
+    return stop ? ERR_ABORTED : HTTP_OK;
+}
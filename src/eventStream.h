@@ -0,0 +1,63 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+
+/** delay before reconnecting to a stream when the server asks for none, in ms */
+#define EVENT_RETRY_DEFAULT 3000
+// UTF-8 byte order mark, skipped at the start of a stream
+#define EVENT_BOM "\xEF\xBB\xBF"
+// a line or an event growing past this is not worth parsing
+#define EVENT_MAX_SIZE (16 * 1024 * 1024)
+
+/** Event of a text/event-stream body */
+typedef struct serverEvent
+{
+    /** "message" when the server did not name it */
+    char *type;
+    /** data lines joined by LF, always followed by a LF not counted in dataLength */
+    char *data;
+    int dataLength;
+    /** last id sent by the server in the stream, NULL if it never sent one */
+    char *id;
+} serverEvent;
+
+/**
+ * @return 0 to keep parsing, anything else to stop
+ */
+typedef int (*eventCallback)(void *userData, serverEvent *event);
+
+/**
+ * Streaming parser of the Server-Sent Events format. It is fed the body in
+ * slices of any size and dispatches every event as soon as the blank line
+ * closing it is parsed. Lines can end with CR, LF or CRLF, split at any byte.
+ */
+typedef struct eventParser
+{
+    /** line being read, without its end */
+    byteBuffer line;
+    /** 1 if the last line ended with CR, an LF right after belongs to it */
+    int afterCR;
+    /** bytes of the byte order mark skipped at the start of the stream, 3 once past it */
+    int bomMatched;
+
+    // EVENT BEING READ
+    byteBuffer data;
+    byteBuffer type;
+
+    /** kept across the events and the reconnections */
+    char *lastId;
+    /** reconnection delay asked by the server in ms, -1 if it never asked */
+    long retry;
+} eventParser;
+
+void initEvents(eventParser *events);
+/**
+ * Parse the next slice of the stream, onEvent is called with every event completed.
+ *
+ * @return ERR_ABORTED if onEvent asked to stop, ERR_PARSE if an event is longer than EVENT_MAX_SIZE
+ */
+httpError feedEvents(eventParser *events, char *data, int length, eventCallback onEvent, void *userData);
+/** Drop the event left incomplete by a closed connection, keeping the last id and the retry delay */
+void resetEvents(eventParser *events);
+void freeEvents(eventParser *events);
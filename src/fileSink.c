@@ -0,0 +1,515 @@
+#define _GNU_SOURCE
+#include "fileSink.h"
+#include "logger.h"
+#include "stats.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+int setupRing(fileSink *sink);
+void destroyRing(fileSink *sink);
+int reapCompletions(fileSink *sink, int waitFor);
+int writeAll(fileSink *sink, char *data, int length, long long offset);
+int drainPipe(fileSink *sink, int length);
+
+fileSink *openSink(char *path, long long offset, long long expectedSize, int flags)
+{
+    int i, openFlags;
+    struct stat outputInfo;
+    fileSink *sink;
+
+    sink = calloc(1, sizeof(fileSink));
+    if (sink == NULL)
+    {
+        logError("Could not allocate file sink!");
+
+        return NULL;
+    }
+    sink->ring          = -1;
+    sink->splicePipe[0] = sink->splicePipe[1] = -1;
+
+    openFlags        = O_WRONLY | O_CREAT | (flags & SINK_DURABLE ? O_DSYNC : 0);
+    sink->descriptor = strcmp(path, SINK_STDOUT) ? open(path, openFlags, 0644) : STDOUT_FILENO;
+    if (sink->descriptor == -1 || fstat(sink->descriptor, &outputInfo) == -1)
+    {
+        logError("Could not open '%s' to write!", path);
+        free(sink);
+
+        return NULL;
+    }
+
+    // stdout redirected to a file is still written at its own position
+    sink->stream     = sink->descriptor == STDOUT_FILENO || !S_ISREG(outputInfo.st_mode);
+    sink->spliceable = S_ISREG(outputInfo.st_mode) || S_ISFIFO(outputInfo.st_mode);
+    // a pipe takes the data straight from the socket, no need for another one
+    if (S_ISFIFO(outputInfo.st_mode))
+    {
+        sink->splicePipe[1] = sink->descriptor;
+    }
+
+    if (!sink->stream && ftruncate(sink->descriptor, offset) == -1)
+    {
+        logError("Could not truncate '%s' to %lld bytes!", path, offset);
+        close(sink->descriptor);
+        free(sink);
+
+        return NULL;
+    }
+    sink->offset = offset;
+
+    if (expectedSize > 0 && !sink->stream)
+    {
+        // keep the size so a partial file still tells how much was written
+        if (fallocate(sink->descriptor, FALLOC_FL_KEEP_SIZE, offset, expectedSize) == 0)
+        {
+            sink->reserved = offset + expectedSize;
+            logDebug("Reserved %lld bytes for '%s'", expectedSize, path);
+        }
+        else
+        {
+            logDebug("fallocate not available (%s), writing without reservation", strerror(errno));
+        }
+    }
+
+    for (i = 0; i < SINK_BUFFERS; ++i)
+    {
+        sink->slots[i].vector.iov_base = malloc(SINK_BUFFER_SIZE);
+        sink->slots[i].vector.iov_len  = SINK_BUFFER_SIZE;
+        if (sink->slots[i].vector.iov_base == NULL)
+        {
+            logError("Could not allocate sink buffers!");
+            closeSink(sink);
+
+            return NULL;
+        }
+    }
+
+    // a write to the page cache returns at once, the ring only pays off when they wait
+    // for the disk and there is enough data to overlap. Writes to a stream must not
+    // complete out of order
+    if ((flags & SINK_DURABLE) && !sink->stream && (expectedSize <= 0 || expectedSize > SINK_BUFFER_SIZE))
+    {
+        if (setupRing(sink) == -1)
+        {
+            logVerbose("io_uring not available, falling back to pwrite");
+        }
+    }
+
+    return sink;
+}
+
+char *sinkBuffer(fileSink *sink, int *size)
+{
+    sinkSlot *slot;
+
+    slot = &sink->slots[sink->nextSlot];
+
+    // slots are used round robin, so the next one is the oldest submitted
+    while (slot->busy)
+    {
+        if (reapCompletions(sink, 1) == -1)
+        {
+            return NULL;
+        }
+    }
+
+    *size = SINK_BUFFER_SIZE;
+
+    return slot->vector.iov_base;
+}
+
+int sinkCommit(fileSink *sink, char *buffer, int length)
+{
+    unsigned tail, index;
+    sinkSlot *slot;
+    struct io_uring_sqe *sqe;
+
+    slot = &sink->slots[sink->nextSlot];
+    if (slot->vector.iov_base != buffer)
+    {
+        logError("Committed buffer was not returned by sinkBuffer!");
+
+        return -1;
+    }
+
+    slot->offset = sink->offset;
+    slot->length = length;
+    sink->offset += length;
+    sink->nextSlot = (sink->nextSlot + 1) % SINK_BUFFERS;
+
+    if (sink->ring == -1)
+    {
+        return writeAll(sink, buffer, length, slot->offset);
+    }
+
+    tail  = *sink->sqTail;
+    index = tail & *sink->sqMask;
+    sqe   = &sink->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = IORING_OP_WRITE_FIXED;
+    sqe->fd        = sink->descriptor;
+    sqe->addr      = (unsigned long)buffer;
+    sqe->len       = length;
+    sqe->off       = slot->offset;
+    sqe->buf_index = slot - sink->slots;
+    sqe->user_data = slot - sink->slots;
+    // submitted inline an O_DSYNC write would wait for the disk in io_uring_enter, a ring worker waits instead
+    sqe->flags     = IOSQE_ASYNC;
+
+    sink->sqArray[index] = index;
+    __atomic_store_n(sink->sqTail, tail + 1, __ATOMIC_RELEASE);
+
+    if (syscall(__NR_io_uring_enter, sink->ring, 1, 0, 0, NULL, 0) != 1)
+    {
+        logWarn("io_uring submission failed (%s), writing synchronously", strerror(errno));
+        __atomic_store_n(sink->sqTail, tail, __ATOMIC_RELEASE);
+
+        return writeAll(sink, buffer, length, slot->offset);
+    }
+
+    slot->busy = 1;
+    ++sink->inFlight;
+
+    return 0;
+}
+
+int sinkWrite(fileSink *sink, char *data, int length)
+{
+    int size, step;
+    char *buffer;
+
+    while (length > 0)
+    {
+        buffer = sinkBuffer(sink, &size);
+        if (buffer == NULL)
+        {
+            return -1;
+        }
+
+        step = length < size ? length : size;
+        memcpy(buffer, data, step);
+        countStat(bytesCopied, step);
+
+        if (sinkCommit(sink, buffer, step) == -1)
+        {
+            return -1;
+        }
+
+        data += step;
+        length -= step;
+    }
+
+    return 0;
+}
+
+int sinkSplice(fileSink *sink, int descriptor, int length)
+{
+    int moved;
+
+    if (sink->splicePipe[1] == -1)
+    {
+        if (pipe(sink->splicePipe) == -1)
+        {
+            logError("Could not create splice pipe: %s", strerror(errno));
+
+            return -1;
+        }
+
+        // a bigger pipe moves more of the body for every pair of splice calls
+        fcntl(sink->splicePipe[1], F_SETPIPE_SZ, SINK_PIPE_SIZE);
+    }
+
+    if (sink->splicePipe[1] == sink->descriptor)
+    {
+        do
+        {
+            moved = splice(descriptor, NULL, sink->descriptor, NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } while (moved == -1 && errno == EINTR);
+    }
+    else
+    {
+        length = length < SINK_PIPE_SIZE ? length : SINK_PIPE_SIZE;
+        do
+        {
+            moved = splice(descriptor, NULL, sink->splicePipe[1], NULL, length, SPLICE_F_MOVE | SPLICE_F_MORE);
+        } while (moved == -1 && errno == EINTR);
+
+        if (moved > 0 && drainPipe(sink, moved) == -1)
+        {
+            return -1;
+        }
+    }
+
+    if (moved == -1)
+    {
+        logError("Could not splice the body: %s", strerror(errno));
+
+        return -1;
+    }
+
+    countStat(splicedBytes, moved);
+    sink->offset += moved;
+
+    return moved;
+}
+
+int closeSink(fileSink *sink)
+{
+    int i, error;
+
+    error = 0;
+    while (sink->inFlight > 0 && error == 0)
+    {
+        error = reapCompletions(sink, 1);
+    }
+
+    destroyRing(sink);
+
+    // the transfer can be shorter than announced, don't leave reserved zeros behind
+    if (sink->reserved > sink->offset &&
+        ftruncate(sink->descriptor, sink->offset) == -1)
+    {
+        logError("Could not trim preallocated space!");
+        error = -1;
+    }
+
+    if (sink->splicePipe[0] != -1)
+    {
+        close(sink->splicePipe[0]);
+        close(sink->splicePipe[1]);
+    }
+
+    // stdout stays open for whatever else the process prints
+    if (sink->descriptor != STDOUT_FILENO && close(sink->descriptor) == -1)
+    {
+        logError("Could not close output file!");
+        error = -1;
+    }
+
+    for (i = 0; i < SINK_BUFFERS; ++i)
+    {
+        free(sink->slots[i].vector.iov_base);
+    }
+    free(sink);
+
+    return error;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+int setupRing(fileSink *sink)
+{
+    int i;
+    struct io_uring_params params;
+    struct iovec vectors[SINK_BUFFERS];
+
+    memset(&params, 0, sizeof(params));
+    sink->ring = syscall(__NR_io_uring_setup, SINK_BUFFERS, &params);
+    if (sink->ring == -1)
+    {
+        return -1;
+    }
+
+    sink->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    sink->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (sink->cqRingSize > sink->sqRingSize)
+        {
+            sink->sqRingSize = sink->cqRingSize;
+        }
+        sink->cqRingSize = 0;
+    }
+
+    sink->sqRing = mmap(NULL, sink->sqRingSize, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, sink->ring, IORING_OFF_SQ_RING);
+    if (sink->sqRing == MAP_FAILED)
+    {
+        sink->sqRing = NULL;
+        destroyRing(sink);
+
+        return -1;
+    }
+
+    if (sink->cqRingSize == 0)
+    {
+        sink->cqRing = sink->sqRing;
+    }
+    else
+    {
+        sink->cqRing = mmap(NULL, sink->cqRingSize, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, sink->ring, IORING_OFF_CQ_RING);
+        if (sink->cqRing == MAP_FAILED)
+        {
+            sink->cqRing = NULL;
+            destroyRing(sink);
+
+            return -1;
+        }
+    }
+
+    sink->sqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    sink->sqes     = mmap(NULL, sink->sqesSize, PROT_READ | PROT_WRITE,
+                          MAP_SHARED | MAP_POPULATE, sink->ring, IORING_OFF_SQES);
+    if (sink->sqes == MAP_FAILED)
+    {
+        sink->sqes = NULL;
+        destroyRing(sink);
+
+        return -1;
+    }
+
+    sink->sqHead  = (unsigned *)((char *)sink->sqRing + params.sq_off.head);
+    sink->sqTail  = (unsigned *)((char *)sink->sqRing + params.sq_off.tail);
+    sink->sqMask  = (unsigned *)((char *)sink->sqRing + params.sq_off.ring_mask);
+    sink->sqArray = (unsigned *)((char *)sink->sqRing + params.sq_off.array);
+    sink->cqHead  = (unsigned *)((char *)sink->cqRing + params.cq_off.head);
+    sink->cqTail  = (unsigned *)((char *)sink->cqRing + params.cq_off.tail);
+    sink->cqMask  = (unsigned *)((char *)sink->cqRing + params.cq_off.ring_mask);
+    sink->cqes    = (struct io_uring_cqe *)((char *)sink->cqRing + params.cq_off.cqes);
+
+    // registered buffers spare the kernel from pinning the pages on every write
+    for (i = 0; i < SINK_BUFFERS; ++i)
+    {
+        vectors[i] = sink->slots[i].vector;
+    }
+    if (syscall(__NR_io_uring_register, sink->ring, IORING_REGISTER_BUFFERS, vectors, SINK_BUFFERS) == -1)
+    {
+        destroyRing(sink);
+
+        return -1;
+    }
+
+    logDebug("io_uring ready with %d registered buffers of %d KB", SINK_BUFFERS, SINK_BUFFER_SIZE / 1024);
+
+    return 0;
+}
+
+void destroyRing(fileSink *sink)
+{
+    if (sink->sqes != NULL)
+    {
+        munmap(sink->sqes, sink->sqesSize);
+    }
+    if (sink->cqRing != NULL && sink->cqRing != sink->sqRing)
+    {
+        munmap(sink->cqRing, sink->cqRingSize);
+    }
+    if (sink->sqRing != NULL)
+    {
+        munmap(sink->sqRing, sink->sqRingSize);
+    }
+    if (sink->ring != -1)
+    {
+        close(sink->ring);
+    }
+
+    sink->sqes   = NULL;
+    sink->sqRing = sink->cqRing = NULL;
+    sink->ring   = -1;
+}
+
+int reapCompletions(fileSink *sink, int waitFor)
+{
+    int error;
+    unsigned head;
+    sinkSlot *slot;
+    struct io_uring_cqe *cqe;
+
+    if (waitFor && syscall(__NR_io_uring_enter, sink->ring, 0, waitFor, IORING_ENTER_GETEVENTS, NULL, 0) == -1 &&
+        errno != EINTR)
+    {
+        logError("Could not wait for disk writes: %s", strerror(errno));
+
+        return -1;
+    }
+
+    error = 0;
+    head  = *sink->cqHead;
+    while (head != __atomic_load_n(sink->cqTail, __ATOMIC_ACQUIRE))
+    {
+        cqe  = &sink->cqes[head & *sink->cqMask];
+        slot = &sink->slots[cqe->user_data];
+
+        if (cqe->res < 0)
+        {
+            logError("Disk write failed: %s", strerror(-cqe->res));
+            error = -1;
+        }
+        else if (cqe->res < slot->length &&
+                 writeAll(sink, (char *)slot->vector.iov_base + cqe->res,
+                          slot->length - cqe->res, slot->offset + cqe->res) == -1)
+        {
+            error = -1;
+        }
+
+        slot->busy = 0;
+        --sink->inFlight;
+        ++head;
+    }
+    __atomic_store_n(sink->cqHead, head, __ATOMIC_RELEASE);
+
+    return error;
+}
+
+int writeAll(fileSink *sink, char *data, int length, long long offset)
+{
+    int written;
+
+    while (length > 0)
+    {
+        written = sink->stream ? write(sink->descriptor, data, length) : pwrite(sink->descriptor, data, length, offset);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            logError("Disk write failed: %s", strerror(errno));
+
+            return -1;
+        }
+
+        data += written;
+        offset += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+// move length bytes from the splice pipe to the output, at the sink offset for a file
+int drainPipe(fileSink *sink, int length)
+{
+    int moved;
+    loff_t offset;
+
+    offset = sink->offset;
+    while (length > 0)
+    {
+        moved = splice(sink->splicePipe[0], NULL, sink->descriptor, sink->stream ? NULL : &offset, length,
+                       SPLICE_F_MOVE | SPLICE_F_MORE);
+        if (moved == -1 && errno == EINTR)
+        {
+            continue;
+        }
+        if (moved <= 0)
+        {
+            logError("Disk write failed: %s", moved == -1 ? strerror(errno) : "output closed");
+
+            return -1;
+        }
+
+        length -= moved;
+    }
+
+    return 0;
+}
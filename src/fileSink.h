@@ -0,0 +1,116 @@
+#pragma once
+
+#include <linux/io_uring.h>
+#include <sys/uio.h>
+
+#define SINK_BUFFERS     8
+#define SINK_BUFFER_SIZE (64 * 1024)
+// capacity asked for the pipe a spliced body goes through on its way to a file
+#define SINK_PIPE_SIZE (1024 * 1024)
+
+/** path of the sink writing to the standard output */
+#define SINK_STDOUT "-"
+
+/** openSink flag: every write reaches the disk before it completes (O_DSYNC) */
+#define SINK_DURABLE 1
+
+typedef struct sinkSlot
+{
+    struct iovec vector;
+    long long offset;
+    int length;
+    /** 1 while a write using this buffer is still in flight */
+    int busy;
+} sinkSlot;
+
+typedef struct fileSink
+{
+    int descriptor;
+    /** offset where the next committed buffer will be written */
+    long long offset;
+    /** bytes reserved with fallocate, 0 if nothing was reserved */
+    long long reserved;
+    /** 1 for the standard output, a pipe or a device: written in order with
+     *  write, never truncated nor reserved */
+    int stream;
+    /** 1 if sinkSplice can be used, the output is a pipe or a regular file */
+    int spliceable;
+    /** pipe spliced data goes through when the output is not a pipe itself, -1 until used */
+    int splicePipe[2];
+
+    /** io_uring file descriptor of a SINK_DURABLE sink, -1 when writing with pwrite */
+    int ring;
+    void *sqRing;
+    void *cqRing;
+    int sqRingSize;
+    int cqRingSize;
+    struct io_uring_sqe *sqes;
+    int sqesSize;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    int inFlight;
+
+    sinkSlot slots[SINK_BUFFERS];
+    int nextSlot;
+} fileSink;
+
+/**
+ * Open (or create) path as the destination of a response body, SINK_STDOUT
+ * for the standard output.
+ * When expectedSize is known the space is reserved up front with fallocate.
+ * Writes go out with pwrite, the page cache absorbs them faster than a ring.
+ * With SINK_DURABLE every write waits for the disk, so they are submitted
+ * through io_uring using registered buffers to keep several of them in flight,
+ * falling back to pwrite when io_uring is not available.
+ *
+ * @param path file to write
+ * @param offset where the first byte of the body will be written, the file is
+ *               truncated to this size
+ * @param expectedSize number of bytes that will be written, 0 or -1 if unknown
+ * @param flags 0 or SINK_DURABLE
+ *
+ * @return New sink, NULL on error
+ */
+fileSink *openSink(char *path, long long offset, long long expectedSize, int flags);
+
+/**
+ * Returns a free buffer to recive data into, waiting for pending writes if
+ * all buffers are still in use.
+ *
+ * @param sink the sink that owns the buffer
+ * @param size is an integer passed by reference that is set to the buffer capacity
+ */
+char *sinkBuffer(fileSink *sink, int *size);
+
+/**
+ * Queue the write of the first length bytes of a buffer returned by sinkBuffer.
+ * The buffer must not be touched until it is returned again by sinkBuffer.
+ *
+ * @return 0 on success, -1 on error
+ */
+int sinkCommit(fileSink *sink, char *buffer, int length);
+
+/** Copy data into the sink buffers and queue the writes. */
+int sinkWrite(fileSink *sink, char *data, int length);
+
+/**
+ * Move up to length bytes from descriptor to the output with splice, so they
+ * never pass through user space. Only allowed when sink->spliceable.
+ *
+ * @return Bytes moved, 0 if descriptor reached its end, -1 on error
+ */
+int sinkSplice(fileSink *sink, int descriptor, int length);
+
+/**
+ * Wait for all the pending writes, trim any unused preallocated space and
+ * close the file.
+ *
+ * @return 0 on success, -1 if any write failed
+ */
+int closeSink(fileSink *sink);
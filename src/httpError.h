@@ -0,0 +1,21 @@
+#pragma once
+
+// don't forget to update the descriptions in httpLib.c
+typedef enum httpError
+{
+    HTTP_OK,
+    ERR_MEMORY,
+    ERR_INVALID,
+    ERR_RESOLVE,
+    ERR_CONNECT,
+    ERR_TLS,
+    ERR_SEND,
+    ERR_RECIVE,
+    ERR_CLOSED,
+    ERR_PARSE,
+    ERR_FILE,
+    ERR_ABORTED,
+    /** the server certificate is not trusted, does not match the host or is revoked */
+    ERR_CERTIFICATE,
+    HTTP_ERROR_MAX
+} httpError;
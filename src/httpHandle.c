@@ -0,0 +1,500 @@
+#include "httpHandle.h"
+#include "httpLib.h"
+#include "httpParser.h"
+#include "logger.h"
+#include "socketUtils.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+httpError performTransfer(httpHandle *handle);
+void clearResponse(httpResponse *res);
+void dropConnection(httpHandle *handle);
+
+httpHandle *createHandle()
+{
+    httpHandle *handle;
+
+    handle = calloc(1, sizeof(httpHandle));
+    if (handle == NULL)
+    {
+        return NULL;
+    }
+
+    // This are calloc so we don't have to manually set all pointers/lengths to NULL/0
+    handle->req = calloc(1, sizeof(httpRequest));
+    handle->res = calloc(1, sizeof(httpResponse));
+    if (handle->req == NULL || handle->res == NULL)
+    {
+        free(handle->req);
+        free(handle->res);
+        free(handle);
+
+        return NULL;
+    }
+
+    handle->req->method = GET;
+    handle->req->type   = NONE;
+
+    return handle;
+}
+
+httpError setMethod(httpHandle *handle, httpMethods method)
+{
+    if (method < 0 || method >= METHODS_MAX)
+    {
+        return ERR_INVALID;
+    }
+
+    handle->req->method = method;
+
+    return HTTP_OK;
+}
+
+httpError setUrl(httpHandle *handle, char *url)
+{
+    return parseUrl(url, handle->req);
+}
+
+httpError addRequestHeader(httpHandle *handle, char *line)
+{
+    return addHeader(handle->req, "%s", line);
+}
+
+httpError addRequestPart(httpHandle *handle, char *name, char *value, char *path)
+{
+    return addPart(handle->req, name, value, path);
+}
+
+httpError setBody(httpHandle *handle, contentType type, char *body)
+{
+    httpRequest *req = handle->req;
+    httpForm *formEntry;
+
+    if (type != TEXT_PLAIN && type != JSON && type != FORM)
+    {
+        return ERR_INVALID;
+    }
+
+    free(req->text);
+    req->text = NULL;
+    while (req->form != NULL)
+    {
+        formEntry = req->form;
+        req->form = req->form->next;
+
+        free(formEntry->entry);
+        free(formEntry);
+    }
+    freeParts(req->parts);
+    req->parts = NULL;
+
+    if (type == FORM)
+    {
+        req->form = calloc(1, sizeof(httpForm));
+        if (req->form == NULL)
+        {
+            return ERR_MEMORY;
+        }
+
+        req->form->entry       = strdup(body);
+        req->form->entryLength = strlen(body);
+        req->form->encoded     = 1;
+        if (req->form->entry == NULL)
+        {
+            free(req->form);
+            req->form = NULL;
+
+            return ERR_MEMORY;
+        }
+    }
+    else
+    {
+        req->text = strdup(body);
+        if (req->text == NULL)
+        {
+            return ERR_MEMORY;
+        }
+    }
+
+    req->type = type;
+
+    return HTTP_OK;
+}
+
+httpError setRequestPayload(httpHandle *handle, char *payload, int payloadSize)
+{
+    httpRequest *req = handle->req;
+
+    if (!req->borrowed)
+    {
+        free(req->payload);
+    }
+    req->borrowed = 0;
+    req->payload  = malloc(payloadSize);
+    if (req->payload == NULL)
+    {
+        req->prebuilt = 0;
+
+        return ERR_MEMORY;
+    }
+
+    memcpy(req->payload, payload, payloadSize);
+    req->payloadSize = payloadSize;
+    req->prebuilt    = 1;
+
+    return HTTP_OK;
+}
+
+void borrowRequestPayload(httpHandle *handle, char *payload, int payloadSize)
+{
+    httpRequest *req = handle->req;
+
+    if (!req->borrowed)
+    {
+        free(req->payload);
+    }
+    req->payload     = payload;
+    req->payloadSize = payloadSize;
+    req->prebuilt    = 1;
+    req->borrowed    = 1;
+}
+
+void setHeaderCallback(httpHandle *handle, headerCallback callback, void *userData)
+{
+    handle->res->onHeader   = callback;
+    handle->res->headerData = userData;
+}
+
+void setBodyCallback(httpHandle *handle, bodyCallback callback, void *userData)
+{
+    handle->res->onBody   = callback;
+    handle->res->bodyData = userData;
+}
+
+void setStreaming(httpHandle *handle, int streaming)
+{
+    handle->res->streaming = streaming;
+}
+
+httpError setSocketProfile(httpHandle *handle, socketProfileName profile)
+{
+    if (profile < 0 || profile >= SOCKET_PROFILE_MAX)
+    {
+        return ERR_INVALID;
+    }
+
+    // applies from the next connection, the current one keeps its options
+    handle->req->socketProfile = profile;
+
+    return HTTP_OK;
+}
+
+httpError setUnixSocket(httpHandle *handle, char *path)
+{
+    char *copy;
+
+    copy = NULL;
+    if (path != NULL && (copy = strdup(path)) == NULL)
+    {
+        return ERR_MEMORY;
+    }
+
+    free(handle->req->unixSocket);
+    handle->req->unixSocket = copy;
+
+    return HTTP_OK;
+}
+
+httpError setRateLimit(httpHandle *handle, long long rate, int weight)
+{
+    removeRateLimit(handle);
+
+    handle->limiter = createLimiter(rate, weight);
+    if (handle->connection != NULL)
+    {
+        handle->connection->limiter = handle->limiter;
+    }
+
+    return handle->limiter == NULL ? ERR_MEMORY : HTTP_OK;
+}
+
+void removeRateLimit(httpHandle *handle)
+{
+    destroyLimiter(handle->limiter);
+    handle->limiter = NULL;
+
+    if (handle->connection != NULL)
+    {
+        handle->connection->limiter = NULL;
+    }
+}
+
+httpError performRequest(httpHandle *handle)
+{
+    sigset_t oldMask;
+    httpError error;
+
+    if (handle->req->host == NULL)
+    {
+        return ERR_INVALID;
+    }
+
+    blockSigpipe(&oldMask);
+    error = performTransfer(handle);
+    restoreSigpipe(&oldMask);
+
+    return error;
+}
+
+int responseStatus(httpHandle *handle)
+{
+    return handle->res->status;
+}
+
+contentType responseType(httpHandle *handle)
+{
+    return handle->res->type;
+}
+
+void resetHandle(httpHandle *handle)
+{
+    httpRequest *req = handle->req;
+    httpResponse *res = handle->res;
+    httpForm *formEntry;
+    socketProfileName profile;
+    char *unixSocket;
+
+    free(req->host);
+    free(req->path);
+    free(req->text);
+    if (!req->borrowed)
+    {
+        free(req->payload);
+    }
+    free(req->outputPath);
+    free(req->expectedChecksum);
+    free(req->summaryPath);
+    free(req->urlList);
+    free(req->templateData);
+    free(req->ranges);
+    free(req->caFile);
+    free(req->caPath);
+    freeHeaders(req->headers);
+    freeHeaders(req->generatedHeaders);
+
+    while (req->form != NULL)
+    {
+        formEntry = req->form;
+        req->form = req->form->next;
+
+        free(formEntry->entry);
+        free(formEntry);
+    }
+    freeParts(req->parts);
+
+    profile    = req->socketProfile;
+    unixSocket = req->unixSocket;
+    memset(req, 0, sizeof(httpRequest));
+    req->method        = GET;
+    req->type          = NONE;
+    req->socketProfile = profile;
+    req->unixSocket    = unixSocket;
+
+    clearResponse(res);
+    res->onHeader   = NULL;
+    res->headerData = NULL;
+    res->onBody     = NULL;
+    res->bodyData   = NULL;
+    res->streaming  = 0;
+}
+
+void destroyHandle(httpHandle *handle)
+{
+    removeRateLimit(handle);
+    dropConnection(handle);
+    freeHttp(handle->req, handle->res);
+    free(handle);
+}
+
+httpHandle *pickHandle(handleSlot *pool, int poolSize, char *host, int secure, socketProfileName profile, long job)
+{
+    int i, chosen;
+    socketStruct *connection;
+
+    chosen = -1;
+    for (i = 0; i < poolSize && chosen == -1; ++i)
+    {
+        connection = pool[i].handle != NULL ? pool[i].handle->connection : NULL;
+        if (connection != NULL && pool[i].handle->connectionSecure == secure &&
+            pool[i].handle->connectionProfile == profile && !strcasecmp(connection->host, host))
+        {
+            chosen = i;
+            logVerbose("Reusing warm connection to '%s'", host);
+        }
+    }
+
+    for (i = 0; i < poolSize && chosen == -1; ++i)
+    {
+        if (pool[i].handle == NULL)
+        {
+            pool[i].handle = createHandle();
+            chosen         = i;
+        }
+    }
+
+    if (chosen == -1)
+    {
+        chosen = 0;
+        for (i = 1; i < poolSize; ++i)
+        {
+            if (pool[i].lastUsed < pool[chosen].lastUsed)
+            {
+                chosen = i;
+            }
+        }
+    }
+
+    pool[chosen].lastUsed = job;
+
+    return pool[chosen].handle;
+}
+
+void destroyPool(handleSlot *pool, int poolSize)
+{
+    int i;
+
+    for (i = 0; i < poolSize; ++i)
+    {
+        if (pool[i].handle != NULL)
+        {
+            destroyHandle(pool[i].handle);
+            pool[i].handle = NULL;
+        }
+    }
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+httpError performTransfer(httpHandle *handle)
+{
+    int attempt, reused, sent;
+    httpRequest *req  = handle->req;
+    httpResponse *res = handle->res;
+    httpError error;
+
+    if (!req->prebuilt)
+    {
+        error = generateHeaders(req);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        error = buildRequest(req);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    // only a connection to the same host, scheme, socket and profile can be reused
+    if (handle->connection != NULL &&
+        (handle->connectionSecure != req->secure || handle->connectionProfile != req->socketProfile ||
+         strcasecmp(handle->connection->host, req->host) ||
+         (handle->connection->unixPath == NULL) != (req->unixSocket == NULL) ||
+         (req->unixSocket != NULL && strcmp(handle->connection->unixPath, req->unixSocket))))
+    {
+        dropConnection(handle);
+    }
+
+    for (attempt = 0; attempt < 2; ++attempt)
+    {
+        reused = handle->connection != NULL;
+        if (!reused)
+        {
+            error = createSocket(&handle->connection, req->host, req->secure, req->socketProfile, req->unixSocket);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            handle->connectionSecure    = req->secure;
+            handle->connectionProfile   = req->socketProfile;
+            handle->connection->limiter = handle->limiter;
+        }
+
+        clearResponse(res);
+
+        sent  = 0;
+        error = sendRequest(handle->connection, req);
+        if (error == HTTP_OK)
+        {
+            sent  = 1;
+            error = reciveHeaders(handle->connection, res);
+        }
+
+        // the server can close a kept alive connection at any time. Once the whole request
+        // is out it may have been served before, only the methods safe to repeat are sent again
+        if (reused && (error == ERR_SEND || error == ERR_RECIVE || error == ERR_CLOSED) &&
+            (!sent || req->method == GET || req->method == HEAD || req->method == OPTIONS))
+        {
+            logVerbose("Kept alive connection to '%s' was closed, reconnecting", req->host);
+            dropConnection(handle);
+
+            continue;
+        }
+
+        break;
+    }
+
+    if (error != HTTP_OK)
+    {
+        dropConnection(handle);
+
+        return error;
+    }
+
+    // HEAD responses announce the length of a body that is never sent
+    if (req->method == HEAD || res->status == 204 || res->status == 304)
+    {
+        res->contentLength = 0;
+    }
+
+    error = reciveBody(handle->connection, res);
+    if (error != HTTP_OK || !res->keepAlive || req->bodyWithheld)
+    {
+        dropConnection(handle);
+    }
+
+    return error;
+}
+
+// free the data of the previous response, keeping the callbacks
+void clearResponse(httpResponse *res)
+{
+    free(res->content);
+    free(res->etag);
+    free(res->lastModified);
+    destroyParser(res->parser);
+
+    res->status        = 0;
+    res->type          = NONE;
+    res->contentLength = 0;
+    res->content       = NULL;
+    res->etag          = NULL;
+    res->lastModified  = NULL;
+    res->rangeStart    = -1;
+    res->rangeEnd      = -1;
+    res->rangeTotal    = -1;
+    res->keepAlive     = 0;
+    res->parser        = NULL;
+}
+
+void dropConnection(httpHandle *handle)
+{
+    if (handle->connection != NULL)
+    {
+        closeSocket(handle->connection);
+        handle->connection = NULL;
+    }
+}
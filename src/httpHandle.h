@@ -0,0 +1,125 @@
+#pragma once
+
+#include "httpLib.h"
+#include "socketUtils.h"
+
+/**
+ * Reusable HTTP/S client for embedding wannabeCurl in other programs.
+ * No function exits the process: errors are returned as httpError codes.
+ * The connection of a handle is kept open between requests to the same
+ * host, and TLS sessions are resumed across connections of the process.
+ * Call silenceLogger() to keep the library from printing to stdout.
+ */
+typedef struct httpHandle
+{
+    httpRequest *req;
+    httpResponse *res;
+
+    /** connection kept open from the previous request, NULL if none */
+    socketStruct *connection;
+    int connectionSecure;
+    socketProfileName connectionProfile;
+
+    /** paces the transfers of the handle, NULL for no limit */
+    rateLimiter *limiter;
+} httpHandle;
+
+/** Entry of a pool of handles kept connected to different hosts */
+typedef struct handleSlot
+{
+    httpHandle *handle;
+    /** number of the last request served, to evict the least recently used */
+    long lastUsed;
+} handleSlot;
+
+/** @return New handle with GET as method, NULL if out of memory */
+httpHandle *createHandle();
+
+httpError setMethod(httpHandle *handle, httpMethods method);
+/** @return ERR_INVALID if url is not a valid http/https url */
+httpError setUrl(httpHandle *handle, char *url);
+/** @param line complete header line in the form 'name: value' */
+httpError addRequestHeader(httpHandle *handle, char *line);
+/**
+ * Set the request body.
+ *
+ * @param type TEXT_PLAIN, JSON or FORM, FORM bodies must be already url encoded
+ *
+ * Replaces the parts added with addRequestPart.
+ */
+httpError setBody(httpHandle *handle, contentType type, char *body);
+/**
+ * Add a multipart/form-data part, files are streamed from disk while sending.
+ *
+ * @param value content of the part, NULL if path is used
+ * @param path file to upload, NULL if value is used
+ */
+httpError addRequestPart(httpHandle *handle, char *name, char *value, char *path);
+
+/**
+ * Send payload as it is instead of building the request from method, headers
+ * and body. The url must still be set to know where to connect.
+ */
+httpError setRequestPayload(httpHandle *handle, char *payload, int payloadSize);
+/**
+ * Like setRequestPayload without the copy: payload stays owned by the caller
+ * and must not change until the request is performed and the handle reset.
+ */
+void borrowRequestPayload(httpHandle *handle, char *payload, int payloadSize);
+
+void setHeaderCallback(httpHandle *handle, headerCallback callback, void *userData);
+/** Without a body callback the body is stored in handle->res->content */
+void setBodyCallback(httpHandle *handle, bodyCallback callback, void *userData);
+/**
+ * With streaming set every piece of body goes to the body callback as soon as
+ * it is read, for responses that never end like event streams. Without it big
+ * bodies are read in blocks, with fewer calls.
+ */
+void setStreaming(httpHandle *handle, int streaming);
+
+/** Options of the sockets opened by the handle, kept by resetHandle */
+httpError setSocketProfile(httpHandle *handle, socketProfileName profile);
+/**
+ * Connect to the unix socket path instead of the host of the url, which is
+ * still sent in the Host header. @name is in the abstract namespace, NULL
+ * goes back to TCP. Kept by resetHandle.
+ */
+httpError setUnixSocket(httpHandle *handle, char *path);
+
+/**
+ * Limit the transfers of the handle, see setGlobalRate to share a rate among handles.
+ *
+ * @param rate bytes per second, 0 to only take part in the global rate
+ * @param weight share of the global rate compared to the other handles
+ */
+httpError setRateLimit(httpHandle *handle, long long rate, int weight);
+/** Stop pacing the handle and give its share of the global rate back */
+void removeRateLimit(httpHandle *handle);
+
+/**
+ * Send the request and recive the whole response.
+ * When a reused connection turns out to be closed by the server, the request
+ * is sent again on a new connection.
+ */
+httpError performRequest(httpHandle *handle);
+
+int responseStatus(httpHandle *handle);
+contentType responseType(httpHandle *handle);
+
+/** Clear method, url, headers, body and callbacks, keeping the connection and its settings */
+void resetHandle(httpHandle *handle);
+void destroyHandle(httpHandle *handle);
+
+/**
+ * Pick the handle for a request to host from a pool: the one already connected
+ * to it with the socket options of profile, else an empty slot, else the least
+ * recently used one.
+ *
+ * @param pool zeroed before the first call, handles are created as needed
+ * @param job increasing number of the request, marks the slot as used
+ *
+ * @return NULL if a new handle could not be allocated
+ */
+httpHandle *pickHandle(handleSlot *pool, int poolSize, char *host, int secure, socketProfileName profile, long job);
+/** Destroy every handle of the pool */
+void destroyPool(handleSlot *pool, int poolSize);
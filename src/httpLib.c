@@ -1,14 +1,29 @@
+#define _GNU_SOURCE
 #include "httpLib.h"
+#include "byteBuffer.h"
+#include "byteRanges.h"
+#include "httpParser.h"
 #include "logger.h"
+#include "probes.h"
 #include "socketUtils.h"
+#include "stats.h"
 #include "utils.h"
 #include <ctype.h>
+#include <fcntl.h>
 #include <openssl/err.h>
+#include <openssl/rand.h>
 #include <openssl/ssl.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#define BODY_BLOCK_SIZE  (16 * 1024)
+#define BODY_DIRECT_SIZE (1 << 30)
 
 const char *methodNames[] = {
     [GET]     = "GET",
@@ -23,138 +38,394 @@ const char *contentTypeValue[] = {
     [TEXT_PLAIN] = "text/plain",
     [TEXT_HTML]  = "text/html",
     [FORM]       = "application/x-www-form-urlencoded",
-    [JSON]       = "application/json"};
+    [JSON]       = "application/json",
+    [MULTIPART]  = "multipart/form-data"};
+
+const char *errorDescriptions[] = {
+    [HTTP_OK]         = "Success",
+    [ERR_MEMORY]      = "Out of memory",
+    [ERR_INVALID]     = "Invalid request",
+    [ERR_RESOLVE]     = "Could not resolve host",
+    [ERR_CONNECT]     = "Could not connect to host",
+    [ERR_TLS]         = "TLS error",
+    [ERR_SEND]        = "Could not send request",
+    [ERR_RECIVE]      = "Could not recive response",
+    [ERR_CLOSED]      = "Connection closed by the server",
+    [ERR_PARSE]       = "Malformed response",
+    [ERR_FILE]        = "Could not read or write file",
+    [ERR_ABORTED]     = "Transfer aborted by callback",
+    [ERR_CERTIFICATE] = "Server certificate rejected"};
 
-void parseHeaders(httpResponse *res, char *headers);
-void reciveBody(socketStruct *socketInfo, httpResponse *res);
+char *headerValue(char *headerLine);
+httpError addGeneratedHeader(httpRequest *req, char *fmt, ...);
+httpError prependHeader(httpHeader **headers, char *fmt, va_list args);
+httpError reciveBlock(socketStruct *socketInfo, httpResponse *res, byteBuffer *content, int size);
+httpError feedFromSocket(socketStruct *socketInfo, httpParser *parser);
+httpError reciveToSink(socketStruct *socketInfo, httpResponse *res, int size);
+httpError spliceToSink(socketStruct *socketInfo, httpResponse *res, int size);
+httpError measureParts(httpRequest *req);
+httpError awaitContinue(socketStruct *socketInfo, int *proceed);
+int partHeader(char *buffer, int size, httpPart *part, char *boundary);
+char *escapeDisposition(char *value);
+httpError sendParts(socketStruct *socketInfo, httpRequest *req);
+httpError appendBlock(socketStruct *socketInfo, char *block, int *used, char *data, int length);
 
-/* generate Content-Type, Content-Length and Connection-Close headers */
-void generateHeaders(httpRequest *req)
+/* generate Content-Type and Content-Length headers */
+httpError generateHeaders(httpRequest *req)
 {
     httpForm *formEntry;
     httpHeader *header;
+    httpError error;
+
+    freeHeaders(req->generatedHeaders);
+    req->generatedHeaders = NULL;
+    req->contentLength    = 0;
 
     // Content-Type
     if (req->type == TEXT_PLAIN || req->type == JSON)
     {
         req->contentLength = strlen(req->text);
-
-        header             = malloc(sizeof(httpHeader));
-        header->lineLength = snprintf(NULL, 0, "Content-Type: %s", contentTypeValue[req->type]);
-        header->line       = malloc(header->lineLength + 1);
-        snprintf(header->line, header->lineLength + 1, "Content-Type: %s", contentTypeValue[req->type]);
-
-        header->next = req->headers;
-        req->headers = header;
     }
     else if (req->type == FORM)
     {
         for (formEntry = req->form; formEntry != NULL; formEntry = formEntry->next)
         {
             // we need to account the & separator between multiple key:value
-            req->contentLength += formEntry->entryLength + (formEntry->next != NULL ? 1 : 0);
+            req->contentLength += (formEntry->encoded ? formEntry->entryLength
+                                                      : urlEncodedLength(formEntry->entry, formEntry->entryLength)) +
+                                  (formEntry->next != NULL ? 1 : 0);
         }
+    }
+    else if (req->type == MULTIPART)
+    {
+        error = measureParts(req);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
 
-        header             = malloc(sizeof(httpHeader));
-        header->lineLength = snprintf(NULL, 0, "Content-Type: %s", contentTypeValue[req->type]);
-        header->line       = malloc(header->lineLength + 1);
-        snprintf(header->line, header->lineLength + 1, "Content-Type: %s", contentTypeValue[req->type]);
+    if (req->type == MULTIPART)
+    {
+        error = addGeneratedHeader(req, "Content-Type: %s; boundary=%s", contentTypeValue[req->type], req->boundary);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+    else if (req->type != NONE)
+    {
+        error = addGeneratedHeader(req, "Content-Type: %s", contentTypeValue[req->type]);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
 
-        header->next = req->headers;
-        req->headers = header;
+    // Expect, unless the user chose it
+    req->expectContinue = 0;
+    for (header = req->headers; header != NULL; header = header->next)
+    {
+        if (!strncasecmp(header->line, "Expect:", 7))
+        {
+            req->expectContinue = strcasestr(header->line, "100-continue") != NULL;
+            break;
+        }
+    }
+    if (header == NULL && req->contentLength >= EXPECT_CONTINUE_SIZE &&
+        (req->method == POST || req->method == PUT || req->method == DELETE))
+    {
+        error = addGeneratedHeader(req, "Expect: 100-continue");
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+        req->expectContinue = 1;
     }
 
     // Content-Length
-    header             = malloc(sizeof(httpHeader));
-    header->lineLength = snprintf(NULL, 0, "Content-Length: %d", req->contentLength);
-    header->line       = malloc(header->lineLength + 1);
-    snprintf(header->line, header->lineLength + 1, "Content-Length: %d", req->contentLength);
+    return addGeneratedHeader(req, "Content-Length: %lld", req->contentLength);
+}
+
+httpError addHeader(httpRequest *req, char *fmt, ...)
+{
+    httpError error;
+    va_list args;
+
+    va_start(args, fmt);
+    error = prependHeader(&req->headers, fmt, args);
+    va_end(args);
 
-    header->next = req->headers;
-    req->headers = header;
+    return error;
 }
 
-void buildRequest(httpRequest *req)
+httpError addGeneratedHeader(httpRequest *req, char *fmt, ...)
 {
-    httpHeader *header = NULL;
+    httpError error;
+    va_list args;
+
+    va_start(args, fmt);
+    error = prependHeader(&req->generatedHeaders, fmt, args);
+    va_end(args);
+
+    return error;
+}
+
+httpError buildRequest(httpRequest *req)
+{
+    httpHeader *header = NULL, *headerLists[2];
     httpForm *formEntry;
-    int bufferSize = 0, cursor = 0;
+    int i;
+    byteBuffer payload;
+    httpError error;
+
+    free(req->payload);
+    req->payload     = NULL;
+    req->payloadSize = 0;
+    initBuffer(&payload);
 
     // REQUEST LINE AND HOST HEADER
-    req->payloadSize = snprintf(NULL, 0,
-                                "%s %s HTTP/1.1" CRLF
-                                "Host: %s" CRLF,
-                                methodNames[req->method], req->path,
-                                req->host);
-
-    req->payload = increaseBuffer(req->payload, &bufferSize, req->payloadSize);
-    snprintf(req->payload + cursor, bufferSize,
-             "%s %s HTTP/1.1" CRLF
-             "Host: %s" CRLF,
-             methodNames[req->method], req->path,
-             req->host);
-    cursor = req->payloadSize;
+    error = appendFormat(&payload,
+                         "%s %s HTTP/1.1" CRLF
+                         "Host: %s" CRLF,
+                         methodNames[req->method], req->path,
+                         req->host);
 
     // HEADERS
-    for (header = req->headers; header != NULL; header = header->next)
+    headerLists[0] = req->generatedHeaders;
+    headerLists[1] = req->headers;
+    for (i = 0; i < 2 && error == HTTP_OK; ++i)
     {
-        // + 2 to accomodate also the CRLF
-        req->payloadSize += header->lineLength + 2;
-
-        // + 2 to accomodate also the final blank line and CRLF
-        req->payload = increaseBuffer(req->payload, &bufferSize, req->payloadSize + 2);
-
-        snprintf(req->payload + cursor, bufferSize, "%s" CRLF, header->line);
-        cursor = req->payloadSize;
+        for (header = headerLists[i]; header != NULL && error == HTTP_OK; header = header->next)
+        {
+            error = appendBuffer(&payload, header->line, header->lineLength);
+            if (error == HTTP_OK)
+            {
+                error = appendBuffer(&payload, CRLF, 2);
+            }
+        }
     }
-    req->payloadSize += 2;
-    strcat(req->payload, CRLF);
-    cursor = req->payloadSize;
+    if (error == HTTP_OK)
+    {
+        error = appendBuffer(&payload, CRLF, 2);
+    }
+    req->headersSize = bufferLength(&payload);
 
     logDebug("HTTP payload headers done");
 
-    // BODY
-    if (req->method == POST || req->method == PUT || req->method == DELETE)
+    // BODY, multipart bodies are streamed by sendRequest
+    if (error == HTTP_OK && (req->method == POST || req->method == PUT || req->method == DELETE) &&
+        req->type != MULTIPART)
     {
-        req->payloadSize += req->contentLength;
-        req->payload = increaseBuffer(req->payload, &bufferSize, req->payloadSize);
+        // a single allocation for the whole body, the form is encoded straight into it
+        error = reserveBuffer(&payload, req->contentLength);
 
-        if (req->type == TEXT_PLAIN || req->type == JSON)
+        if (error == HTTP_OK && (req->type == TEXT_PLAIN || req->type == JSON))
         {
-            snprintf(req->payload + cursor, bufferSize, "%s", req->text);
+            error = appendBuffer(&payload, req->text, req->contentLength);
         }
-        else if (req->type == FORM)
+        else if (error == HTTP_OK && req->type == FORM)
         {
-
             for (formEntry = req->form; formEntry != NULL; formEntry = formEntry->next)
             {
-                snprintf(req->payload + cursor, bufferSize,
-                         "%s%c",
-                         formEntry->entry,
-                         formEntry->next != NULL ? '&' : '\0');
+                if (formEntry->encoded)
+                {
+                    appendBuffer(&payload, formEntry->entry, formEntry->entryLength);
+                }
+                else
+                {
+                    commitBuffer(&payload, urlEncodeInto(bufferSpace(&payload), formEntry->entry, formEntry->entryLength));
+                }
 
-                cursor += formEntry->entryLength + 1;
+                if (formEntry->next != NULL)
+                {
+                    appendBuffer(&payload, "&", 1);
+                }
             }
         }
 
         logDebug("HTTP payload body done");
     }
+
+    if (error != HTTP_OK)
+    {
+        freeBuffer(&payload);
+
+        return error;
+    }
+
+    req->payloadSize = bufferLength(&payload);
+    req->payload     = detachBuffer(&payload);
+
+    return HTTP_OK;
 }
 
-void reciveResponse(socketStruct *socketInfo, httpResponse *res)
+httpError addPart(httpRequest *req, char *name, char *value, char *path)
 {
-    char *responseHeaders;
+    httpPart *newPart, **last;
 
-    logInfo("Reciving and parsing response headers..");
-    responseHeaders = readHeaders(socketInfo);
+    if (name == NULL || (value == NULL) == (path == NULL) || (req->type != NONE && req->type != MULTIPART))
+    {
+        return ERR_INVALID;
+    }
+
+    newPart = calloc(1, sizeof(httpPart));
+    if (newPart == NULL)
+    {
+        return ERR_MEMORY;
+    }
+
+    newPart->name = escapeDisposition(name);
+    if (value != NULL)
+    {
+        newPart->value = strdup(value);
+        newPart->size  = strlen(value);
+    }
+    else
+    {
+        newPart->path     = strdup(path);
+        newPart->filename = escapeDisposition(strrchr(path, '/') != NULL ? strrchr(path, '/') + 1 : path);
+    }
 
-    logFile(DEBUG, res->filename, res->filenameLength, "res.txt", 7, "%s", responseHeaders);
-    parseHeaders(res, responseHeaders);
-    free(responseHeaders);
+    if (newPart->name == NULL || (newPart->value == NULL && (newPart->path == NULL || newPart->filename == NULL)))
+    {
+        freeParts(newPart);
+
+        return ERR_MEMORY;
+    }
+
+    // the server sees the parts in the order they were added
+    for (last = &req->parts; *last != NULL; last = &(*last)->next)
+    {
+    }
+    *last     = newPart;
+    req->type = MULTIPART;
+
+    return HTTP_OK;
+}
+
+httpError sendRequest(socketStruct *socketInfo, httpRequest *req)
+{
+    int proceed;
+    httpError error;
+
+    req->bodyWithheld = 0;
+    if (!req->expectContinue || req->prebuilt)
+    {
+        error = sendMessage(socketInfo, req->payload, req->payloadSize);
+    }
+    else
+    {
+        error = sendMessage(socketInfo, req->payload, req->headersSize);
+        if (error == HTTP_OK)
+        {
+            error = awaitContinue(socketInfo, &proceed);
+        }
+        if (error == HTTP_OK && !proceed)
+        {
+            logInfo("The server answered before the body was sent, not sending it");
+            req->bodyWithheld = 1;
+
+            return HTTP_OK;
+        }
+        if (error == HTTP_OK)
+        {
+            error = sendMessage(socketInfo, req->payload + req->headersSize, req->payloadSize - req->headersSize);
+        }
+    }
+
+    if (error == HTTP_OK && req->type == MULTIPART && !req->prebuilt &&
+        (req->method == POST || req->method == PUT || req->method == DELETE))
+    {
+        error = sendParts(socketInfo, req);
+    }
+
+    return error;
+}
+
+httpError reciveResponse(socketStruct *socketInfo, httpResponse *res)
+{
+    httpError error;
+
+    error = reciveHeaders(socketInfo, res);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
 
     logInfo("Done! Now reciving response body..");
 
-    reciveBody(socketInfo, res);
+    return reciveBody(socketInfo, res);
+}
+
+httpError reciveHeaders(socketStruct *socketInfo, httpResponse *res)
+{
+    httpError error;
+
+    logInfo("Reciving and parsing response headers..");
+
+    destroyParser(res->parser);
+    res->parser = createParser(res);
+    if (res->parser == NULL)
+    {
+        return ERR_MEMORY;
+    }
+
+    error = HTTP_OK;
+    while (error == HTTP_OK && res->parser->state == PARSER_HEADERS)
+    {
+        error = feedFromSocket(socketInfo, res->parser);
+    }
+
+    return error;
+}
+
+httpError reciveBody(socketStruct *socketInfo, httpResponse *res)
+{
+    int consumed;
+    long long expected;
+    httpError error;
+
+    if (res->parser == NULL)
+    {
+        logError("Response headers not recived yet!");
+
+        return ERR_INVALID;
+    }
+
+    // picks the framing from the headers, done at once if there is no body
+    error = feedParser(res->parser, NULL, 0, &consumed);
+
+    while (error == HTTP_OK && !parserDone(res->parser))
+    {
+        expected = parserBodyExpected(res->parser);
+
+        // big blocks go straight from the socket to their destination, the
+        // framing and the bytes already read ahead go through the parser
+        if (expected >= READ_AHEAD_SIZE && bufferLength(&socketInfo->readAhead) == 0 && !res->streaming)
+        {
+            expected = expected < BODY_DIRECT_SIZE ? expected : BODY_DIRECT_SIZE;
+            error    = reciveBlock(socketInfo, res, &res->parser->content, expected);
+            if (error == HTTP_OK)
+            {
+                advanceParser(res->parser, expected);
+            }
+        }
+        else
+        {
+            error = feedFromSocket(socketInfo, res->parser);
+        }
+
+        if (error == ERR_CLOSED)
+        {
+            error = closeParser(res->parser);
+        }
+    }
+
+    destroyParser(res->parser);
+    res->parser = NULL;
+
+    return error;
 }
 
 char *statusCodeDescription(int code)
@@ -252,9 +523,49 @@ char *statusCodeDescription(int code)
     }
 }
 
-void freeHttp(httpRequest *req, httpResponse *res)
+char *errorDescription(httpError error)
+{
+    if (error < 0 || error >= HTTP_ERROR_MAX)
+    {
+        return "Unknown error";
+    }
+
+    return (char *)errorDescriptions[error];
+}
+
+void freeHeaders(httpHeader *headers)
 {
     httpHeader *header;
+
+    while (headers != NULL)
+    {
+        header  = headers;
+        headers = headers->next;
+
+        free(header->line);
+        free(header);
+    }
+}
+
+void freeParts(httpPart *parts)
+{
+    httpPart *part;
+
+    while (parts != NULL)
+    {
+        part  = parts;
+        parts = parts->next;
+
+        free(part->name);
+        free(part->path);
+        free(part->filename);
+        free(part->value);
+        free(part);
+    }
+}
+
+void freeHttp(httpRequest *req, httpResponse *res)
+{
     httpForm *formEntry;
 
     logDebug("Freeing allocated memory");
@@ -263,16 +574,22 @@ void freeHttp(httpRequest *req, httpResponse *res)
     free(req->host);
     free(req->path);
     free(req->text);
-    free(req->payload);
-
-    while (req->headers != NULL)
+    if (!req->borrowed)
     {
-        header       = req->headers;
-        req->headers = req->headers->next;
-
-        free(header->line);
-        free(header);
+        free(req->payload);
     }
+    free(req->outputPath);
+    free(req->expectedChecksum);
+    free(req->summaryPath);
+    free(req->urlList);
+    free(req->templateData);
+    free(req->ranges);
+    free(req->caFile);
+    free(req->caPath);
+    free(req->unixSocket);
+
+    freeHeaders(req->headers);
+    freeHeaders(req->generatedHeaders);
 
     while (req->form != NULL)
     {
@@ -282,6 +599,7 @@ void freeHttp(httpRequest *req, httpResponse *res)
         free(formEntry->entry);
         free(formEntry);
     }
+    freeParts(req->parts);
 
     free(req);
 
@@ -290,34 +608,63 @@ void freeHttp(httpRequest *req, httpResponse *res)
     // RESPONSE
     free(res->content);
     free(res->filename);
+    free(res->etag);
+    free(res->lastModified);
+    EVP_MD_CTX_free(res->digest);
+    destroyParser(res->parser);
     free(res);
 
     logDebug("Response struct freed");
 }
 
-// ==================== LOCAL FUNCTIONS ====================
-
-void parseHeaders(httpResponse *res, char *headers)
+httpError parseHeaders(httpResponse *res, char *headers)
 {
-    int i;
-    char *headerLine;
+    int i, http11, framed, closeConnection;
+    char *headerLine, *savePointer;
+    byteRange range;
 
     // STATUS-LINE
-    headerLine = strtok(headers, "\r\n");
+    headerLine = strtok_r(headers, "\r\n", &savePointer);
+    if (headerLine == NULL || strncmp(headerLine, "HTTP/", 5) != 0)
+    {
+        logError("Invalid status line!");
 
-    while (*headerLine != ' ')
+        return ERR_PARSE;
+    }
+
+    if (res->onHeader != NULL &&
+        res->onHeader(res->headerData, headerLine, strlen(headerLine)) != 0)
+    {
+        return ERR_ABORTED;
+    }
+    http11 = strncmp(headerLine, "HTTP/1.0", 8) != 0;
+
+    headerLine = strchr(headerLine, ' ');
+    if (headerLine == NULL || strlen(headerLine) < 4)
     {
-        ++headerLine;
+        logError("Invalid status line!");
+
+        return ERR_PARSE;
     }
     ++headerLine;
     // now headerLine points to the first digit of the status code
     headerLine[3] = '\0';
     res->status   = strtol(headerLine, NULL, 10);
 
+    framed          = res->status < 200 || res->status == 204 || res->status == 304;
+    closeConnection = 0;
+    res->rangeStart = res->rangeEnd = res->rangeTotal = -1;
+
     // HEADERS
-    headerLine = strtok(NULL, "\r\n");
+    headerLine = strtok_r(NULL, "\r\n", &savePointer);
     while (headerLine != NULL)
     {
+        if (res->onHeader != NULL &&
+            res->onHeader(res->headerData, headerLine, strlen(headerLine)) != 0)
+        {
+            return ERR_ABORTED;
+        }
+
         if (strncasecmp(headerLine, "Content-Type", 12) == 0)
         {
             // headerLine = stripString(headerLine + 13);
@@ -331,73 +678,540 @@ void parseHeaders(httpResponse *res, char *headers)
         }
         else if (strncasecmp(headerLine, "Content-Length", 14) == 0)
         {
-            res->contentLength = atoi(headerLine + 15);
+            res->contentLength = strtoll(headerLine + 15, NULL, 10);
+            framed             = 1;
+        }
+        // only the body of a 206 is a range, a 416 tells the size with bytes */TOTAL
+        else if (strncasecmp(headerLine, "Content-Range", 13) == 0 && res->status == 206)
+        {
+            if (parseContentRange(headerValue(headerLine), &range, &res->rangeTotal) != HTTP_OK)
+            {
+                logError("Invalid Content-Range '%s'!", headerValue(headerLine));
+
+                return ERR_PARSE;
+            }
+            res->rangeStart = range.first;
+            res->rangeEnd   = range.last;
+        }
+        else if (strncasecmp(headerLine, "ETag", 4) == 0)
+        {
+            free(res->etag);
+            res->etag = strdup(headerValue(headerLine));
+        }
+        else if (strncasecmp(headerLine, "Last-Modified", 13) == 0)
+        {
+            free(res->lastModified);
+            res->lastModified = strdup(headerValue(headerLine));
+        }
+        else if (strncasecmp(headerLine, "Connection", 10) == 0 &&
+                 strstr(lowerString(headerLine), "close"))
+        {
+            closeConnection = 1;
         }
         else if (strncasecmp(headerLine, "Transfer-Encoding", 17) == 0 &&
                  strstr(lowerString(headerLine), "chunked"))
         {
             res->contentLength = -1;
+            framed             = 1;
+        }
+
+        headerLine = strtok_r(NULL, "\r\n", &savePointer);
+    }
+
+    // without framing the body ends when the server closes the connection
+    res->keepAlive = http11 && framed && !closeConnection;
+    if (!framed)
+    {
+        res->contentLength = BODY_UNTIL_CLOSE;
+    }
+
+    if (res->rangeStart != -1 && res->contentLength >= 0 && res->contentLength != res->rangeEnd - res->rangeStart + 1)
+    {
+        logError("Content-Length %lld does not match the range %lld-%lld!", res->contentLength, res->rangeStart, res->rangeEnd);
+
+        return ERR_PARSE;
+    }
+
+    // an empty line tells the callback that all the headers were parsed
+    if (res->onHeader != NULL && res->onHeader(res->headerData, "", 0) != 0)
+    {
+        return ERR_ABORTED;
+    }
+
+    return HTTP_OK;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// returns the value of a header line, skipping the name and leading spaces
+char *headerValue(char *headerLine)
+{
+    char *value;
+
+    value = strchr(headerLine, ':');
+    if (value == NULL)
+    {
+        return headerLine + strlen(headerLine);
+    }
+
+    ++value;
+    while (*value == ' ' || *value == '\t')
+    {
+        ++value;
+    }
+
+    return value;
+}
+
+httpError prependHeader(httpHeader **headers, char *fmt, va_list args)
+{
+    httpHeader *header;
+    va_list argsCopy;
+
+    header = malloc(sizeof(httpHeader));
+    if (header == NULL)
+    {
+        logError("Could not allocate new header!");
+
+        return ERR_MEMORY;
+    }
+
+    va_copy(argsCopy, args);
+    header->lineLength = vsnprintf(NULL, 0, fmt, argsCopy);
+    va_end(argsCopy);
+
+    header->line = malloc(header->lineLength + 1);
+    if (header->line == NULL)
+    {
+        logError("Could not allocate new header!");
+        free(header);
+
+        return ERR_MEMORY;
+    }
+
+    vsnprintf(header->line, header->lineLength + 1, fmt, args);
+
+    header->next = *headers;
+    *headers     = header;
+
+    return HTTP_OK;
+}
+
+// wait for the server to accept the body, proceed is set to 0 if its final response came instead
+httpError awaitContinue(socketStruct *socketInfo, int *proceed)
+{
+    int timeout;
+    char *status, *lineEnd;
+    httpError error;
+
+    *proceed = 1;
+
+    // the status line tells, the response stays read ahead for reciveHeaders
+    error   = HTTP_OK;
+    lineEnd = NULL;
+    timeout = EXPECT_CONTINUE_TIMEOUT;
+    while (error == HTTP_OK && lineEnd == NULL && timeout > 0)
+    {
+        if (bufferLength(&socketInfo->readAhead) > 0)
+        {
+            lineEnd = memchr(bufferData(&socketInfo->readAhead), '\n', bufferLength(&socketInfo->readAhead));
+        }
+        if (lineEnd == NULL)
+        {
+            error = readAvailableWithin(socketInfo, &timeout);
+        }
+    }
+    if (error != HTTP_OK)
+    {
+        logError("Error while waiting for 100 Continue!");
+
+        return error;
+    }
+
+    // a server that ignores Expect waits for the body
+    if (lineEnd == NULL)
+    {
+        logVerbose("No answer in %d ms, sending the body anyway", EXPECT_CONTINUE_TIMEOUT);
+
+        return HTTP_OK;
+    }
+
+    // 100 Continue or another interim response, the final one comes after the body
+    status   = memchr(bufferData(&socketInfo->readAhead), ' ', lineEnd - bufferData(&socketInfo->readAhead));
+    *proceed = status != NULL && status[1] == '1';
+    logVerbose("%.*s", (int)(lineEnd - bufferData(&socketInfo->readAhead)), bufferData(&socketInfo->readAhead));
+
+    return HTTP_OK;
+}
+
+// recive size bytes of body, appended to content when there is no sink or body callback
+httpError reciveBlock(socketStruct *socketInfo, httpResponse *res, byteBuffer *content, int size)
+{
+    int step;
+    char *buffer;
+    httpError error;
+
+    // a plain body nobody needs to look at can stay in the kernel
+    if (res->sink != NULL && res->sink->spliceable && res->digest == NULL && socketInfo->transport->spliceable)
+    {
+        return spliceToSink(socketInfo, res, size);
+    }
+
+    if (res->sink != NULL)
+    {
+        return reciveToSink(socketInfo, res, size);
+    }
+
+    if (res->onBody != NULL)
+    {
+        buffer = malloc(size < BODY_BLOCK_SIZE ? size : BODY_BLOCK_SIZE);
+        if (buffer == NULL)
+        {
+            return ERR_MEMORY;
         }
+        countStat(allocations, 1);
 
-        headerLine = strtok(NULL, "\r\n");
+        error = HTTP_OK;
+        while (size > 0 && error == HTTP_OK)
+        {
+            step  = size < BODY_BLOCK_SIZE ? size : BODY_BLOCK_SIZE;
+            error = readInto(socketInfo, buffer, step);
+            if (error == HTTP_OK && res->digest != NULL)
+            {
+                EVP_DigestUpdate(res->digest, buffer, step);
+            }
+
+            if (error == HTTP_OK && res->onBody(res->bodyData, buffer, step) != 0)
+            {
+                error = ERR_ABORTED;
+            }
+
+            size -= step;
+        }
+
+        free(buffer);
+
+        return error;
     }
+
+    // the body grows geometrically, a chunked body does not move at every chunk
+    error = reserveBuffer(content, size);
+    if (error != HTTP_OK)
+    {
+        logError("Could not allocate %d bytes for the response body!", bufferLength(content) + size);
+
+        return error;
+    }
+
+    error = readInto(socketInfo, bufferSpace(content), size);
+    if (error == HTTP_OK && res->digest != NULL)
+    {
+        EVP_DigestUpdate(res->digest, bufferSpace(content), size);
+    }
+    if (error == HTTP_OK)
+    {
+        commitBuffer(content, size);
+    }
+
+    return error;
 }
 
-void reciveBody(socketStruct *socketInfo, httpResponse *res)
+// hand the bytes read ahead to the parser, reading more if there are none
+httpError feedFromSocket(socketStruct *socketInfo, httpParser *parser)
 {
-    int chunkSize;
+    int consumed;
+    httpError error;
+
+    if (bufferLength(&socketInfo->readAhead) == 0)
+    {
+        error = readAvailable(socketInfo);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    error = feedParser(parser, bufferData(&socketInfo->readAhead), bufferLength(&socketInfo->readAhead), &consumed);
+    consumeBuffer(&socketInfo->readAhead, consumed);
+
+    return error;
+}
+
+httpError reciveToSink(socketStruct *socketInfo, httpResponse *res, int size)
+{
+    int bufferSize, step;
     char *buffer;
+    httpError error;
+
+    // the socket reads into the sink buffers, so the disk write of a block
+    // overlaps with the read of the next one
+    while (size > 0)
+    {
+        buffer = sinkBuffer(res->sink, &bufferSize);
+        if (buffer == NULL)
+        {
+            return ERR_FILE;
+        }
+
+        step  = size < bufferSize ? size : bufferSize;
+        error = readInto(socketInfo, buffer, step);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
 
-    if (res->contentLength > 0)
+        // hashed while still in cache, the file is never read back
+        if (res->digest != NULL)
+        {
+            EVP_DigestUpdate(res->digest, buffer, step);
+        }
+
+        if (sinkCommit(res->sink, buffer, step) == -1)
+        {
+            return ERR_FILE;
+        }
+
+        size -= step;
+    }
+
+    return HTTP_OK;
+}
+
+httpError spliceToSink(socketStruct *socketInfo, httpResponse *res, int size)
+{
+    int step, moved, spliced;
+
+    for (spliced = 0; spliced < size; spliced += moved)
+    {
+        step  = throttle(socketInfo->limiter, size - spliced);
+        moved = sinkSplice(res->sink, socketInfo->descriptor, step);
+        if (moved == -1)
+        {
+            traceProbe(read_done, socketInfo->host, spliced, ERR_FILE);
+
+            return ERR_FILE;
+        }
+        else if (moved == 0)
+        {
+            logError("Connection closed while reading message of %.2f KB!", (size - spliced) / 1024.0);
+            traceProbe(read_done, socketInfo->host, spliced, ERR_CLOSED);
+
+            return ERR_CLOSED;
+        }
+    }
+    traceProbe(read_done, socketInfo->host, size, HTTP_OK);
+
+    return HTTP_OK;
+}
+
+// pick a new boundary and add up part headers, contents and closing boundary
+httpError measureParts(httpRequest *req)
+{
+    int i;
+    unsigned char random[MULTIPART_BOUNDARY_LENGTH / 2];
+    struct stat fileInfo;
+    httpPart *part;
+
+    if (RAND_bytes(random, sizeof(random)) != 1)
+    {
+        logError("Could not generate multipart boundary!");
+
+        return ERR_MEMORY;
+    }
+    for (i = 0; i < sizeof(random); ++i)
+    {
+        sprintf(req->boundary + i * 2, "%02x", random[i]);
+    }
+
+    for (part = req->parts; part != NULL; part = part->next)
+    {
+        if (part->path != NULL)
+        {
+            if (stat(part->path, &fileInfo) == -1 || !S_ISREG(fileInfo.st_mode))
+            {
+                logError("Could not read '%s' to upload it!", part->path);
+
+                return ERR_FILE;
+            }
+            part->size = fileInfo.st_size;
+        }
+
+        // + 2 for the CRLF closing the part content
+        req->contentLength += partHeader(NULL, 0, part, req->boundary) + part->size + 2;
+    }
+
+    // -- boundary -- CRLF
+    req->contentLength += 2 + MULTIPART_BOUNDARY_LENGTH + 2 + 2;
+
+    return HTTP_OK;
+}
+
+int partHeader(char *buffer, int size, httpPart *part, char *boundary)
+{
+    if (part->path == NULL)
+    {
+        return snprintf(buffer, size,
+                        "--%s" CRLF
+                        "Content-Disposition: form-data; name=\"%s\"" CRLF CRLF,
+                        boundary, part->name);
+    }
+
+    return snprintf(buffer, size,
+                    "--%s" CRLF
+                    "Content-Disposition: form-data; name=\"%s\"; filename=\"%s\"" CRLF
+                    "Content-Type: application/octet-stream" CRLF CRLF,
+                    boundary, part->name, part->filename);
+}
+
+// copy of value to quote in a Content-Disposition, with '"', CR and LF percent encoded as the HTML forms do
+char *escapeDisposition(char *value)
+{
+    byteBuffer escaped;
+    httpError error;
+
+    // reserved even for an empty value, detachBuffer returns NULL without memory
+    initBuffer(&escaped);
+    for (error = reserveBuffer(&escaped, strlen(value)); *value != '\0' && error == HTTP_OK; ++value)
     {
-        logVerbose("Reciving entire body: size %d", res->contentLength);
-        res->content = readSize(socketInfo, res->contentLength);
+        if (*value == '"' || *value == '\r' || *value == '\n')
+        {
+            error = appendFormat(&escaped, "%%%02X", (unsigned char)*value);
+        }
+        else
+        {
+            error = appendBuffer(&escaped, value, 1);
+        }
     }
-    // contentLength -1 means chunked
-    else if (res->contentLength == -1)
+
+    if (error != HTTP_OK)
     {
-        /* CHUNK STRUCTURE
-        Chunked-Body   = *chunk
-                         last-chunk
-                         trailer
-                         CRLF
+        freeBuffer(&escaped);
 
-        chunk          = chunk-size [ chunk-extension ] CRLF
-                         chunk-data CRLF
-        chunk-size     = 1*HEX
-        last-chunk     = 1*("0") [ chunk-extension ] CRLF
+        return NULL;
+    }
 
-        chunk-extension= *( ";" chunk-ext-name [ "=" chunk-ext-val ] )
-        chunk-ext-name = token
-        chunk-ext-val  = token | quoted-string
-        chunk-data     = chunk-size(OCTET)
-        trailer        = *(entity-header CRLF)
-        */
+    return detachBuffer(&escaped);
+}
+
+// files are read in blocks so memory does not grow with their size
+httpError sendParts(socketStruct *socketInfo, httpRequest *req)
+{
+    int used, headerLength, fileDescriptor, lastRead;
+    long long remaining;
+    char *block, *header, closing[2 + MULTIPART_BOUNDARY_LENGTH + 2 + 2 + 1];
+    httpPart *part;
+    httpError error;
 
-        logVerbose("Reciving chiunked body");
-        res->contentLength = 0;
+    block = malloc(BODY_BLOCK_SIZE);
+    if (block == NULL)
+    {
+        return ERR_MEMORY;
+    }
 
-        while (1)
+    used  = 0;
+    error = HTTP_OK;
+    for (part = req->parts; part != NULL && error == HTTP_OK; part = part->next)
+    {
+        headerLength = partHeader(NULL, 0, part, req->boundary);
+        header       = malloc(headerLength + 1);
+        if (header == NULL)
         {
-            // read chunk size
-            buffer    = readLine(socketInfo);
-            chunkSize = strtol(buffer, NULL, 16);
-            free(buffer);
+            error = ERR_MEMORY;
 
-            if (chunkSize == 0)
+            break;
+        }
+        partHeader(header, headerLength + 1, part, req->boundary);
+
+        error = appendBlock(socketInfo, block, &used, header, headerLength);
+        free(header);
+
+        if (part->path == NULL)
+        {
+            if (error == HTTP_OK)
             {
-                break;
+                error = appendBlock(socketInfo, block, &used, part->value, part->size);
+            }
+        }
+        else if (error == HTTP_OK)
+        {
+            fileDescriptor = open(part->path, O_RDONLY);
+            if (fileDescriptor == -1)
+            {
+                logError("Could not open '%s' to upload it!", part->path);
+                error = ERR_FILE;
             }
 
-            logDebug("Chunk size %d", chunkSize);
+            remaining = part->size;
+            while (error == HTTP_OK && remaining > 0)
+            {
+                if (used == BODY_BLOCK_SIZE)
+                {
+                    error = sendMessage(socketInfo, block, used);
+                    used  = 0;
 
-            buffer = readSize(socketInfo, chunkSize);
+                    continue;
+                }
 
-            res->content = realloc(res->content, res->contentLength + chunkSize);
-            memcpy(res->content + res->contentLength, buffer, chunkSize);
-            res->contentLength += chunkSize;
+                lastRead = read(fileDescriptor, block + used,
+                                remaining < BODY_BLOCK_SIZE - used ? remaining : BODY_BLOCK_SIZE - used);
+                if (lastRead <= 0)
+                {
+                    // Content-Length was already sent, a file that shrank cannot be sent anymore
+                    logError("Could not read '%s' while uploading it!", part->path);
+                    error = ERR_FILE;
 
-            free(buffer);
+                    break;
+                }
+
+                used += lastRead;
+                remaining -= lastRead;
+            }
+
+            if (fileDescriptor != -1)
+            {
+                close(fileDescriptor);
+            }
         }
+
+        if (error == HTTP_OK)
+        {
+            error = appendBlock(socketInfo, block, &used, CRLF, 2);
+        }
+    }
+
+    if (error == HTTP_OK)
+    {
+        snprintf(closing, sizeof(closing), "--%s--" CRLF, req->boundary);
+        error = appendBlock(socketInfo, block, &used, closing, sizeof(closing) - 1);
     }
+    if (error == HTTP_OK && used > 0)
+    {
+        error = sendMessage(socketInfo, block, used);
+    }
+
+    free(block);
+
+    return error;
+}
+
+// copy data at the end of block, data that does not fit goes out with the block without being copied
+httpError appendBlock(socketStruct *socketInfo, char *block, int *used, char *data, int length)
+{
+    struct iovec parts[2];
+
+    if (*used + length > BODY_BLOCK_SIZE)
+    {
+        parts[0].iov_base = block;
+        parts[0].iov_len  = *used;
+        parts[1].iov_base = data;
+        parts[1].iov_len  = length;
+        *used             = 0;
+
+        return sendVector(socketInfo, parts, 2);
+    }
+
+    memcpy(block + *used, data, length);
+    *used += length;
+
+    return HTTP_OK;
 }
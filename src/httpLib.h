@@ -1,5 +1,8 @@
 #pragma once
 
+#include "checksum.h"
+#include "fileSink.h"
+#include "httpError.h"
 #include "socketUtils.h"
 #include <openssl/ssl.h>
 
@@ -9,6 +12,16 @@
 #define CRLF        "\r\n"
 #define HEADERS_END CRLF CRLF
 
+#define MULTIPART_BOUNDARY_LENGTH 32
+
+/** bodies from this size are sent only once the server agrees with 100 Continue */
+#define EXPECT_CONTINUE_SIZE (1024 * 1024)
+/** milliseconds waited for 100 Continue before sending the body anyway */
+#define EXPECT_CONTINUE_TIMEOUT 1000
+
+/** contentLength of a response without framing, its body ends when the server closes the connection */
+#define BODY_UNTIL_CLOSE -2
+
 // don't forget to update the const array in httpLib.c
 typedef enum httpMethods
 {
@@ -29,9 +42,18 @@ typedef enum contentType
     TEXT_HTML,
     FORM,
     JSON,
+    MULTIPART,
     CONTENT_TYPE_MAX
 } contentType;
 
+/**
+ * Called with the status line, every response header line and finally an
+ * empty line once all the headers are parsed. Returning non zero aborts the transfer
+ */
+typedef int (*headerCallback)(void *userData, char *line, int length);
+/** Called for every block of response body, returning non zero aborts the transfer */
+typedef int (*bodyCallback)(void *userData, char *data, int length);
+
 typedef struct httpHeader
 {
     char *line;
@@ -41,11 +63,28 @@ typedef struct httpHeader
 
 typedef struct httpForm
 {
+    /** key=value, url encoded while the request is built */
     char *entry;
     int entryLength;
+    /** 1 if entry is already url encoded and must be sent as it is */
+    int encoded;
     struct httpForm *next;
 } httpForm;
 
+typedef struct httpPart
+{
+    /** quoted in the Content-Disposition, '"', CR and LF are written as %22, %0D and %0A */
+    char *name;
+    /** file streamed as the content of the part when the request is sent, NULL to send value */
+    char *path;
+    /** last component of path, escaped as name */
+    char *filename;
+    char *value;
+    /** size of the file, measured by generateHeaders, or of value */
+    long long size;
+    struct httpPart *next;
+} httpPart;
+
 typedef struct httpRequest
 {
     // INFO
@@ -59,17 +98,89 @@ typedef struct httpRequest
     char *path;
     int pathLength;
     struct httpHeader *headers;
+    /** Content-Type and Content-Length, rebuilt by every generateHeaders */
+    struct httpHeader *generatedHeaders;
 
     contentType type;
     /** size of the HTTP body */
-    int contentLength;
+    long long contentLength;
     char *text;
     struct httpForm *form;
+    /** parts of a MULTIPART body, in the order they are sent */
+    struct httpPart *parts;
+    char boundary[MULTIPART_BOUNDARY_LENGTH + 1];
 
+    // OUTPUT
+    /** file where the body is saved, NULL for the default file in ./out */
+    char *outputPath;
+    /** 1 to continue a partial download found in outputPath */
+    int resume;
+    /** algorithm the body is hashed with while it arrives */
+    checksumType checksum;
+    /** hex digest the body must match, NULL to skip the check */
+    char *expectedChecksum;
+    /** file the JSON summary of the transfer is written to, NULL for none */
+    char *summaryPath;
+    /** 0 = no stats
+     *  1 = print stats at exit
+     *  2 = print stats at exit as JSON */
+    int stats;
+    /** bytes per second allowed to the transfer, 0 for no limit */
+    long long limitRate;
+    /** share of the global rate compared to the other transfers, 0 counts as 1 */
+    int rateWeight;
+    /** 0 = body saved once complete
+     *  STREAM_EVENTS = text/event-stream events printed as they arrive, see runStream
+     *  STREAM_RAW = body printed as it arrives */
+    int stream;
+    /** byte ranges of the url to fetch into a sparse outputPath, NULL for the whole body, see runRanges */
+    char *ranges;
+
+    // DAEMON
+    /** 1 to run as daemon, -1 to never hand the request to a running daemon */
+    int daemon;
+
+    // BATCH
+    /** file with one url per line to download instead of the single url, NULL for none */
+    char *urlList;
+    /** worker threads sharing the urls of urlList */
+    int threads;
+    /** 1 to transfer every copy of a url of urlList, by default a copy taken while the url is in flight shares its result */
+    int noCoalesce;
+    /** 1 to bind every worker thread to its own CPU */
+    int pinThreads;
+    /** 1 to wait for the disk on every write of the body, see SINK_DURABLE */
+    int durable;
+    /** links followed from the url when mirroring its site, -1 to not mirror */
+    int mirrorDepth;
+    /** CSV or JSON Lines file, one request is sent for each row filling the {{column}} of the request */
+    char *templateData;
+
+    // CONNECTION
+    /** options of the sockets opened for the request */
+    socketProfileName socketProfile;
+    /** certificates trusted instead of the system ones, NULL for none, see setTlsTrust */
+    char *caFile;
+    char *caPath;
+    /** 1 to accept any server certificate */
+    int insecure;
+    /** unix socket to connect to instead of the host of the url, @name for the abstract namespace */
+    char *unixSocket;
+
+    /** 1 if payload was set directly and must not be rebuilt from the fields above */
+    int prebuilt;
+    /** 1 if payload belongs to the caller and is not freed with the request */
+    int borrowed;
     /** complete HTTP payload */
     char *payload;
     /** size of the complete HTTP message */
     int payloadSize;
+    /** bytes of payload up to the end of the headers, set by buildRequest */
+    int headersSize;
+    /** 1 if the request carries Expect: 100-continue, set by generateHeaders */
+    int expectContinue;
+    /** 1 if the server answered before the body was sent, the connection can not be reused */
+    int bodyWithheld;
 
 } httpRequest;
 
@@ -77,8 +188,35 @@ typedef struct httpResponse
 {
     int status;
     contentType type;
-    int contentLength;
+    /** -1 for a chunked body and BODY_UNTIL_CLOSE until the body is recived, its size after */
+    long long contentLength;
     char *content;
+    /** when set the body is streamed here instead of being stored in content */
+    fileSink *sink;
+    /** when set every body byte is also hashed here, as it arrives */
+    EVP_MD_CTX *digest;
+
+    /** validators used to resume the download, NULL if not sent */
+    char *etag;
+    char *lastModified;
+    /** first and last byte of a 206 from its Content-Range, -1 if not sent */
+    long long rangeStart;
+    long long rangeEnd;
+    /** size of the remote file from the Content-Range of a 206, -1 if not told */
+    long long rangeTotal;
+    /** 1 if the connection can be used for another request */
+    int keepAlive;
+
+    /** when set the headers and the body are also passed here as they arrive */
+    headerCallback onHeader;
+    void *headerData;
+    bodyCallback onBody;
+    void *bodyData;
+    /** 1 to pass the body to onBody as soon as it is read, never waiting to fill a bigger block */
+    int streaming;
+
+    /** parses the response between reciveHeaders and reciveBody, NULL otherwise */
+    struct httpParser *parser;
 
     char *filename;
     int filenameLength;
@@ -87,10 +225,40 @@ typedef struct httpResponse
 extern const char *methodNames[];
 extern const char *contentTypeValue[];
 
-void generateHeaders(httpRequest *req);
-void buildRequest(httpRequest *req);
+httpError generateHeaders(httpRequest *req);
+/** Format a new header line and add it to the request */
+httpError addHeader(httpRequest *req, char *fmt, ...);
+/**
+ * Build req->payload from the request fields.
+ * The parts of a MULTIPART body are not part of the payload, sendRequest streams them.
+ */
+httpError buildRequest(httpRequest *req);
+/**
+ * Add a multipart/form-data part at the end of the body. The quotes and line
+ * breaks of name and of the file name are escaped as browsers do.
+ *
+ * @param value content of the part, NULL if path is used
+ * @param path file sent as content of the part, NULL if value is used
+ */
+httpError addPart(httpRequest *req, char *name, char *value, char *path);
+/**
+ * Send req->payload followed by the parts of a MULTIPART body, read in blocks from their files.
+ * With req->expectContinue only the headers are sent until the server answers
+ * 100 Continue or EXPECT_CONTINUE_TIMEOUT passes. When it sends its final
+ * response instead the body is never sent and req->bodyWithheld is set, the
+ * response is left for reciveHeaders.
+ */
+httpError sendRequest(socketStruct *socketInfo, httpRequest *req);
 
-void reciveResponse(socketStruct *socketInfo, httpResponse *res);
+httpError reciveResponse(socketStruct *socketInfo, httpResponse *res);
+httpError reciveHeaders(socketStruct *socketInfo, httpResponse *res);
+/** Parse the status line and headers, headers is modified in place */
+httpError parseHeaders(httpResponse *res, char *headers);
+/** Recive the body to res->sink, res->onBody or res->content, in this order of preference */
+httpError reciveBody(socketStruct *socketInfo, httpResponse *res);
 
 char *statusCodeDescription(int code);
+char *errorDescription(httpError error);
+void freeHeaders(httpHeader *headers);
+void freeParts(httpPart *parts);
 void freeHttp(httpRequest *req, httpResponse *res);
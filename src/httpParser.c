@@ -0,0 +1,364 @@
+#include "httpParser.h"
+#include "fileSink.h"
+#include "logger.h"
+#include "probes.h"
+#include "stats.h"
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+
+httpError startBody(httpParser *parser);
+httpError deliverBody(httpParser *parser, char *data, int length);
+int collectLine(httpParser *parser, char *data, int length, int *complete);
+int isInterim(char *headers);
+void finishBody(httpParser *parser);
+
+httpParser *createParser(httpResponse *res)
+{
+    httpParser *parser;
+
+    parser = malloc(sizeof(httpParser));
+    if (parser == NULL)
+    {
+        return NULL;
+    }
+    countStat(allocations, 1);
+
+    parser->state     = PARSER_HEADERS;
+    parser->res       = res;
+    parser->matched   = 0;
+    parser->remaining = 0;
+    initBuffer(&parser->line);
+    initBuffer(&parser->content);
+
+    return parser;
+}
+
+httpError feedParser(httpParser *parser, char *data, int length, int *consumed)
+{
+    int i, step, complete;
+    char *sizeEnd;
+    httpError error;
+
+    *consumed = 0;
+
+    if (parser->state == PARSER_BODY_START)
+    {
+        error = startBody(parser);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    while (*consumed < length && parser->state != PARSER_DONE)
+    {
+        switch (parser->state)
+        {
+        case PARSER_HEADERS:
+            // HEADERS_END can be split between two slices, the match carries over
+            for (i = *consumed; i < length && parser->matched < 4; ++i)
+            {
+                if (data[i] == HEADERS_END[parser->matched])
+                {
+                    ++parser->matched;
+                }
+                else
+                {
+                    parser->matched = data[i] == '\r' ? 1 : 0;
+                }
+            }
+
+            step  = i - *consumed;
+            error = appendBuffer(&parser->line, data + *consumed, step);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            *consumed += step;
+
+            if (parser->matched < 4)
+            {
+                if (bufferLength(&parser->line) > PARSER_MAX_HEADERS)
+                {
+                    logError("Response headers longer than %d KB!", PARSER_MAX_HEADERS / 1024);
+
+                    return ERR_PARSE;
+                }
+
+                break;
+            }
+
+            // 100 Continue and 103 Early Hints come before the real response
+            if (isInterim(bufferData(&parser->line)))
+            {
+                logVerbose("Interim response '%.*s' skipped", (int)strcspn(bufferData(&parser->line), CRLF),
+                           bufferData(&parser->line));
+                consumeBuffer(&parser->line, bufferLength(&parser->line));
+                parser->matched = 0;
+
+                break;
+            }
+
+            if (parser->res->filename != NULL)
+            {
+                logFile(DEBUG, parser->res->filename, parser->res->filenameLength, "res.txt", 7,
+                        "%s", bufferData(&parser->line));
+            }
+            error = parseHeaders(parser->res, bufferData(&parser->line));
+            if (error == HTTP_OK)
+            {
+                traceProbe(headers_done, parser->res->status, parser->res->contentLength, bufferLength(&parser->line));
+            }
+            consumeBuffer(&parser->line, bufferLength(&parser->line));
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+
+            // the caller decides where the body goes before feeding it
+            parser->state = PARSER_BODY_START;
+
+            return HTTP_OK;
+
+        case PARSER_BODY:
+        case PARSER_CHUNK_DATA:
+            step = length - *consumed;
+            if (step > parser->remaining)
+            {
+                step = parser->remaining;
+            }
+
+            error = deliverBody(parser, data + *consumed, step);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            *consumed += step;
+            advanceParser(parser, step);
+            break;
+
+        case PARSER_BODY_UNTIL_CLOSE:
+            step  = length - *consumed;
+            error = deliverBody(parser, data + *consumed, step);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            *consumed += step;
+            parser->res->contentLength += step;
+            break;
+
+        case PARSER_CHUNK_SIZE:
+        case PARSER_CHUNK_END:
+        case PARSER_TRAILERS:
+            step = collectLine(parser, data + *consumed, length - *consumed, &complete);
+            if (step == -1)
+            {
+                return ERR_MEMORY;
+            }
+            *consumed += step;
+
+            if (!complete)
+            {
+                break;
+            }
+
+            if (parser->state == PARSER_CHUNK_SIZE)
+            {
+                parser->remaining = strtoll(bufferData(&parser->line), &sizeEnd, 16);
+                if (sizeEnd == bufferData(&parser->line) || parser->remaining < 0)
+                {
+                    logError("Invalid chunk size line '%s'", bufferData(&parser->line));
+
+                    return ERR_PARSE;
+                }
+
+                logDebug("Chunk size %lld", parser->remaining);
+                traceProbe(chunk, parser->remaining);
+
+                parser->res->contentLength += parser->remaining;
+                parser->state = parser->remaining == 0 ? PARSER_TRAILERS : PARSER_CHUNK_DATA;
+            }
+            else if (parser->state == PARSER_CHUNK_END)
+            {
+                parser->state = PARSER_CHUNK_SIZE;
+            }
+            // the trailer ends with an empty line, the fields before it are ignored.
+            // Like the chunk size lines it can end with a bare LF
+            else if (strcmp(bufferData(&parser->line), CRLF) == 0 || strcmp(bufferData(&parser->line), "\n") == 0)
+            {
+                finishBody(parser);
+            }
+
+            consumeBuffer(&parser->line, bufferLength(&parser->line));
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+long long parserBodyExpected(httpParser *parser)
+{
+    if (parser->state == PARSER_BODY || parser->state == PARSER_CHUNK_DATA)
+    {
+        return parser->remaining;
+    }
+
+    return 0;
+}
+
+void advanceParser(httpParser *parser, long long length)
+{
+    parser->remaining -= length;
+    if (parser->remaining > 0)
+    {
+        return;
+    }
+
+    if (parser->state == PARSER_CHUNK_DATA)
+    {
+        // CRLF closing the chunk data
+        parser->state = PARSER_CHUNK_END;
+    }
+    else
+    {
+        finishBody(parser);
+    }
+}
+
+httpError closeParser(httpParser *parser)
+{
+    if (parser->state != PARSER_BODY_UNTIL_CLOSE)
+    {
+        return parserDone(parser) ? HTTP_OK : ERR_CLOSED;
+    }
+
+    finishBody(parser);
+
+    return HTTP_OK;
+}
+
+void destroyParser(httpParser *parser)
+{
+    if (parser == NULL)
+    {
+        return;
+    }
+
+    freeBuffer(&parser->line);
+    freeBuffer(&parser->content);
+    free(parser);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// choose the framing from the parsed headers, contentLength -1 means chunked
+httpError startBody(httpParser *parser)
+{
+    if (parser->res->contentLength > 0)
+    {
+        logVerbose("Reciving entire body: size %lld", parser->res->contentLength);
+
+        parser->remaining = parser->res->contentLength;
+        parser->state     = PARSER_BODY;
+
+        // the whole body is stored at once, never moved while growing
+        if (parser->res->sink == NULL && parser->res->onBody == NULL)
+        {
+            if (parser->res->contentLength >= INT_MAX)
+            {
+                logError("Body of %lld bytes too big to be kept in memory!", parser->res->contentLength);
+
+                return ERR_MEMORY;
+            }
+
+            return reserveBuffer(&parser->content, parser->res->contentLength);
+        }
+    }
+    else if (parser->res->contentLength == -1)
+    {
+        logVerbose("Reciving chiunked body");
+
+        parser->res->contentLength = 0;
+        parser->state              = PARSER_CHUNK_SIZE;
+    }
+    else if (parser->res->contentLength == BODY_UNTIL_CLOSE)
+    {
+        logVerbose("Reciving body until the connection is closed");
+
+        parser->res->contentLength = 0;
+        parser->state              = PARSER_BODY_UNTIL_CLOSE;
+    }
+    else
+    {
+        finishBody(parser);
+    }
+
+    return HTTP_OK;
+}
+
+httpError deliverBody(httpParser *parser, char *data, int length)
+{
+    httpResponse *res;
+
+    res = parser->res;
+
+    if (res->digest != NULL)
+    {
+        EVP_DigestUpdate(res->digest, data, length);
+    }
+
+    if (res->sink != NULL)
+    {
+        return sinkWrite(res->sink, data, length) == -1 ? ERR_FILE : HTTP_OK;
+    }
+
+    if (res->onBody != NULL)
+    {
+        return res->onBody(res->bodyData, data, length) != 0 ? ERR_ABORTED : HTTP_OK;
+    }
+
+    return appendBuffer(&parser->content, data, length);
+}
+
+// append up to the first LF to parser->line, -1 if out of memory
+int collectLine(httpParser *parser, char *data, int length, int *complete)
+{
+    char *lineEnd;
+    int step;
+
+    lineEnd   = memchr(data, '\n', length);
+    step      = lineEnd != NULL ? lineEnd - data + 1 : length;
+    *complete = lineEnd != NULL;
+
+    if (appendBuffer(&parser->line, data, step) != HTTP_OK)
+    {
+        return -1;
+    }
+
+    return step;
+}
+
+// 1xx status line, but 101 Switching Protocols which is final
+int isInterim(char *headers)
+{
+    char *status;
+
+    status = strchr(headers, ' ');
+
+    return status != NULL && status[1] == '1' && strncmp(status + 1, "101", 3) != 0;
+}
+
+void finishBody(httpParser *parser)
+{
+    parser->state = PARSER_DONE;
+    traceProbe(body_done, parser->res->contentLength);
+
+    free(parser->res->content);
+    parser->res->content = detachBuffer(&parser->content);
+}
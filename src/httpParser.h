@@ -0,0 +1,86 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+#include "httpLib.h"
+
+// a response whose headers grow past this is not worth parsing
+#define PARSER_MAX_HEADERS (256 * 1024)
+
+typedef enum parserState
+{
+    PARSER_HEADERS,
+    /** headers parsed, the body framing is chosen at the next feed */
+    PARSER_BODY_START,
+    PARSER_BODY,
+    /** body without framing, it ends when the server closes the connection */
+    PARSER_BODY_UNTIL_CLOSE,
+    PARSER_CHUNK_SIZE,
+    PARSER_CHUNK_DATA,
+    PARSER_CHUNK_END,
+    PARSER_TRAILERS,
+    PARSER_DONE
+} parserState;
+
+/**
+ * Incremental HTTP/1.1 response parser, fed with slices of any size as they
+ * arrive from whatever transport. Every piece of state is kept between calls,
+ * so a line or a chunk can be split at any byte.
+ *
+ * Events go through the response: the status line and the headers are passed
+ * to res->onHeader by parseHeaders, body bytes are hashed into res->digest and
+ * then written to res->sink, passed to res->onBody or stored in res->content.
+ */
+typedef struct httpParser
+{
+    parserState state;
+    httpResponse *res;
+
+    /** headers, chunk size line or trailer line read so far */
+    byteBuffer line;
+    /** bytes of HEADERS_END matched at the end of line */
+    int matched;
+    /** body bytes left in the whole body or in the current chunk */
+    long long remaining;
+
+    /** body kept in memory, moved to res->content when done */
+    byteBuffer content;
+} httpParser;
+
+#define parserDone(parser) ((parser)->state == PARSER_DONE)
+
+/** @return New parser waiting for the status line of res, NULL if out of memory */
+httpParser *createParser(httpResponse *res);
+
+/**
+ * Parse the next slice of the response.
+ * Stops right after the headers, even with data left, so the caller can look
+ * at them and choose where the body goes (res->sink, callbacks, or no body at
+ * all by setting res->contentLength to 0) before feeding the rest.
+ * Also stops at the end of the response: the bytes left belong to the next one.
+ *
+ * @param data slice to parse, may be NULL with length 0 to only start the body
+ * @param consumed is an integer passed by reference that is set to the bytes used
+ */
+httpError feedParser(httpParser *parser, char *data, int length, int *consumed);
+
+/**
+ * @return Body bytes the parser expects before any more framing, 0 if it
+ *         expects framing or is not in the body. The caller can deliver them to
+ *         the response on its own, e.g. reading straight into the sink buffers,
+ *         and report them with advanceParser.
+ */
+long long parserBodyExpected(httpParser *parser);
+/** Account length body bytes delivered by the caller, at most parserBodyExpected */
+void advanceParser(httpParser *parser, long long length);
+
+/**
+ * Tell the parser the server closed the connection, which completes a body
+ * without Content-Length nor chunked framing.
+ *
+ * @return ERR_CLOSED if the response was still missing something
+ */
+httpError closeParser(httpParser *parser);
+
+/** Free the parser and the body it was still holding, NULL is ignored */
+void destroyParser(httpParser *parser);
@@ -0,0 +1,226 @@
+#include "linkScanner.h"
+#include <ctype.h>
+#include <string.h>
+
+void endAttributeName(linkScanner *scanner);
+httpError emitLink(linkScanner *scanner, linkCallback onLink, void *userData);
+
+void initScanner(linkScanner *scanner)
+{
+    scanner->state           = SCAN_TEXT;
+    scanner->quote           = '\0';
+    scanner->attributeLength = 0;
+    scanner->isLink          = 0;
+    scanner->matched         = 0;
+    initBuffer(&scanner->value);
+}
+
+httpError feedScanner(linkScanner *scanner, char *data, int length, linkCallback onLink, void *userData)
+{
+    int i;
+    char byte, *tagStart;
+    httpError error;
+
+    for (i = 0; i < length; ++i)
+    {
+        byte = data[i];
+
+        switch (scanner->state)
+        {
+        case SCAN_TEXT:
+            // most of a page is text, jump straight to the next tag
+            tagStart = memchr(data + i, '<', length - i);
+            if (tagStart == NULL)
+            {
+                return HTTP_OK;
+            }
+
+            i                = tagStart - data;
+            scanner->state   = SCAN_TAG_OPEN;
+            scanner->matched = 0;
+            break;
+
+        case SCAN_TAG_OPEN:
+            // "<!--" opens a comment, anything else is a tag (or a declaration)
+            if (byte == '!' && scanner->matched == 0)
+            {
+                scanner->matched = -1;
+            }
+            else if (byte == '-' && scanner->matched < 0)
+            {
+                if (--scanner->matched == -3)
+                {
+                    scanner->state   = SCAN_COMMENT;
+                    scanner->matched = 0;
+                }
+            }
+            else if (byte == '>')
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else
+            {
+                scanner->state = isspace((unsigned char)byte) ? SCAN_TAG : SCAN_TAG_NAME;
+            }
+            break;
+
+        case SCAN_COMMENT:
+            if (byte == '-')
+            {
+                ++scanner->matched;
+            }
+            else if (byte == '>' && scanner->matched >= 2)
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else
+            {
+                scanner->matched = 0;
+            }
+            break;
+
+        case SCAN_TAG_NAME:
+            if (byte == '>')
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else if (isspace((unsigned char)byte) || byte == '/')
+            {
+                scanner->state = SCAN_TAG;
+            }
+            break;
+
+        case SCAN_TAG:
+            if (byte == '>')
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else if (!isspace((unsigned char)byte) && byte != '/')
+            {
+                scanner->state           = SCAN_ATTRIBUTE_NAME;
+                scanner->attribute[0]    = tolower((unsigned char)byte);
+                scanner->attributeLength = 1;
+            }
+            break;
+
+        case SCAN_ATTRIBUTE_NAME:
+            if (byte == '=')
+            {
+                endAttributeName(scanner);
+                scanner->state = SCAN_BEFORE_VALUE;
+            }
+            else if (byte == '>' || byte == '/' || isspace((unsigned char)byte))
+            {
+                endAttributeName(scanner);
+                scanner->state = byte == '>' ? SCAN_TEXT : byte == '/' ? SCAN_TAG : SCAN_AFTER_NAME;
+            }
+            else if (scanner->attributeLength < LINK_ATTRIBUTE_MAX)
+            {
+                scanner->attribute[scanner->attributeLength++] = tolower((unsigned char)byte);
+            }
+            break;
+
+        case SCAN_AFTER_NAME:
+            if (byte == '=')
+            {
+                scanner->state = SCAN_BEFORE_VALUE;
+            }
+            else if (byte == '>')
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else if (!isspace((unsigned char)byte))
+            {
+                // an attribute without value, this byte starts the next one
+                scanner->state = SCAN_TAG;
+                --i;
+            }
+            break;
+
+        case SCAN_BEFORE_VALUE:
+            if (byte == '"' || byte == '\'')
+            {
+                scanner->state = SCAN_QUOTED_VALUE;
+                scanner->quote = byte;
+            }
+            else if (byte == '>')
+            {
+                scanner->state = SCAN_TEXT;
+            }
+            else if (!isspace((unsigned char)byte))
+            {
+                scanner->state = SCAN_UNQUOTED_VALUE;
+                --i;
+            }
+            break;
+
+        case SCAN_QUOTED_VALUE:
+        case SCAN_UNQUOTED_VALUE:
+            if ((scanner->state == SCAN_QUOTED_VALUE && byte == scanner->quote) ||
+                (scanner->state == SCAN_UNQUOTED_VALUE && (isspace((unsigned char)byte) || byte == '>')))
+            {
+                error = emitLink(scanner, onLink, userData);
+                if (error != HTTP_OK)
+                {
+                    return error;
+                }
+
+                scanner->state = byte == '>' ? SCAN_TEXT : SCAN_TAG;
+            }
+            else if (scanner->isLink && bufferLength(&scanner->value) < LINK_VALUE_MAX)
+            {
+                error = appendBuffer(&scanner->value, &byte, 1);
+                if (error != HTTP_OK)
+                {
+                    return error;
+                }
+            }
+            break;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+void freeScanner(linkScanner *scanner)
+{
+    freeBuffer(&scanner->value);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+void endAttributeName(linkScanner *scanner)
+{
+    scanner->attribute[scanner->attributeLength] = '\0';
+
+    scanner->isLink = !strcmp(scanner->attribute, "href") || !strcmp(scanner->attribute, "src");
+    consumeBuffer(&scanner->value, bufferLength(&scanner->value));
+}
+
+httpError emitLink(linkScanner *scanner, linkCallback onLink, void *userData)
+{
+    int in, out, length;
+    char *link;
+
+    if (!scanner->isLink || bufferLength(&scanner->value) == 0 || bufferLength(&scanner->value) >= LINK_VALUE_MAX)
+    {
+        return HTTP_OK;
+    }
+
+    // query strings are written with &amp; inside HTML
+    link   = bufferData(&scanner->value);
+    length = bufferLength(&scanner->value);
+    for (in = out = 0; in < length; ++in, ++out)
+    {
+        link[out] = link[in];
+        if (!strncmp(link + in, "&amp;", 5))
+        {
+            in += 4;
+        }
+    }
+    link[out] = '\0';
+
+    scanner->isLink = 0;
+
+    return onLink(userData, link, out) != 0 ? ERR_ABORTED : HTTP_OK;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+
+// longer attribute names are never href or src, longer values are not followed
+#define LINK_ATTRIBUTE_MAX 8
+#define LINK_VALUE_MAX     4096
+
+typedef enum scanState
+{
+    SCAN_TEXT,
+    /** after '<', a comment or a tag */
+    SCAN_TAG_OPEN,
+    SCAN_COMMENT,
+    SCAN_TAG_NAME,
+    /** between the attributes of a tag */
+    SCAN_TAG,
+    SCAN_ATTRIBUTE_NAME,
+    /** after an attribute name, before '=' or the next attribute */
+    SCAN_AFTER_NAME,
+    SCAN_BEFORE_VALUE,
+    SCAN_QUOTED_VALUE,
+    SCAN_UNQUOTED_VALUE
+} scanState;
+
+/**
+ * @return 0 to keep scanning, anything else to stop
+ */
+typedef int (*linkCallback)(void *userData, char *link, int length);
+
+/**
+ * Streaming HTML tokenizer that finds the href and src attributes of the tags.
+ * It is fed the body in slices of any size, a tag can be split at any byte.
+ */
+typedef struct linkScanner
+{
+    scanState state;
+    /** quote closing the current value */
+    char quote;
+    char attribute[LINK_ATTRIBUTE_MAX + 1];
+    int attributeLength;
+    /** 1 if the current attribute is a link, 0 skips its value */
+    int isLink;
+    /** '-' of "<!--" or "-->" matched so far */
+    int matched;
+    byteBuffer value;
+} linkScanner;
+
+void initScanner(linkScanner *scanner);
+/**
+ * Scan the next slice of the document, onLink is called with every link found.
+ * &amp; in the links is decoded, everything else is passed as written.
+ *
+ * @return ERR_ABORTED if onLink asked to stop
+ */
+httpError feedScanner(linkScanner *scanner, char *data, int length, linkCallback onLink, void *userData);
+void freeScanner(linkScanner *scanner);
@@ -1,4 +1,5 @@
 #include "logger.h"
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -7,45 +8,57 @@
 
 logLevel loggerLevel = INFO;
 char *logTime        = NULL;
+pthread_mutex_t logTimeLock = PTHREAD_MUTEX_INITIALIZER;
+// NULL for stdout, which is not a constant
+FILE *logStream = NULL;
 
 void logger(logLevel level, char *filename, int fileLine, const char *funcName, char *fmt, ...)
 {
     va_list args;
+    FILE *output;
 
     if (level <= loggerLevel)
     {
+        output = logStream != NULL ? logStream : stdout;
+
+        // the pieces of a line are printed together even with other threads logging
+        flockfile(output);
+
         switch (level)
         {
         case DEBUG:
-            printf(MAGENTA "[DEBUG] " RESET);
+            fprintf(output, MAGENTA "[DEBUG] " RESET);
 
             break;
 
         case VERBOSE:
-            printf(CYAN "[VERBOSE] " RESET);
+            fprintf(output, CYAN "[VERBOSE] " RESET);
 
             break;
 
         case INFO:
-            printf(GREEN "[INFO] " RESET);
+            fprintf(output, GREEN "[INFO] " RESET);
 
             break;
 
         case WARNING:
-            printf(YELLOW "[WARNING] " RESET);
+            fprintf(output, YELLOW "[WARNING] " RESET);
 
             break;
 
         case ERROR:
-            printf(RED "[ERROR] " RESET);
+            fprintf(output, RED "[ERROR] " RESET);
 
             break;
 
         case PANIC:
-            printf(RED "[FATAL ERROR] " GRAY "%s:%d [%s] " RESET,
-                   filename, fileLine, funcName);
-            vprintf(fmt, args);
-            printf("\n");
+            fprintf(output, RED "[FATAL ERROR] " GRAY "%s:%d [%s] " RESET,
+                    filename, fileLine, funcName);
+            va_start(args, fmt);
+            vfprintf(output, fmt, args);
+            va_end(args);
+            fprintf(output, "\n");
+            funlockfile(output);
 
             exit(1);
 
@@ -57,63 +70,110 @@ void logger(logLevel level, char *filename, int fileLine, const char *funcName,
 
         if (loggerLevel >= DEBUG)
         {
-            printf(GRAY "%s:%d [%s] " RESET,
-                   filename, fileLine, funcName);
+            fprintf(output, GRAY "%s:%d [%s] " RESET,
+                    filename, fileLine, funcName);
         }
 
         va_start(args, fmt);
-        vprintf(fmt, args);
-        printf("\n");
+        vfprintf(output, fmt, args);
+        fprintf(output, "\n");
         va_end(args);
+
+        funlockfile(output);
     }
 }
 
 void logFile(logLevel level, char *name, int nameLength, const char *extension, int extensionLength, char *fmt, ...)
 {
     char *filename;
-    int filenameLength;
     FILE *fp;
     va_list args;
 
     if (level <= loggerLevel)
     {
-        if (logTime == NULL)
+        filename = logFilename(name, nameLength, extension, extensionLength);
+        if (filename == NULL)
         {
-            initLogTime();
-            logDebug("TIME %s", logTime);
+            return;
         }
 
-        // LOG_DIR     + '/' + name       + ' - ' + logTime + '.' + extension
-        // LOG_DIR_LEN + 1   + nameLength + 3     + 19      + 1   + extensionLength
-        filenameLength = DEFAULT_LOG_DIR_LENGTH + 1 + nameLength + 3 + 19 + 1 + extensionLength;
-        filename       = malloc(filenameLength + 1);
-
-        if (filename == NULL)
+        fp = fopen(filename, "w+");
+        if (fp == NULL)
         {
-            logPanic("Could not allocate filename of length %d", filenameLength);
+            logError("Could not open '%s' to write!", filename);
+            free(filename);
+
+            return;
         }
-        else
+
+        va_start(args, fmt);
+        vfprintf(fp, fmt, args);
+        va_end(args);
+
+        free(filename);
+        fclose(fp);
+    }
+}
+
+void logFileData(logLevel level, char *name, int nameLength, const char *extension, int extensionLength, char *data, int length)
+{
+    char *filename;
+    FILE *fp;
+
+    if (level <= loggerLevel)
+    {
+        filename = logFilename(name, nameLength, extension, extensionLength);
+        if (filename == NULL)
         {
-            snprintf(filename, filenameLength + 1,
-                     "%s/%s - %s.%s",
-                     DEFAULT_LOG_DIR, name, logTime, extension);
+            return;
         }
-        fp = fopen(filename, "w+");
 
+        fp = fopen(filename, "w+");
         if (fp == NULL)
         {
             logError("Could not open '%s' to write!", filename);
+            free(filename);
+
+            return;
         }
 
-        va_start(args, fmt);
-        vfprintf(fp, fmt, args);
-        va_end(args);
+        fwrite(data, 1, length, fp);
 
         free(filename);
         fclose(fp);
     }
 }
 
+char *logFilename(char *name, int nameLength, const char *extension, int extensionLength)
+{
+    char *filename;
+    int filenameLength;
+
+    initLogTime();
+    if (logTime == NULL)
+    {
+        return NULL;
+    }
+
+    // LOG_DIR     + '/' + name       + ' - ' + logTime + '.' + extension
+    // LOG_DIR_LEN + 1   + nameLength + 3     + 19      + 1   + extensionLength
+    filenameLength = DEFAULT_LOG_DIR_LENGTH + 1 + nameLength + 3 + 19 + 1 + extensionLength;
+    filename       = malloc(filenameLength + 1);
+
+    if (filename == NULL)
+    {
+        logError("Could not allocate filename of length %d", filenameLength);
+
+        return NULL;
+    }
+
+    snprintf(filename, filenameLength + 1,
+             "%s/%s - %s.%s",
+             DEFAULT_LOG_DIR, name, logTime, extension);
+
+    return filename;
+}
+
 void increaseLogLevel()
 {
     if (loggerLevel < DEBUG)
@@ -127,22 +187,36 @@ void silenceLogger()
     loggerLevel = PANIC;
 }
 
+void setLogStream(FILE *stream)
+{
+    logStream = stream;
+}
+
 void initLogTime()
 {
     time_t epochTime;
-    struct tm *currentTime;
+    struct tm currentTime;
+    char *newTime;
 
+    // every thread must see the same time, it is part of all the file names
+    pthread_mutex_lock(&logTimeLock);
     if (logTime == NULL)
     {
         // YYYY-MM-DD HH-MM-SS => 19 + 1
-        logTime = malloc(19 + 1);
-        if (logTime == NULL)
+        newTime = malloc(19 + 1);
+        if (newTime == NULL)
         {
-            logPanic("Could not allocate time string!");
+            logError("Could not allocate time string!");
         }
+        else
+        {
+            time(&epochTime);
+            localtime_r(&epochTime, &currentTime);
+            strftime(newTime, 19 + 1, "%F %T", &currentTime);
+            logTime = newTime;
 
-        time(&epochTime);
-        currentTime = localtime(&epochTime);
-        strftime(logTime, 19 + 1, "%F %T", currentTime);
+            logDebug("TIME %s", logTime);
+        }
     }
+    pthread_mutex_unlock(&logTimeLock);
 }
@@ -1,5 +1,7 @@
 #pragma once
 
+#include <stdio.h>
+
 #define MAGENTA "\x1b[35m"
 #define CYAN    "\x1b[36m"
 #define GREEN   "\x1b[32m"
@@ -30,7 +32,14 @@ typedef enum
 
 void logger(logLevel level, char *filename, int fileLine, const char *funcName, char *fmt, ...);
 void logFile(logLevel level, char *name, int nameLength, const char *extension, int extLength, char *fmt, ...);
+/** Same as logFile for raw bytes, that can contain null bytes */
+void logFileData(logLevel level, char *name, int nameLength, const char *extension, int extLength, char *data, int length);
+/** Returns the newly allocated path used by logFile for name and extension, NULL on error */
+char *logFilename(char *name, int nameLength, const char *extension, int extLength);
 
+/** Logging is safe from any thread, the level should be set before starting them */
 void increaseLogLevel();
 void silenceLogger();
+/** Print the log lines to stream instead of stdout, e.g. when stdout carries the body */
+void setLogStream(FILE *stream);
 void initLogTime();
@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * USDT tracepoints of the transfer phases, provider 'wannabeCurl'.
+ * A probe is a single nop until a tracer attaches to it, so they are always
+ * compiled in when <sys/sdt.h> (systemtap-sdt-dev) is installed; without it,
+ * or with -DNO_PROBES, they compile to nothing and the arguments are not evaluated.
+ * List them with 'bpftrace -l "usdt:./wannabeCurl:*"', see ./tracing for scripts.
+ *
+ * Probes and arguments:
+ *   dns_start(host)                     dns_done(host, httpError)
+ *   connect_start(host, address)        connect_done(host, 1 if connected)
+ *   tls_start(host)                     tls_done(host, SSL_connect result, 1 if resumed)
+ *   send_start(host, length)            send_done(host, bytes sent, -1 on error)
+ *   read_done(host, bytes read, httpError), for every read of a head or a body from the socket
+ *   headers_done(status, content length, header bytes)
+ *   chunk(size)                         body_done(body bytes)
+ */
+
+#if !defined(NO_PROBES) && defined(__has_include)
+#if __has_include(<sys/sdt.h>)
+#include <sys/sdt.h>
+#define traceProbe(name, ...) STAP_PROBEV(wannabeCurl, name, __VA_ARGS__)
+#endif
+#endif
+
+#ifndef traceProbe
+#define traceProbe(name, ...) ((void)0)
+#endif
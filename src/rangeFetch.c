@@ -0,0 +1,462 @@
+#define _GNU_SOURCE
+#include "rangeFetch.h"
+#include "byteRanges.h"
+#include "httpHandle.h"
+#include "logger.h"
+#include "rateLimit.h"
+#include "utils.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+typedef struct rangeFetch
+{
+    httpRequest *req;
+    httpHandle *handle;
+    char *url;
+    /** sparse file the ranges are written to */
+    char *outputPath;
+    int descriptor;
+    /** size of the remote file, -1 until a response tells it */
+    long long total;
+    long long written;
+
+    // REQUEST IN PROGRESS
+    /** ranges asked by the request */
+    byteRange *ranges;
+    int asked;
+    /** Content-Type of the response as sent, the boundary is case sensitive */
+    char *contentType;
+    /** 1 once the headers announce a multipart/byteranges body */
+    int multipart;
+    /** bytes written by the response, checked against the ranges asked */
+    byteRange *received;
+    int receivedCount;
+    int receivedCapacity;
+    rangeParser parser;
+    /** where the next byte of a single range response goes */
+    long long offset;
+    /** 1 if the server sent the whole file or refused the ranges */
+    int refused;
+    /** why a callback stopped the transfer */
+    httpError failure;
+} rangeFetch;
+
+httpError fetchRanges(rangeFetch *fetch, byteRange *ranges, int count);
+httpError setupRanges(rangeFetch *fetch, byteRange *ranges, int count);
+httpError checkReceived(rangeFetch *fetch, byteRange *ranges, int count);
+int checkRanges(void *userData, char *line, int length);
+int writeRanges(void *userData, char *data, int length);
+int writePart(void *userData, long long offset, char *data, int length);
+
+httpError runRanges(httpRequest *req)
+{
+    int i, count;
+    byteRange *ranges;
+    rangeFetch fetch;
+    httpError error;
+
+    memset(&fetch, 0, sizeof(fetch));
+    fetch.req        = req;
+    fetch.descriptor = -1;
+    fetch.total      = -1;
+
+    error = parseRanges(req->ranges, &ranges, &count);
+    if (error != HTTP_OK)
+    {
+        logError("Invalid ranges '%s': %s", req->ranges, errorDescription(error));
+
+        return error;
+    }
+
+    fetch.handle = createHandle();
+    if (fetch.handle == NULL ||
+        asprintf(&fetch.url, "%s://%s%s", req->secure ? "https" : "http", req->host, req->path) == -1)
+    {
+        fetch.url = NULL;
+        error     = ERR_MEMORY;
+    }
+
+    if (error == HTTP_OK)
+    {
+        fetch.outputPath = req->outputPath != NULL ? strdup(req->outputPath)
+                                                   : logFilename(req->host, req->hostLength,
+                                                                 contentTypeToExtension[NONE], contentTypeToLength[NONE]);
+        error = fetch.outputPath == NULL ? ERR_MEMORY : HTTP_OK;
+    }
+
+    // not truncated, the ranges of several runs add up in the same file
+    if (error == HTTP_OK)
+    {
+        fetch.descriptor = open(fetch.outputPath, O_WRONLY | O_CREAT, 0644);
+        if (fetch.descriptor == -1)
+        {
+            logError("Could not open '%s': %s", fetch.outputPath, strerror(errno));
+            error = ERR_FILE;
+        }
+    }
+
+    if (error == HTTP_OK)
+    {
+        // overlapping and touching ranges are a single one for the server too
+        count = coalesceRanges(ranges, count, 0);
+        error = fetchRanges(&fetch, ranges, count);
+
+        if (fetch.refused && count > 1)
+        {
+            count = coalesceRanges(ranges, count, RANGE_COALESCE_GAP);
+            logInfo("'%s' does not send several ranges at once, asking for %d ranges one by one", fetch.url, count);
+
+            for (i = 0, error = HTTP_OK; i < count && error == HTTP_OK; ++i)
+            {
+                error = fetchRanges(&fetch, &ranges[i], 1);
+            }
+        }
+    }
+
+    // the file gets the size of the remote one, what was not fetched is a hole
+    if (error == HTTP_OK && fetch.total > 0 && ftruncate(fetch.descriptor, fetch.total) == -1)
+    {
+        logError("Could not resize '%s': %s", fetch.outputPath, strerror(errno));
+        error = ERR_FILE;
+    }
+
+    if (error == HTTP_OK)
+    {
+        logInfo("%lld bytes of '%s' written to '%s'", fetch.written, fetch.url, fetch.outputPath);
+    }
+    else
+    {
+        logError("Ranges of '%s' failed: %s", fetch.url != NULL ? fetch.url : req->host, errorDescription(error));
+    }
+
+    if (fetch.descriptor != -1)
+    {
+        close(fetch.descriptor);
+    }
+    if (fetch.handle != NULL)
+    {
+        destroyHandle(fetch.handle);
+    }
+    free(fetch.outputPath);
+    free(fetch.url);
+    free(fetch.received);
+    free(ranges);
+
+    return error;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// a single request asking for count ranges
+httpError fetchRanges(rangeFetch *fetch, byteRange *ranges, int count)
+{
+    httpError error;
+
+    fetch->ranges        = ranges;
+    fetch->asked         = count;
+    fetch->multipart     = 0;
+    fetch->receivedCount = 0;
+    fetch->offset        = 0;
+    fetch->refused       = 0;
+    fetch->failure       = HTTP_OK;
+
+    error = setupRanges(fetch, ranges, count);
+    if (error == HTTP_OK)
+    {
+        error = performRequest(fetch->handle);
+    }
+
+    if (error == ERR_ABORTED && fetch->failure != HTTP_OK)
+    {
+        error = fetch->failure;
+    }
+
+    if (fetch->multipart)
+    {
+        if (error == HTTP_OK)
+        {
+            error = finishRanges(&fetch->parser);
+        }
+        if (fetch->parser.total > 0)
+        {
+            fetch->total = fetch->parser.total;
+        }
+
+        freeRanges(&fetch->parser);
+    }
+    free(fetch->contentType);
+    fetch->contentType = NULL;
+
+    if (error == HTTP_OK)
+    {
+        error = checkReceived(fetch, ranges, count);
+    }
+
+    return error;
+}
+
+httpError setupRanges(rangeFetch *fetch, byteRange *ranges, int count)
+{
+    char *value;
+    httpRequest *req = fetch->req;
+    httpHeader *header;
+    httpError error;
+
+    resetHandle(fetch->handle);
+    setHeaderCallback(fetch->handle, checkRanges, fetch);
+    setBodyCallback(fetch->handle, writeRanges, fetch);
+
+    error = setUrl(fetch->handle, fetch->url);
+    if (error == HTTP_OK)
+    {
+        error = setSocketProfile(fetch->handle, req->socketProfile);
+    }
+    if (error == HTTP_OK)
+    {
+        error = setUnixSocket(fetch->handle, req->unixSocket);
+    }
+
+    for (header = req->headers; header != NULL && error == HTTP_OK; header = header->next)
+    {
+        // the ranges asked are the ones of --range
+        if (strncasecmp(header->line, "Range:", 6))
+        {
+            error = addRequestHeader(fetch->handle, header->line);
+        }
+    }
+
+    if (error == HTTP_OK)
+    {
+        value = formatRanges(ranges, count);
+        error = value != NULL ? addHeader(fetch->handle->req, "Range: %s", value) : ERR_MEMORY;
+        if (error == HTTP_OK)
+        {
+            logInfo("Fetching %s of '%s'...", value, fetch->url);
+        }
+        free(value);
+    }
+    if (error == HTTP_OK && (req->limitRate > 0 || globalRate() > 0))
+    {
+        error = setRateLimit(fetch->handle, req->limitRate, req->rateWeight);
+    }
+
+    return error;
+}
+
+// every range asked must be in the response, the server may send less than asked
+httpError checkReceived(rangeFetch *fetch, byteRange *ranges, int count)
+{
+    int i, j;
+    long long first, last;
+
+    fetch->receivedCount = coalesceRanges(fetch->received, fetch->receivedCount, 0);
+
+    for (i = 0; i < count; ++i)
+    {
+        first = ranges[i].first;
+        last  = ranges[i].last;
+
+        // the ends of the open ranges are known only with the size of the file
+        if (first < 0)
+        {
+            if (fetch->total < 0)
+            {
+                continue;
+            }
+            first = fetch->total + first > 0 ? fetch->total + first : 0;
+            last  = fetch->total - 1;
+        }
+        else if (last == -1 || (fetch->total >= 0 && last >= fetch->total))
+        {
+            last = fetch->total >= 0 ? fetch->total - 1 : first;
+        }
+
+        // past the end of the file, there is nothing to fetch
+        if (first > last)
+        {
+            continue;
+        }
+
+        for (j = 0; j < fetch->receivedCount; ++j)
+        {
+            if (fetch->received[j].first <= first && fetch->received[j].last >= last)
+            {
+                break;
+            }
+        }
+        if (j == fetch->receivedCount)
+        {
+            logError("Bytes %lld-%lld of '%s' were asked but not sent!", first, last, fetch->url);
+
+            return ERR_PARSE;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+int checkRanges(void *userData, char *line, int length)
+{
+    long long first;
+    rangeFetch *fetch = userData;
+    httpResponse *res = fetch->handle->res;
+
+    if (length > 0)
+    {
+        if (!strncasecmp(line, "Content-Type:", 13))
+        {
+            free(fetch->contentType);
+            fetch->contentType = strdup(line + 13);
+        }
+
+        return 0;
+    }
+
+    // all the headers are parsed
+    logVerbose("Status %d: %s", res->status, statusCodeDescription(res->status));
+    if (res->status == 206)
+    {
+        if (fetch->contentType != NULL && strcasestr(fetch->contentType, "multipart/byteranges") != NULL)
+        {
+            fetch->multipart = 1;
+            fetch->failure   = initRanges(&fetch->parser, fetch->contentType);
+
+            return fetch->failure != HTTP_OK;
+        }
+
+        // a single part, the server can merge the ranges asked
+        if (res->rangeStart == -1)
+        {
+            logError("'%s' sent a range without its Content-Range!", fetch->url);
+            fetch->failure = ERR_PARSE;
+
+            return 1;
+        }
+        if (res->rangeTotal > 0)
+        {
+            fetch->total = res->rangeTotal;
+        }
+
+        // a single range asked starts where it was asked, the last bytes once the size is known
+        first = fetch->ranges[0].first;
+        if (first < 0 && fetch->total > 0)
+        {
+            first = fetch->total + first > 0 ? fetch->total + first : 0;
+        }
+        if (fetch->asked == 1 && first >= 0 && res->rangeStart != first)
+        {
+            logError("'%s' sent a range starting at %lld instead of %lld!", fetch->url, res->rangeStart, first);
+            fetch->failure = ERR_PARSE;
+
+            return 1;
+        }
+        fetch->offset = res->rangeStart;
+
+        return 0;
+    }
+
+    // the whole file is not read, only the ranges are wanted
+    if (res->status == 200 || res->status == 416)
+    {
+        fetch->refused = 1;
+        if (fetch->asked == 1)
+        {
+            logError(res->status == 200 ? "'%s' does not send ranges of the file!" : "The range asked is not in '%s'!",
+                     fetch->url);
+            fetch->failure = ERR_INVALID;
+        }
+
+        return 1;
+    }
+
+    logError("Status %d: '%s' could not be fetched!", res->status, fetch->url);
+
+    return 1;
+}
+
+int writeRanges(void *userData, char *data, int length)
+{
+    rangeFetch *fetch = userData;
+    httpError error;
+
+    if (fetch->multipart)
+    {
+        error = feedRanges(&fetch->parser, data, length, writePart, fetch);
+        if (error != HTTP_OK && error != ERR_ABORTED)
+        {
+            fetch->failure = error;
+        }
+
+        return error != HTTP_OK;
+    }
+
+    if (writePart(fetch, fetch->offset, data, length) != 0)
+    {
+        return 1;
+    }
+    fetch->offset += length;
+
+    return 0;
+}
+
+// data of the remote file written at the same offset of the local one
+int writePart(void *userData, long long offset, char *data, int length)
+{
+    int written, capacity;
+    rangeFetch *fetch = userData;
+    byteRange *grown;
+
+    // the pieces of the same part follow each other
+    if (fetch->receivedCount > 0 && fetch->received[fetch->receivedCount - 1].last + 1 == offset)
+    {
+        fetch->received[fetch->receivedCount - 1].last += length;
+    }
+    else if (length > 0)
+    {
+        if (fetch->receivedCount == fetch->receivedCapacity)
+        {
+            capacity = fetch->receivedCapacity > 0 ? fetch->receivedCapacity * 2 : 8;
+            grown    = realloc(fetch->received, capacity * sizeof(byteRange));
+            if (grown == NULL)
+            {
+                fetch->failure = ERR_MEMORY;
+
+                return -1;
+            }
+            fetch->received         = grown;
+            fetch->receivedCapacity = capacity;
+        }
+
+        fetch->received[fetch->receivedCount].first = offset;
+        fetch->received[fetch->receivedCount].last  = offset + length - 1;
+        ++fetch->receivedCount;
+    }
+
+    while (length > 0)
+    {
+        written = pwrite(fetch->descriptor, data, length, offset);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            logError("Could not write to '%s': %s", fetch->outputPath, strerror(errno));
+            fetch->failure = ERR_FILE;
+
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+        offset += written;
+        fetch->written += written;
+    }
+
+    return 0;
+}
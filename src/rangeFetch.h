@@ -0,0 +1,17 @@
+#pragma once
+
+#include "httpLib.h"
+
+/**
+ * Fetch the byte ranges of req->ranges from the url of req into a sparse file,
+ * every byte at its offset in the remote file. All the ranges are asked in a
+ * single request and the multipart/byteranges answer is parsed while it
+ * arrives. When the server sends the whole file instead, or refuses that many
+ * ranges, the ranges are merged with their close neighbours and asked one
+ * request each.
+ *
+ * Every range asked must be in the answers, the server can not leave one out.
+ *
+ * @return HTTP_OK when every range was written, ERR_PARSE if one was not sent
+ */
+httpError runRanges(httpRequest *req);
@@ -0,0 +1,242 @@
+#include "rateLimit.h"
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+long long sharedRate         = 0;
+rateLimiter *activeLimiters  = NULL;
+pthread_mutex_t limitersLock = PTHREAD_MUTEX_INITIALIZER;
+
+double allowedRate(rateLimiter *limiter, struct timespec *now);
+double secondsBetween(struct timespec *start, struct timespec *end);
+
+void setGlobalRate(long long rate)
+{
+    pthread_mutex_lock(&limitersLock);
+    sharedRate = rate > 0 ? rate : 0;
+    pthread_mutex_unlock(&limitersLock);
+}
+
+long long globalRate()
+{
+    long long rate;
+
+    pthread_mutex_lock(&limitersLock);
+    rate = sharedRate;
+    pthread_mutex_unlock(&limitersLock);
+
+    return rate;
+}
+
+rateLimiter *createLimiter(long long rate, int weight)
+{
+    rateLimiter *limiter;
+
+    limiter = calloc(1, sizeof(rateLimiter));
+    if (limiter == NULL)
+    {
+        return NULL;
+    }
+
+    limiter->rate   = rate > 0 ? rate : 0;
+    limiter->weight = weight > 0 ? weight : 1;
+    clock_gettime(CLOCK_MONOTONIC, &limiter->lastRefill);
+    limiter->lastActive = limiter->lastRefill;
+
+    pthread_mutex_lock(&limitersLock);
+    limiter->next  = activeLimiters;
+    activeLimiters = limiter;
+    pthread_mutex_unlock(&limitersLock);
+
+    return limiter;
+}
+
+void destroyLimiter(rateLimiter *limiter)
+{
+    rateLimiter **current;
+
+    if (limiter == NULL)
+    {
+        return;
+    }
+
+    pthread_mutex_lock(&limitersLock);
+    for (current = &activeLimiters; *current != NULL; current = &(*current)->next)
+    {
+        if (*current == limiter)
+        {
+            *current = limiter->next;
+
+            break;
+        }
+    }
+    pthread_mutex_unlock(&limitersLock);
+
+    free(limiter);
+}
+
+int throttle(rateLimiter *limiter, int wanted)
+{
+    double rate, quantum, needed, wait;
+    struct timespec now, deadline;
+
+    if (limiter == NULL)
+    {
+        return wanted;
+    }
+
+    while (1)
+    {
+        // recomputed every time, transfers may have started, ended or idled while waiting
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        rate = allowedRate(limiter, &now);
+        if (rate <= 0)
+        {
+            return wanted;
+        }
+
+        quantum = rate / RATE_SLICES;
+        if (quantum < RATE_MIN_QUANTUM)
+        {
+            quantum = RATE_MIN_QUANTUM;
+        }
+        else if (quantum > RATE_MAX_QUANTUM)
+        {
+            quantum = RATE_MAX_QUANTUM;
+        }
+
+        limiter->tokens += secondsBetween(&limiter->lastRefill, &now) * rate;
+        limiter->lastRefill = now;
+
+        // an idle transfer can save up at most two slices of traffic
+        if (limiter->tokens > 2 * quantum)
+        {
+            limiter->tokens = 2 * quantum;
+        }
+
+        needed = wanted < quantum ? wanted : quantum;
+        if (limiter->tokens >= needed)
+        {
+            if (limiter->tokens < wanted)
+            {
+                wanted = limiter->tokens;
+            }
+            limiter->tokens -= wanted;
+
+            return wanted;
+        }
+
+        wait             = (needed - limiter->tokens) / rate;
+        deadline.tv_sec  = now.tv_sec + (time_t)wait;
+        deadline.tv_nsec = now.tv_nsec + (long)((wait - (time_t)wait) * 1e9);
+        if (deadline.tv_nsec >= 1000000000L)
+        {
+            ++deadline.tv_sec;
+            deadline.tv_nsec -= 1000000000L;
+        }
+
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+        {
+        }
+    }
+}
+
+long long parseRate(char *text)
+{
+    double rate;
+    char *unit;
+
+    rate = strtod(text, &unit);
+    if (unit == text || rate <= 0)
+    {
+        return -1;
+    }
+
+    switch (*unit)
+    {
+    case 'g':
+    case 'G':
+        rate *= 1024;
+        // fall through
+    case 'm':
+    case 'M':
+        rate *= 1024;
+        // fall through
+    case 'k':
+    case 'K':
+        rate *= 1024;
+        ++unit;
+        // fall through
+    case '\0':
+        break;
+
+    default:
+        return -1;
+    }
+
+    return *unit == '\0' && rate >= 1 ? (long long)rate : -1;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// own rate or weighted share of the global rate, whichever is smaller, 0 for unlimited.
+// The global rate is water-filled: the transfers held below their share by their
+// own rate and the idle ones are taken out, the rest is split among the others
+double allowedRate(rateLimiter *limiter, struct timespec *now)
+{
+    int changed;
+    long long weight;
+    double rate, remaining, share;
+    rateLimiter *current;
+
+    pthread_mutex_lock(&limitersLock);
+    limiter->lastActive = *now;
+    rate                = limiter->rate;
+    if (sharedRate > 0)
+    {
+        remaining = sharedRate;
+        weight    = 0;
+        for (current = activeLimiters; current != NULL; current = current->next)
+        {
+            current->capped = secondsBetween(&current->lastActive, now) > RATE_IDLE_SECONDS;
+            if (!current->capped)
+            {
+                weight += current->weight;
+            }
+        }
+
+        // every pass can only cap more transfers, the share of the others only grows
+        do
+        {
+            changed = 0;
+            for (current = activeLimiters; current != NULL && weight > 0; current = current->next)
+            {
+                if (!current->capped && current->rate > 0 && current->rate < remaining * current->weight / weight)
+                {
+                    current->capped = 1;
+                    remaining -= current->rate;
+                    weight -= current->weight;
+                    changed = 1;
+                }
+            }
+        } while (changed);
+
+        if (!limiter->capped)
+        {
+            share = remaining * limiter->weight / weight;
+            if (rate == 0 || share < rate)
+            {
+                rate = share;
+            }
+        }
+    }
+    pthread_mutex_unlock(&limitersLock);
+
+    return rate;
+}
+
+double secondsBetween(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <time.h>
+
+// a transfer is paced in slices of about 1/RATE_SLICES of a second of traffic
+#define RATE_SLICES      20
+#define RATE_MIN_QUANTUM 1024
+#define RATE_MAX_QUANTUM (64 * 1024)
+// a transfer that asked for nothing in this many seconds leaves its share to the others
+#define RATE_IDLE_SECONDS 0.25
+
+/**
+ * Token bucket of a single transfer. When a global rate is set, it is split
+ * among the active limiters in proportion to their weight. A transfer whose
+ * own rate is below its share keeps its own rate and the idle ones take
+ * nothing, what they leave goes to the others in proportion to their weight.
+ */
+typedef struct rateLimiter
+{
+    /** bytes per second allowed to this transfer, 0 for no own limit */
+    long long rate;
+    /** share of the global rate compared to the other active transfers */
+    int weight;
+    /** bytes that can be transferred right now */
+    double tokens;
+    struct timespec lastRefill;
+    /** last time the transfer asked to move bytes, read by the others under the lock */
+    struct timespec lastActive;
+    /** 1 while computing the shares, if held to its own rate */
+    int capped;
+    struct rateLimiter *next;
+} rateLimiter;
+
+/** Bytes per second shared by all the transfers of the process, 0 to disable */
+void setGlobalRate(long long rate);
+long long globalRate();
+
+/**
+ * Register a new active transfer.
+ *
+ * @param rate own limit in bytes per second, 0 to only take part in the global share
+ * @param weight relative share of the global rate, values below 1 count as 1
+ *
+ * @return NULL if out of memory
+ */
+rateLimiter *createLimiter(long long rate, int weight);
+/** Unregister the transfer, its share goes back to the others */
+void destroyLimiter(rateLimiter *limiter);
+
+/**
+ * Wait until the transfer is allowed to move some bytes.
+ * Waits are timed on an absolute deadline and cover a whole slice, so the
+ * callers keep doing big reads and writes instead of tiny paced ones.
+ *
+ * @param limiter NULL for no limit
+ *
+ * @return Bytes that can be transferred now, between 1 and wanted
+ */
+int throttle(rateLimiter *limiter, int wanted);
+
+/** Parse a rate like 500, 200K, 1.5M or 1G (1024 based), -1 if invalid */
+long long parseRate(char *text);
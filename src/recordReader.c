@@ -0,0 +1,660 @@
+#include "recordReader.h"
+#include "logger.h"
+#include "stats.h"
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+
+int nextLine(recordReader *reader);
+void clearValues(recordReader *reader);
+httpError setValue(recordReader *reader, int column, int start);
+httpError addColumn(recordReader *reader, char *name, int length);
+httpError parseCsvLine(recordReader *reader, int length, int header);
+httpError parseJsonLine(recordReader *reader, int length, int header);
+httpError appendJsonString(byteBuffer *buffer, char **cursor, char *end);
+char *skipJsonValue(char *cursor, char *end);
+char *skipSpaces(char *cursor, char *end);
+int encodeUtf8(unsigned int codepoint, char *output);
+templateRecord *makeRecord(recordReader *reader);
+
+httpError openRecords(recordReader *reader, char *path)
+{
+    int length;
+    httpError error;
+
+    memset(reader, 0, sizeof(recordReader));
+    initBuffer(&reader->values);
+    initBuffer(&reader->key);
+    reader->path = path;
+
+    reader->fp = strcmp(path, "-") ? fopen(path, "r") : stdin;
+    if (reader->fp == NULL)
+    {
+        logError("Could not open data file '%s'!", path);
+
+        return ERR_FILE;
+    }
+
+    length = nextLine(reader);
+    if (length == -1)
+    {
+        logError("Data file '%s' is empty!", path);
+
+        return ERR_PARSE;
+    }
+
+    reader->json = *skipSpaces(reader->line, reader->line + length) == '{';
+    if (!reader->json)
+    {
+        // the names of the columns go through the same parser as the values
+        return parseCsvLine(reader, length, 1);
+    }
+
+    error = parseJsonLine(reader, length, 1);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    reader->pending = makeRecord(reader);
+
+    return reader->pending != NULL ? HTTP_OK : ERR_MEMORY;
+}
+
+httpError readRecord(recordReader *reader, templateRecord **record)
+{
+    int length;
+    httpError error;
+
+    *record = NULL;
+
+    if (reader->pending != NULL)
+    {
+        *record         = reader->pending;
+        reader->pending = NULL;
+
+        return HTTP_OK;
+    }
+
+    length = nextLine(reader);
+    if (length == -1)
+    {
+        return HTTP_OK;
+    }
+
+    error = reader->json ? parseJsonLine(reader, length, 0) : parseCsvLine(reader, length, 0);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    *record = makeRecord(reader);
+
+    return *record != NULL ? HTTP_OK : ERR_MEMORY;
+}
+
+int findColumn(recordReader *reader, char *name, int nameLength)
+{
+    int i;
+
+    for (i = 0; i < reader->columnCount; ++i)
+    {
+        if (strlen(reader->columns[i]) == nameLength && !memcmp(reader->columns[i], name, nameLength))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+void closeRecords(recordReader *reader)
+{
+    int i;
+
+    if (reader->fp != NULL && reader->fp != stdin)
+    {
+        fclose(reader->fp);
+    }
+    reader->fp = NULL;
+
+    for (i = 0; i < reader->columnCount; ++i)
+    {
+        free(reader->columns[i]);
+    }
+    free(reader->columns);
+    free(reader->line);
+    free(reader->starts);
+    free(reader->lengths);
+    free(reader->pending);
+    freeBuffer(&reader->values);
+    freeBuffer(&reader->key);
+
+    reader->columns     = NULL;
+    reader->columnCount = 0;
+    reader->line        = NULL;
+    reader->starts      = NULL;
+    reader->lengths     = NULL;
+    reader->slots       = 0;
+    reader->pending     = NULL;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// next line that is not empty without its line ending, -1 at the end of the file
+int nextLine(recordReader *reader)
+{
+    int length;
+
+    while ((length = getline(&reader->line, &reader->lineCapacity, reader->fp)) != -1)
+    {
+        ++reader->lineNumber;
+
+        while (length > 0 && (reader->line[length - 1] == '\n' || reader->line[length - 1] == '\r'))
+        {
+            reader->line[--length] = '\0';
+        }
+        if (length > 0)
+        {
+            return length;
+        }
+    }
+
+    return -1;
+}
+
+void clearValues(recordReader *reader)
+{
+    int i;
+
+    consumeBuffer(&reader->values, bufferLength(&reader->values));
+    for (i = 0; i < reader->slots; ++i)
+    {
+        reader->lengths[i] = -1;
+    }
+}
+
+// the bytes appended to values since start are the value of column
+httpError setValue(recordReader *reader, int column, int start)
+{
+    int i, slots, *starts, *lengths;
+
+    if (column >= reader->slots)
+    {
+        slots   = reader->slots > 0 ? reader->slots * 2 : 16;
+        slots   = slots > column ? slots : column + 1;
+        starts  = realloc(reader->starts, slots * sizeof(int));
+        lengths = starts != NULL ? realloc(reader->lengths, slots * sizeof(int)) : NULL;
+        if (starts != NULL)
+        {
+            reader->starts = starts;
+            countStat(reallocations, 1);
+        }
+        if (lengths == NULL)
+        {
+            return ERR_MEMORY;
+        }
+        reader->lengths = lengths;
+        countStat(reallocations, 1);
+
+        for (i = reader->slots; i < slots; ++i)
+        {
+            reader->lengths[i] = -1;
+        }
+        reader->slots = slots;
+    }
+
+    reader->starts[column]  = start;
+    reader->lengths[column] = bufferLength(&reader->values) - start;
+
+    // every value is a string of its own
+    return appendBuffer(&reader->values, "", 1);
+}
+
+httpError addColumn(recordReader *reader, char *name, int length)
+{
+    char **columns;
+
+    columns = realloc(reader->columns, (reader->columnCount + 1) * sizeof(char *));
+    if (columns == NULL)
+    {
+        return ERR_MEMORY;
+    }
+    countStat(reallocations, 1);
+    reader->columns = columns;
+
+    reader->columns[reader->columnCount] = strndup(name, length);
+    if (reader->columns[reader->columnCount] == NULL)
+    {
+        return ERR_MEMORY;
+    }
+    ++reader->columnCount;
+
+    return HTTP_OK;
+}
+
+httpError parseCsvLine(recordReader *reader, int length, int header)
+{
+    int i, column, start;
+    char *cursor, *end, *fieldEnd;
+    httpError error;
+
+    clearValues(reader);
+    cursor = reader->line;
+    end    = reader->line + length;
+
+    for (column = 0;; ++column)
+    {
+        if (!header && column == reader->columnCount)
+        {
+            logError("%s:%ld has more fields than the %d columns!", reader->path, reader->lineNumber, reader->columnCount);
+
+            return ERR_PARSE;
+        }
+
+        start = bufferLength(&reader->values);
+        if (cursor < end && *cursor == '"')
+        {
+            // a quote is written twice inside a quoted field
+            for (++cursor;; cursor = fieldEnd + 2)
+            {
+                fieldEnd = memchr(cursor, '"', end - cursor);
+                if (fieldEnd == NULL)
+                {
+                    logError("%s:%ld has an unterminated quoted field!", reader->path, reader->lineNumber);
+
+                    return ERR_PARSE;
+                }
+
+                error = appendBuffer(&reader->values, cursor, fieldEnd + 1 < end && fieldEnd[1] == '"' ? fieldEnd + 1 - cursor : fieldEnd - cursor);
+                if (error != HTTP_OK)
+                {
+                    return error;
+                }
+                if (fieldEnd + 1 == end || fieldEnd[1] != '"')
+                {
+                    break;
+                }
+            }
+
+            cursor = fieldEnd + 1;
+            if (cursor < end && *cursor != ',')
+            {
+                logError("%s:%ld has text after a quoted field!", reader->path, reader->lineNumber);
+
+                return ERR_PARSE;
+            }
+        }
+        else
+        {
+            fieldEnd = memchr(cursor, ',', end - cursor);
+            fieldEnd = fieldEnd != NULL ? fieldEnd : end;
+
+            error = appendBuffer(&reader->values, cursor, fieldEnd - cursor);
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            cursor = fieldEnd;
+        }
+
+        error = setValue(reader, column, start);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        if (cursor == end)
+        {
+            break;
+        }
+        // the separator
+        ++cursor;
+    }
+
+    for (i = 0; header && i <= column; ++i)
+    {
+        error = addColumn(reader, bufferData(&reader->values) + reader->starts[i], reader->lengths[i]);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    return HTTP_OK;
+}
+
+httpError parseJsonLine(recordReader *reader, int length, int header)
+{
+    int column, start;
+    char *cursor, *end, *valueEnd;
+    httpError error;
+
+    clearValues(reader);
+    cursor = reader->line;
+    end    = reader->line + length;
+
+    cursor = skipSpaces(cursor, end);
+    if (cursor == end || *cursor != '{')
+    {
+        logError("%s:%ld is not a JSON object!", reader->path, reader->lineNumber);
+
+        return ERR_PARSE;
+    }
+    cursor = skipSpaces(cursor + 1, end);
+
+    while (cursor < end && *cursor != '}')
+    {
+        // KEY
+        consumeBuffer(&reader->key, bufferLength(&reader->key));
+        if (*cursor != '"' || appendJsonString(&reader->key, &cursor, end) != HTTP_OK)
+        {
+            break;
+        }
+
+        column = findColumn(reader, bufferData(&reader->key), bufferLength(&reader->key));
+        if (column == -1 && header)
+        {
+            error = addColumn(reader, bufferData(&reader->key), bufferLength(&reader->key));
+            if (error != HTTP_OK)
+            {
+                return error;
+            }
+            column = reader->columnCount - 1;
+        }
+
+        cursor = skipSpaces(cursor, end);
+        if (cursor == end || *cursor != ':')
+        {
+            break;
+        }
+        cursor = skipSpaces(cursor + 1, end);
+
+        // VALUE, the ones of unknown keys are parsed and left unused
+        start = bufferLength(&reader->values);
+        if (cursor < end && *cursor == '"')
+        {
+            if (appendJsonString(&reader->values, &cursor, end) != HTTP_OK)
+            {
+                break;
+            }
+        }
+        else
+        {
+            valueEnd = skipJsonValue(cursor, end);
+            if (valueEnd == NULL || valueEnd == cursor)
+            {
+                break;
+            }
+
+            if (valueEnd - cursor != 4 || strncmp(cursor, "null", 4) != 0)
+            {
+                error = appendBuffer(&reader->values, cursor, valueEnd - cursor);
+                if (error != HTTP_OK)
+                {
+                    return error;
+                }
+            }
+            cursor = valueEnd;
+        }
+
+        error = column != -1 ? setValue(reader, column, start) : HTTP_OK;
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        cursor = skipSpaces(cursor, end);
+        if (cursor < end && *cursor == ',')
+        {
+            cursor = skipSpaces(cursor + 1, end);
+        }
+        else if (cursor == end || *cursor != '}')
+        {
+            break;
+        }
+    }
+
+    if (cursor == end || *cursor != '}' || skipSpaces(cursor + 1, end) != end)
+    {
+        logError("%s:%ld is not a flat JSON object!", reader->path, reader->lineNumber);
+
+        return ERR_PARSE;
+    }
+
+    return HTTP_OK;
+}
+
+// unescape the string starting at the '"' of cursor, cursor is moved after the closing '"'
+httpError appendJsonString(byteBuffer *buffer, char **cursor, char *end)
+{
+    int step;
+    unsigned int codepoint, low;
+    char *current, *runEnd, escaped[5], *hexEnd, utf8[4];
+    httpError error;
+
+    for (current = *cursor + 1; current < end && *current != '"'; current = runEnd)
+    {
+        for (runEnd = current; runEnd < end && *runEnd != '"' && *runEnd != '\\'; ++runEnd)
+        {
+        }
+
+        error = appendBuffer(buffer, current, runEnd - current);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+        if (runEnd == end || *runEnd == '"')
+        {
+            continue;
+        }
+
+        // ESCAPE
+        if (runEnd + 1 == end)
+        {
+            return ERR_PARSE;
+        }
+
+        step = 2;
+        switch (runEnd[1])
+        {
+        case 'b':
+            error = appendBuffer(buffer, "\b", 1);
+            break;
+        case 'f':
+            error = appendBuffer(buffer, "\f", 1);
+            break;
+        case 'n':
+            error = appendBuffer(buffer, "\n", 1);
+            break;
+        case 'r':
+            error = appendBuffer(buffer, "\r", 1);
+            break;
+        case 't':
+            error = appendBuffer(buffer, "\t", 1);
+            break;
+
+        case 'u':
+            if (end - runEnd < 6)
+            {
+                return ERR_PARSE;
+            }
+            memcpy(escaped, runEnd + 2, 4);
+            escaped[4] = '\0';
+            codepoint  = strtoul(escaped, &hexEnd, 16);
+            if (hexEnd != escaped + 4)
+            {
+                return ERR_PARSE;
+            }
+            step = 6;
+
+            // characters outside the BMP are written as a pair of surrogates
+            if (codepoint >= 0xD800 && codepoint < 0xDC00 && end - runEnd >= 12 && runEnd[6] == '\\' && runEnd[7] == 'u')
+            {
+                memcpy(escaped, runEnd + 8, 4);
+                low = strtoul(escaped, &hexEnd, 16);
+                if (hexEnd == escaped + 4 && low >= 0xDC00 && low < 0xE000)
+                {
+                    codepoint = 0x10000 + ((codepoint - 0xD800) << 10) + (low - 0xDC00);
+                    step      = 12;
+                }
+            }
+
+            error = appendBuffer(buffer, utf8, encodeUtf8(codepoint, utf8));
+            break;
+
+        default:
+            // '"', '\' and '/' stand for themselves
+            error = appendBuffer(buffer, runEnd + 1, 1);
+            break;
+        }
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        runEnd += step;
+    }
+
+    if (current >= end)
+    {
+        return ERR_PARSE;
+    }
+
+    *cursor = current + 1;
+
+    return HTTP_OK;
+}
+
+// end of the number, literal, object or array at cursor, NULL if it does not end on the line
+char *skipJsonValue(char *cursor, char *end)
+{
+    int depth;
+
+    for (depth = 0; cursor < end; ++cursor)
+    {
+        if (*cursor == '"')
+        {
+            // strings can hold brackets and commas
+            for (++cursor; cursor < end && *cursor != '"'; ++cursor)
+            {
+                if (*cursor == '\\')
+                {
+                    ++cursor;
+                }
+            }
+            if (cursor >= end)
+            {
+                return NULL;
+            }
+        }
+        else if (*cursor == '{' || *cursor == '[')
+        {
+            ++depth;
+        }
+        else if (*cursor == '}' || *cursor == ']')
+        {
+            if (depth == 0)
+            {
+                break;
+            }
+            --depth;
+        }
+        else if (depth == 0 && (*cursor == ',' || isspace((unsigned char)*cursor)))
+        {
+            break;
+        }
+    }
+
+    return depth == 0 ? cursor : NULL;
+}
+
+char *skipSpaces(char *cursor, char *end)
+{
+    while (cursor < end && isspace((unsigned char)*cursor))
+    {
+        ++cursor;
+    }
+
+    return cursor;
+}
+
+// @return bytes written in output, at most 4
+int encodeUtf8(unsigned int codepoint, char *output)
+{
+    if (codepoint < 0x80)
+    {
+        output[0] = codepoint;
+
+        return 1;
+    }
+    if (codepoint < 0x800)
+    {
+        output[0] = 0xC0 | (codepoint >> 6);
+        output[1] = 0x80 | (codepoint & 0x3F);
+
+        return 2;
+    }
+    if (codepoint < 0x10000)
+    {
+        output[0] = 0xE0 | (codepoint >> 12);
+        output[1] = 0x80 | ((codepoint >> 6) & 0x3F);
+        output[2] = 0x80 | (codepoint & 0x3F);
+
+        return 3;
+    }
+
+    output[0] = 0xF0 | (codepoint >> 18);
+    output[1] = 0x80 | ((codepoint >> 12) & 0x3F);
+    output[2] = 0x80 | ((codepoint >> 6) & 0x3F);
+    output[3] = 0x80 | (codepoint & 0x3F);
+
+    return 4;
+}
+
+// copy the values of the line in a single allocation, in the order of the columns
+templateRecord *makeRecord(recordReader *reader)
+{
+    int i, size;
+    char *data;
+    templateRecord *record;
+
+    size = sizeof(templateRecord) + reader->columnCount * (sizeof(char *) + sizeof(int)) + bufferLength(&reader->values) + 1;
+    record = malloc(size);
+    if (record == NULL)
+    {
+        return NULL;
+    }
+    countStat(allocations, 1);
+
+    record->count   = reader->columnCount;
+    record->line    = reader->lineNumber;
+    record->values  = (char **)(record + 1);
+    record->lengths = (int *)(record->values + record->count);
+    data            = (char *)(record->lengths + record->count);
+
+    // the values, each followed by its null byte, are copied all at once
+    if (bufferLength(&reader->values) > 0)
+    {
+        memcpy(data, bufferData(&reader->values), bufferLength(&reader->values));
+        countStat(bytesCopied, bufferLength(&reader->values));
+    }
+    data[bufferLength(&reader->values)] = '\0';
+
+    for (i = 0; i < record->count; ++i)
+    {
+        if (i < reader->slots && reader->lengths[i] != -1)
+        {
+            record->values[i]  = data + reader->starts[i];
+            record->lengths[i] = reader->lengths[i];
+        }
+        else
+        {
+            // the null byte after all the values
+            record->values[i]  = data + bufferLength(&reader->values);
+            record->lengths[i] = 0;
+        }
+    }
+
+    return record;
+}
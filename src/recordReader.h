@@ -0,0 +1,62 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+#include <stdio.h>
+
+/** One row of a data file, the values are in the order of the columns */
+typedef struct templateRecord
+{
+    int count;
+    char **values;
+    int *lengths;
+    /** line of the data file, for the error messages */
+    long line;
+} templateRecord;
+
+/**
+ * Reads the rows of a CSV or JSON Lines file one at a time.
+ * CSV files name the columns in their first line, fields can be quoted with
+ * '"' and a quote inside a quoted field is written twice. JSON Lines files
+ * have a flat object per line, the keys of the first one name the columns:
+ * strings are unescaped, any other value is kept as JSON text and null is empty.
+ */
+typedef struct recordReader
+{
+    FILE *fp;
+    char *path;
+    /** 1 for JSON Lines, told apart by the '{' starting the first line */
+    int json;
+
+    char **columns;
+    int columnCount;
+
+    char *line;
+    size_t lineCapacity;
+    long lineNumber;
+
+    // VALUES OF THE LINE BEING PARSED
+    byteBuffer values;
+    /** unescaped JSON key */
+    byteBuffer key;
+    /** offset in values of every column, -1 if the line has none */
+    int *starts;
+    int *lengths;
+    int slots;
+
+    /** first JSON Lines row, parsed early to know the columns */
+    templateRecord *pending;
+} recordReader;
+
+/** Open path, - for stdin, and read the names of the columns */
+httpError openRecords(recordReader *reader, char *path);
+/**
+ * Read the next row, a column the row does not have is an empty value.
+ *
+ * @param record is set to the new row, to free with free(), NULL at the end of the file
+ * @return ERR_PARSE for a malformed line
+ */
+httpError readRecord(recordReader *reader, templateRecord **record);
+/** @return Index of the column called name, -1 if there is none */
+int findColumn(recordReader *reader, char *name, int nameLength);
+void closeRecords(recordReader *reader);
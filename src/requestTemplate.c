@@ -0,0 +1,303 @@
+#include "requestTemplate.h"
+#include "logger.h"
+#include "stats.h"
+#include "utils.h"
+#include <stdlib.h>
+#include <string.h>
+
+httpError addText(requestTemplate *compiled, recordReader *reader, char *text, int placeholders);
+httpError closeSegment(requestTemplate *compiled, int slot);
+int formatLength(long long length, char *output);
+
+httpError compileTemplate(httpRequest *req, recordReader *reader, requestTemplate **compiled)
+{
+    int i;
+    httpHeader *header, *headerLists[2];
+    requestTemplate *newTemplate;
+    httpError error;
+
+    *compiled = NULL;
+
+    if (req->type == FORM || req->type == MULTIPART)
+    {
+        logError("Only text and json bodies can be templates!");
+
+        return ERR_INVALID;
+    }
+
+    newTemplate = calloc(1, sizeof(requestTemplate));
+    if (newTemplate == NULL)
+    {
+        return ERR_MEMORY;
+    }
+    countStat(allocations, 1);
+    initBuffer(&newTemplate->text);
+
+    // REQUEST LINE AND HOST HEADER, the same of buildRequest
+    error = addText(newTemplate, reader, (char *)methodNames[req->method], 0);
+    if (error == HTTP_OK)
+    {
+        error = addText(newTemplate, reader, " ", 0);
+    }
+    if (error == HTTP_OK)
+    {
+        error = addText(newTemplate, reader, req->path, 1);
+    }
+    newTemplate->pathEnd = newTemplate->segmentCount;
+    if (error == HTTP_OK)
+    {
+        error = appendFormat(&newTemplate->text, " HTTP/1.1" CRLF "Host: %s" CRLF, req->host);
+    }
+
+    // HEADERS, Content-Length is left as a slot
+    headerLists[0] = req->generatedHeaders;
+    headerLists[1] = req->headers;
+    for (i = 0; i < 2 && error == HTTP_OK; ++i)
+    {
+        for (header = headerLists[i]; header != NULL && error == HTTP_OK; header = header->next)
+        {
+            if (i == 0 && !strncasecmp(header->line, "Content-Length:", 15))
+            {
+                error = addText(newTemplate, reader, "Content-Length: ", 0);
+                if (error == HTTP_OK)
+                {
+                    error = closeSegment(newTemplate, TEMPLATE_CONTENT_LENGTH);
+                }
+            }
+            else
+            {
+                error = addText(newTemplate, reader, header->line, i == 1);
+            }
+
+            if (error == HTTP_OK)
+            {
+                error = addText(newTemplate, reader, CRLF, 0);
+            }
+        }
+    }
+    if (error == HTTP_OK)
+    {
+        error = addText(newTemplate, reader, CRLF, 0);
+    }
+    if (error == HTTP_OK)
+    {
+        error = closeSegment(newTemplate, TEMPLATE_NO_SLOT);
+    }
+
+    // BODY
+    newTemplate->bodyStart = newTemplate->segmentCount;
+    if (error == HTTP_OK && (req->method == POST || req->method == PUT || req->method == DELETE) && req->text != NULL)
+    {
+        error = addText(newTemplate, reader, req->text, 1);
+        if (error == HTTP_OK)
+        {
+            error = closeSegment(newTemplate, TEMPLATE_NO_SLOT);
+        }
+    }
+
+    if (error != HTTP_OK)
+    {
+        destroyTemplate(newTemplate);
+
+        return error;
+    }
+
+    logVerbose("Request template compiled in %d segments, %d fixed bytes",
+               newTemplate->segmentCount, bufferLength(&newTemplate->text));
+
+    *compiled = newTemplate;
+
+    return HTTP_OK;
+}
+
+httpError fillTemplate(requestTemplate *compiled, templateRecord *record, byteBuffer *payload)
+{
+    int i, size, digitsLength;
+    long long bodyLength;
+    char digits[24], *value;
+    templateSegment *segment;
+    httpError error;
+
+    size       = bufferLength(&compiled->text);
+    bodyLength = 0;
+    for (i = 0; i < compiled->segmentCount; ++i)
+    {
+        segment = &compiled->segments[i];
+        if (i >= compiled->bodyStart)
+        {
+            bodyLength += segment->length;
+        }
+        if (segment->slot < 0)
+        {
+            continue;
+        }
+
+        value = record->values[segment->slot];
+        if (i < compiled->pathEnd)
+        {
+            size += urlEncodedLength(value, record->lengths[segment->slot]);
+
+            continue;
+        }
+
+        size += record->lengths[segment->slot];
+        if (i >= compiled->bodyStart)
+        {
+            bodyLength += record->lengths[segment->slot];
+        }
+        else if (memchr(value, '\r', record->lengths[segment->slot]) != NULL ||
+                 memchr(value, '\n', record->lengths[segment->slot]) != NULL)
+        {
+            logError("Record of line %ld: a line break can not be part of a header!", record->line);
+
+            return ERR_INVALID;
+        }
+    }
+
+    digitsLength = formatLength(bodyLength, digits);
+    size += digitsLength;
+
+    // nothing is moved while filling
+    error = reserveBuffer(payload, size);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
+
+    for (i = 0; i < compiled->segmentCount; ++i)
+    {
+        segment = &compiled->segments[i];
+
+        memcpy(bufferSpace(payload), bufferData(&compiled->text) + segment->offset, segment->length);
+        commitBuffer(payload, segment->length);
+
+        if (segment->slot >= 0 && i < compiled->pathEnd)
+        {
+            commitBuffer(payload, urlEncodeInto(bufferSpace(payload), record->values[segment->slot],
+                                                record->lengths[segment->slot]));
+        }
+        else if (segment->slot >= 0)
+        {
+            memcpy(bufferSpace(payload), record->values[segment->slot], record->lengths[segment->slot]);
+            commitBuffer(payload, record->lengths[segment->slot]);
+        }
+        else if (segment->slot == TEMPLATE_CONTENT_LENGTH)
+        {
+            memcpy(bufferSpace(payload), digits, digitsLength);
+            commitBuffer(payload, digitsLength);
+        }
+    }
+    countStat(bytesCopied, size);
+
+    return HTTP_OK;
+}
+
+void destroyTemplate(requestTemplate *compiled)
+{
+    if (compiled == NULL)
+    {
+        return;
+    }
+
+    freeBuffer(&compiled->text);
+    free(compiled->segments);
+    free(compiled);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// append text to the fixed bytes, with placeholders a segment ends at every {{column}}
+httpError addText(requestTemplate *compiled, recordReader *reader, char *text, int placeholders)
+{
+    int column;
+    char *open, *close, *name, *nameEnd;
+    httpError error;
+
+    while ((open = placeholders ? strstr(text, TEMPLATE_OPEN) : NULL) != NULL &&
+           (close = strstr(open + 2, TEMPLATE_CLOSE)) != NULL)
+    {
+        for (name = open + 2; name < close && *name == ' '; ++name)
+        {
+        }
+        for (nameEnd = close; nameEnd > name && nameEnd[-1] == ' '; --nameEnd)
+        {
+        }
+
+        column = findColumn(reader, name, nameEnd - name);
+        if (column == -1)
+        {
+            logError("'%.*s' is not a column of '%s'!", (int)(nameEnd - name), name, reader->path);
+
+            return ERR_INVALID;
+        }
+
+        error = appendBuffer(&compiled->text, text, open - text);
+        if (error == HTTP_OK)
+        {
+            error = closeSegment(compiled, column);
+        }
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        text = close + 2;
+    }
+
+    // a '{{' without '}}' is not a placeholder
+    return appendBuffer(&compiled->text, text, strlen(text));
+}
+
+// the fixed bytes added since the last segment are followed by slot
+httpError closeSegment(requestTemplate *compiled, int slot)
+{
+    int capacity, start;
+    templateSegment *segments;
+
+    if (compiled->segmentCount == compiled->segmentCapacity)
+    {
+        capacity = compiled->segmentCapacity > 0 ? compiled->segmentCapacity * 2 : 16;
+        segments = realloc(compiled->segments, capacity * sizeof(templateSegment));
+        if (segments == NULL)
+        {
+            return ERR_MEMORY;
+        }
+        countStat(reallocations, 1);
+        compiled->segments        = segments;
+        compiled->segmentCapacity = capacity;
+    }
+
+    start = 0;
+    if (compiled->segmentCount > 0)
+    {
+        start = compiled->segments[compiled->segmentCount - 1].offset + compiled->segments[compiled->segmentCount - 1].length;
+    }
+
+    compiled->segments[compiled->segmentCount].offset = start;
+    compiled->segments[compiled->segmentCount].length = bufferLength(&compiled->text) - start;
+    compiled->segments[compiled->segmentCount].slot   = slot;
+    ++compiled->segmentCount;
+
+    return HTTP_OK;
+}
+
+// decimal digits of length, without the printf machinery
+int formatLength(long long length, char *output)
+{
+    int i, count;
+    char reversed[24];
+
+    count = 0;
+    do
+    {
+        reversed[count++] = '0' + length % 10;
+        length /= 10;
+    } while (length > 0);
+
+    for (i = 0; i < count; ++i)
+    {
+        output[i] = reversed[count - 1 - i];
+    }
+
+    return count;
+}
@@ -0,0 +1,61 @@
+#pragma once
+
+#include "byteBuffer.h"
+#include "httpError.h"
+#include "httpLib.h"
+#include "recordReader.h"
+
+/** the Content-Length value, computed from the body of every request */
+#define TEMPLATE_CONTENT_LENGTH -2
+/** no value follows the bytes of the segment */
+#define TEMPLATE_NO_SLOT -1
+
+#define TEMPLATE_OPEN  "{{"
+#define TEMPLATE_CLOSE "}}"
+
+/** Fixed bytes of the request followed by the value of a slot */
+typedef struct templateSegment
+{
+    /** offset of the bytes in the template text */
+    int offset;
+    int length;
+    /** column of the record, TEMPLATE_CONTENT_LENGTH or TEMPLATE_NO_SLOT */
+    int slot;
+} templateSegment;
+
+/**
+ * Request compiled once and filled with the values of a record for every
+ * send: building a request is only copying bytes, nothing is formatted or
+ * measured again but the Content-Length.
+ * The {{column}} placeholders can be in the path, in the headers and in the
+ * text or json body. The values of the path are url encoded, '/' and '?'
+ * included, the others are copied as they are and those that would end a
+ * header (CR or LF) are refused.
+ */
+typedef struct requestTemplate
+{
+    /** fixed bytes of every segment, one after the other */
+    byteBuffer text;
+    templateSegment *segments;
+    int segmentCount;
+    int segmentCapacity;
+    /** first segment after the path, the values of the ones before are url encoded */
+    int pathEnd;
+    /** first segment of the body, segmentCount if the request has none */
+    int bodyStart;
+} requestTemplate;
+
+/**
+ * Compile the request line, the headers and the body of req, generateHeaders
+ * must have been called. Placeholders are matched with the columns of reader.
+ *
+ * @return ERR_INVALID if a placeholder names no column
+ */
+httpError compileTemplate(httpRequest *req, recordReader *reader, requestTemplate **compiled);
+/**
+ * Write the request for record at the end of payload, in a single reservation.
+ *
+ * @return ERR_INVALID if a value of a header holds CR or LF
+ */
+httpError fillTemplate(requestTemplate *compiled, templateRecord *record, byteBuffer *payload);
+void destroyTemplate(requestTemplate *compiled);
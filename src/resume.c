@@ -0,0 +1,144 @@
+#include "resume.h"
+#include "fileSink.h"
+#include "httpLib.h"
+#include "logger.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char *resumeStatePath(char *path);
+
+long long prepareResume(httpRequest *req, char *path)
+{
+    long long offset;
+    char *statePath, *validator, line[512];
+    struct stat fileInfo;
+    FILE *fp;
+
+    if (stat(path, &fileInfo) == -1 || fileInfo.st_size == 0)
+    {
+        logInfo("No partial download found in '%s', starting from scratch", path);
+
+        return 0;
+    }
+
+    // writes can complete out of order, so the last in flight blocks could be
+    // holes: restart from before the oldest write that might not have landed,
+    // which is the start of a file smaller than all of them
+    offset = fileInfo.st_size - (long long)SINK_BUFFERS * SINK_BUFFER_SIZE;
+    if (offset < 0)
+    {
+        offset = 0;
+    }
+
+    validator = NULL;
+    statePath = resumeStatePath(path);
+    fp        = fopen(statePath, "r");
+    if (fp != NULL)
+    {
+        while (fgets(line, sizeof(line), fp) != NULL)
+        {
+            line[strcspn(line, "\r\n")] = '\0';
+
+            // weak etags cannot be used in If-Range
+            if (strncasecmp(line, "ETag: ", 6) == 0 && strncmp(line + 6, "W/", 2) != 0)
+            {
+                free(validator);
+                validator = strdup(line + 6);
+            }
+            else if (strncasecmp(line, "Last-Modified: ", 15) == 0 && validator == NULL)
+            {
+                validator = strdup(line + 15);
+            }
+        }
+
+        fclose(fp);
+    }
+    free(statePath);
+
+    if (addHeader(req, "Range: bytes=%lld-", offset) != HTTP_OK ||
+        (validator != NULL && addHeader(req, "If-Range: %s", validator) != HTTP_OK))
+    {
+        logPanic("Could not add the resume headers!");
+    }
+
+    if (validator == NULL)
+    {
+        logWarn("No validator saved for '%s', the remote file could have changed!", path);
+    }
+
+    logInfo("Continuing download of '%s' from byte %lld", path, offset);
+
+    free(validator);
+
+    return offset;
+}
+
+void saveResumeState(httpResponse *res, char *path)
+{
+    char *statePath;
+    FILE *fp;
+
+    if (res->etag == NULL && res->lastModified == NULL)
+    {
+        return;
+    }
+
+    statePath = resumeStatePath(path);
+    fp        = fopen(statePath, "w");
+    if (fp == NULL)
+    {
+        logWarn("Could not save '%s', the download will not be resumable", statePath);
+        free(statePath);
+
+        return;
+    }
+
+    if (res->etag != NULL)
+    {
+        fprintf(fp, "ETag: %s\n", res->etag);
+    }
+    if (res->lastModified != NULL)
+    {
+        fprintf(fp, "Last-Modified: %s\n", res->lastModified);
+    }
+
+    fclose(fp);
+    free(statePath);
+}
+
+void clearResumeState(char *path)
+{
+    char *statePath;
+
+    statePath = resumeStatePath(path);
+    if (unlink(statePath) == -1 && errno != ENOENT)
+    {
+        logWarn("Could not remove '%s'", statePath);
+    }
+
+    free(statePath);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+char *resumeStatePath(char *path)
+{
+    char *statePath;
+    int pathLength;
+
+    pathLength = strlen(path);
+    statePath  = malloc(pathLength + RESUME_EXTENSION_LENGTH + 1);
+    if (statePath == NULL)
+    {
+        logPanic("Could not allocate resume state path!");
+    }
+
+    memcpy(statePath, path, pathLength);
+    memcpy(statePath + pathLength, RESUME_EXTENSION, RESUME_EXTENSION_LENGTH + 1);
+
+    return statePath;
+}
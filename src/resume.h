@@ -0,0 +1,23 @@
+#pragma once
+
+#include "httpLib.h"
+
+#define RESUME_EXTENSION        ".resume"
+#define RESUME_EXTENSION_LENGTH 7
+
+/**
+ * Looks for a partial download in path and, if found, adds the Range and
+ * If-Range headers needed to continue it.
+ *
+ * @param req request that will continue the download
+ * @param path the partial output file
+ *
+ * @return Offset the download continues from, 0 to start from scratch
+ */
+long long prepareResume(httpRequest *req, char *path);
+
+/** Save the validators of res next to path, so an interrupted download can be continued */
+void saveResumeState(httpResponse *res, char *path);
+
+/** Remove the validators saved for path once the download is complete */
+void clearResumeState(char *path);
@@ -1,239 +1,1300 @@
 #include "socketUtils.h"
+#include "byteBuffer.h"
+#include "dnsCache.h"
 #include "httpLib.h"
 #include "logger.h"
+#include "probes.h"
+#include "stats.h"
 #include "utils.h"
 #include <arpa/inet.h>
-#include <ctype.h>
-#include <netdb.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <openssl/err.h>
+#include <openssl/ocsp.h>
 #include <openssl/ssl.h>
+#include <openssl/x509v3.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <signal.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <time.h>
 #include <unistd.h>
 
-socketStruct *createSocket(char *host, int secure)
+typedef struct tlsSession
 {
-    int error;
-    struct addrinfo hints, *result, *DNSresult;
-    socketStruct *socketInfo;
-    SSL_CTX *tlsContext;
+    char *host;
+    SSL_SESSION *session;
+    struct tlsSession *next;
+} tlsSession;
 
-    logInfo("Resolving '%s'...", host);
+/** Verified OCSP answer for a server certificate, trusted until the next update */
+typedef struct ocspStatus
+{
+    unsigned char certificate[SHA256_DIGEST_LENGTH];
+    time_t validUntil;
+    int revoked;
+    struct ocspStatus *next;
+} ocspStatus;
+
+/** State of a mock socket, see createMockSocket */
+typedef struct mockReplies
+{
+    char *response;
+    int length;
+    /** where the next read starts in response */
+    int offset;
+} mockReplies;
+
+SSL_CTX *tlsContext      = NULL;
+tlsSession *tlsSessions = NULL;
+ocspStatus *ocspCache   = NULL;
+// guards the creation of the context and the caches, shared by every thread
+pthread_mutex_t tlsLock = PTHREAD_MUTEX_INITIALIZER;
+
+// trust settings of the context, see setTlsTrust
+int verifyPeer  = 1;
+char *trustFile = NULL;
+char *trustPath = NULL;
+
+const char *socketProfileNames[] = {
+    [PROFILE_DEFAULT]     = "default",
+    [PROFILE_LOW_LATENCY] = "low-latency",
+    [PROFILE_BULK]        = "bulk"};
+
+const socketProfile socketProfiles[] = {
+    [PROFILE_DEFAULT]     = {0},
+    [PROFILE_LOW_LATENCY] = {.noDelay = 1, .quickAck = 1, .fastOpen = 1, .busyPoll = 50},
+    // fixed buffers turn off autotuning, so they are sized for high bandwidth-delay paths
+    [PROFILE_BULK] = {.fastOpen = 1, .receiveBuffer = 4 * 1024 * 1024, .sendBuffer = 4 * 1024 * 1024}};
+
+httpError connectTcp(socketStruct *newSocket, char *port, socketProfileName profile);
+httpError connectUnix(socketStruct *newSocket);
+httpError tcpConnect(socketStruct *socketInfo, socketProfileName profile);
+httpError unixConnect(socketStruct *socketInfo, socketProfileName profile);
+int plainRead(socketStruct *socketInfo, char *buffer, int length, int waitAll);
+int plainWrite(socketStruct *socketInfo, char *data, int length);
+int plainWritev(socketStruct *socketInfo, struct iovec *parts, int count);
+int plainPending(socketStruct *socketInfo);
+void plainClose(socketStruct *socketInfo);
+httpError tlsConnect(socketStruct *socketInfo, socketProfileName profile);
+int tlsRead(socketStruct *socketInfo, char *buffer, int length, int waitAll);
+int tlsWrite(socketStruct *socketInfo, char *data, int length);
+int tlsWritev(socketStruct *socketInfo, struct iovec *parts, int count);
+int tlsPending(socketStruct *socketInfo);
+void tlsClose(socketStruct *socketInfo);
+int mockRead(socketStruct *socketInfo, char *buffer, int length, int waitAll);
+int mockWrite(socketStruct *socketInfo, char *data, int length);
+int mockWritev(socketStruct *socketInfo, struct iovec *parts, int count);
+int mockPending(socketStruct *socketInfo);
+void mockClose(socketStruct *socketInfo);
+SSL_CTX *sharedTlsContext();
+SSL_CTX *createTlsContext();
+int loadTrust(SSL_CTX *context);
+httpError checkCertificate(socketStruct *socketInfo, char *host);
+int checkStapledOcsp(SSL *tls, void *data);
+ocspStatus *findOcspStatus(unsigned char *certificate);
+void applyProfile(int descriptor, const socketProfile *profile);
+void setOption(int descriptor, int level, int option, int value, char *optionName);
+void rearmQuickAck(socketStruct *socketInfo);
+tlsSession *findTlsSession(char *host);
+void saveTlsSession(socketStruct *socketInfo);
+
+const socketTransport tcpTransport = {
+    .name       = "plain",
+    .spliceable = 1,
+    .connect    = tcpConnect,
+    .read       = plainRead,
+    .write      = plainWrite,
+    .writev     = plainWritev,
+    .pending    = plainPending,
+    .close      = plainClose};
+
+const socketTransport unixTransport = {
+    .name       = "unix",
+    .spliceable = 1,
+    .connect    = unixConnect,
+    .read       = plainRead,
+    .write      = plainWrite,
+    .writev     = plainWritev,
+    .pending    = plainPending,
+    .close      = plainClose};
+
+// over TCP or over a unix socket
+const socketTransport tlsTransport = {
+    .name    = "secure",
+    .connect = tlsConnect,
+    .read    = tlsRead,
+    .write   = tlsWrite,
+    .writev  = tlsWritev,
+    .pending = tlsPending,
+    .close   = tlsClose};
+
+// only made by createMockSocket
+const socketTransport mockTransport = {
+    .name    = "mock",
+    .read    = mockRead,
+    .write   = mockWrite,
+    .writev  = mockWritev,
+    .pending = mockPending,
+    .close   = mockClose};
+
+httpError createSocket(socketStruct **socketInfo, char *host, int secure, socketProfileName profile, char *unixPath)
+{
+    socketStruct *newSocket;
+    httpError error;
+
+    newSocket = calloc(1, sizeof(socketStruct));
+    if (newSocket == NULL)
+    {
+        logError("Could not allocate socket structure!");
+
+        return ERR_MEMORY;
+    }
+    newSocket->descriptor = -1;
+    newSocket->host       = strdup(host);
+    newSocket->unixPath   = unixPath != NULL ? strdup(unixPath) : NULL;
+    initBuffer(&newSocket->readAhead);
+
+    if (secure)
+    {
+        newSocket->transport = &tlsTransport;
+    }
+    else if (unixPath != NULL)
+    {
+        newSocket->transport = &unixTransport;
+    }
+    else
+    {
+        newSocket->transport = &tcpTransport;
+    }
+
+    if (newSocket->host == NULL || (unixPath != NULL && newSocket->unixPath == NULL))
+    {
+        closeSocket(newSocket);
+
+        return ERR_MEMORY;
+    }
+
+    error = newSocket->transport->connect(newSocket, profile);
+    if (error != HTTP_OK)
+    {
+        closeSocket(newSocket);
+
+        return error;
+    }
+
+    *socketInfo = newSocket;
+
+    return HTTP_OK;
+}
+
+httpError createMockSocket(socketStruct **socketInfo, char *host, char *response, int length)
+{
+    socketStruct *newSocket;
+    mockReplies *replies;
+
+    if (length <= 0)
+    {
+        return ERR_INVALID;
+    }
+
+    newSocket = calloc(1, sizeof(socketStruct));
+    replies   = calloc(1, sizeof(mockReplies));
+    if (newSocket == NULL || replies == NULL)
+    {
+        free(newSocket);
+        free(replies);
+
+        return ERR_MEMORY;
+    }
+    newSocket->descriptor = -1;
+    newSocket->transport  = &mockTransport;
+    newSocket->state      = replies;
+    newSocket->host       = strdup(host);
+    replies->response     = malloc(length);
+    replies->length       = length;
+    initBuffer(&newSocket->readAhead);
+
+    if (newSocket->host == NULL || replies->response == NULL)
+    {
+        closeSocket(newSocket);
+
+        return ERR_MEMORY;
+    }
+    memcpy(replies->response, response, length);
+
+    *socketInfo = newSocket;
+
+    return HTTP_OK;
+}
+
+httpError setTlsTrust(char *caFile, char *caPath, int verify)
+{
+    pthread_mutex_lock(&tlsLock);
+    if (tlsContext != NULL)
+    {
+        pthread_mutex_unlock(&tlsLock);
+        logError("The trusted certificates can only be set before the first TLS connection!");
+
+        return ERR_INVALID;
+    }
+
+    free(trustFile);
+    free(trustPath);
+    trustFile  = caFile != NULL ? strdup(caFile) : NULL;
+    trustPath  = caPath != NULL ? strdup(caPath) : NULL;
+    verifyPeer = verify;
+    pthread_mutex_unlock(&tlsLock);
+
+    return (caFile != NULL && trustFile == NULL) || (caPath != NULL && trustPath == NULL) ? ERR_MEMORY : HTTP_OK;
+}
+
+void closeSocket(socketStruct *socketInfo)
+{
+    socketInfo->transport->close(socketInfo);
+
+    freeBuffer(&socketInfo->readAhead);
+    free(socketInfo->host);
+    free(socketInfo->unixPath);
+    free(socketInfo);
+}
+
+httpError sendMessage(socketStruct *socketInfo, char *message, int length)
+{
+    int step, sent;
+
+    logVerbose("Sending %s message \n"
+               "%.*s \n"
+               "of size %d!",
+               socketInfo->transport->name,
+               length, message,
+               length);
+
+    socketInfo->quickAckArmed = 0;
+    traceProbe(send_start, socketInfo->host, length);
+    for (sent = 0; sent < length; sent += step)
+    {
+        step = throttle(socketInfo->limiter, length - sent);
+        step = socketInfo->transport->write(socketInfo, message + sent, step);
+        if (step <= 0)
+        {
+            logDebug("Message send failed! Message: \n%.*s", length, message);
+            logError("Could not send %s message!", socketInfo->transport->name);
+            traceProbe(send_done, socketInfo->host, -1);
+
+            return ERR_SEND;
+        }
+    }
+    traceProbe(send_done, socketInfo->host, sent);
+
+    return HTTP_OK;
+}
+
+httpError sendVector(socketStruct *socketInfo, struct iovec *parts, int count)
+{
+    int i, length, sent;
+    httpError error;
+
+    // paced sockets send the parts one at a time, each in slices
+    if (socketInfo->limiter != NULL)
+    {
+        for (i = 0, error = HTTP_OK; i < count && error == HTTP_OK; ++i)
+        {
+            error = sendMessage(socketInfo, parts[i].iov_base, parts[i].iov_len);
+        }
+
+        return error;
+    }
+
+    for (i = 0, length = 0; i < count; ++i)
+    {
+        length += parts[i].iov_len;
+    }
+    logVerbose("Sending %s message of size %d in %d parts!", socketInfo->transport->name, length, count);
+
+    socketInfo->quickAckArmed = 0;
+    traceProbe(send_start, socketInfo->host, length);
+    while (count > 0)
+    {
+        sent = socketInfo->transport->writev(socketInfo, parts, count);
+        if (sent <= 0)
+        {
+            logError("Could not send %s message!", socketInfo->transport->name);
+            traceProbe(send_done, socketInfo->host, -1);
+
+            return ERR_SEND;
+        }
+
+        // skip what was sent, the rest goes with the next call
+        for (; count > 0 && sent >= (int)parts->iov_len; ++parts, --count)
+        {
+            sent -= parts->iov_len;
+        }
+        if (count > 0)
+        {
+            parts->iov_base = (char *)parts->iov_base + sent;
+            parts->iov_len -= sent;
+        }
+    }
+    traceProbe(send_done, socketInfo->host, length);
+
+    return HTTP_OK;
+}
+
+httpError readInto(socketStruct *socketInfo, char *buffer, int size)
+{
+    int readSize, step, lastRead, stepRead;
+
+    // bytes already read ahead come first
+    readSize = bufferLength(&socketInfo->readAhead) < size ? bufferLength(&socketInfo->readAhead) : size;
+    if (readSize > 0)
+    {
+        memcpy(buffer, bufferData(&socketInfo->readAhead), readSize);
+        consumeBuffer(&socketInfo->readAhead, readSize);
+        countStat(bytesCopied, readSize);
+    }
+
+    for (; readSize < size; readSize += step)
+    {
+        step = throttle(socketInfo->limiter, size - readSize);
+
+        rearmQuickAck(socketInfo);
+
+        // plain sockets fill the step in one call, a TLS record can be smaller
+        for (stepRead = 0; stepRead < step; stepRead += lastRead)
+        {
+            lastRead = socketInfo->transport->read(socketInfo, buffer + readSize + stepRead, step - stepRead, 1);
+            if (lastRead == 0)
+            {
+                logError("Connection closed while reading message of %.2f KB!", size / 1024.0);
+                traceProbe(read_done, socketInfo->host, readSize + stepRead, ERR_CLOSED);
+
+                return ERR_CLOSED;
+            }
+            else if (lastRead == -1)
+            {
+                logError("Error while reading message of %.2f KB from %s socket!", size / 1024.0, socketInfo->transport->name);
+                traceProbe(read_done, socketInfo->host, readSize + stepRead, ERR_RECIVE);
+
+                return ERR_RECIVE;
+            }
+        }
+    }
+    traceProbe(read_done, socketInfo->host, size, HTTP_OK);
+
+    return HTTP_OK;
+}
+
+httpError readAvailable(socketStruct *socketInfo)
+{
+    int step, lastRead;
+    httpError error;
+
+    error = reserveBuffer(&socketInfo->readAhead, READ_AHEAD_SIZE);
+    if (error != HTTP_OK)
+    {
+        return error;
+    }
 
-    socketInfo = calloc(1, sizeof(socketInfo));
+    step = throttle(socketInfo->limiter, READ_AHEAD_SIZE);
 
-    // setup structs for DNS request
-    memset(&hints, 0, sizeof(hints));
-    hints.ai_family   = AF_INET;
-    hints.ai_socktype = SOCK_STREAM;
-    DNSresult         = NULL;
+    rearmQuickAck(socketInfo);
 
-    error = getaddrinfo(host, (secure ? HTTPS_PORT : HTTP_PORT), &hints, &DNSresult);
-    if (error)
+    lastRead = socketInfo->transport->read(socketInfo, bufferSpace(&socketInfo->readAhead), step, 0);
+    if (lastRead <= 0)
     {
-        logPanic("Could not resolve '%s'!", host);
+        // a close can be the end of a body, the caller tells if it was expected
+        if (lastRead == -1)
+        {
+            logError("Error while reading from %s socket!", socketInfo->transport->name);
+        }
+        traceProbe(read_done, socketInfo->host, 0, lastRead == 0 ? ERR_CLOSED : ERR_RECIVE);
+
+        return lastRead == 0 ? ERR_CLOSED : ERR_RECIVE;
     }
+    commitBuffer(&socketInfo->readAhead, lastRead);
+    traceProbe(read_done, socketInfo->host, lastRead, HTTP_OK);
+
+    return HTTP_OK;
+}
+
+httpError readAvailableWithin(socketStruct *socketInfo, int *timeout)
+{
+    int flags, step, lastRead;
+    long long deadline, left;
+    struct timespec now;
+    struct pollfd watched;
+    httpError error;
 
-    for (result = DNSresult; result != NULL; result = result->ai_next)
+    error = reserveBuffer(&socketInfo->readAhead, READ_AHEAD_SIZE);
+    if (error != HTTP_OK)
     {
-        logVerbose("Resolved '%s' to '%s'",
-                   host,
-                   inet_ntoa(((struct sockaddr_in *)result->ai_addr)->sin_addr));
+        return error;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    deadline = now.tv_sec * 1000LL + now.tv_nsec / 1000000 + *timeout;
 
-        socketInfo->descriptor = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
-        if (socketInfo->descriptor == -1)
+    // a TLS record without data, like a session ticket, makes the descriptor readable too
+    flags = fcntl(socketInfo->descriptor, F_GETFL);
+    if (flags != -1)
+    {
+        fcntl(socketInfo->descriptor, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    step           = throttle(socketInfo->limiter, READ_AHEAD_SIZE);
+    watched.fd     = socketInfo->descriptor;
+    watched.events = POLLIN;
+    while (1)
+    {
+        lastRead = socketInfo->transport->read(socketInfo, bufferSpace(&socketInfo->readAhead), step, 0);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        left = deadline - (now.tv_sec * 1000LL + now.tv_nsec / 1000000);
+        if (lastRead > 0)
+        {
+            commitBuffer(&socketInfo->readAhead, lastRead);
+            *timeout = left > 0 ? left : 1;
+
+            break;
+        }
+        else if (lastRead == 0)
+        {
+            error = ERR_CLOSED;
+
+            break;
+        }
+        else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)
+        {
+            logError("Error while reading from %s socket!", socketInfo->transport->name);
+            error = ERR_RECIVE;
+
+            break;
+        }
+
+        if (left <= 0)
+        {
+            *timeout = 0;
+
+            break;
+        }
+
+        if (socketInfo->transport->pending(socketInfo) == 0 && poll(&watched, 1, left) == -1 && errno != EINTR)
+        {
+            error = ERR_RECIVE;
+
+            break;
+        }
+    }
+
+    if (flags != -1)
+    {
+        fcntl(socketInfo->descriptor, F_SETFL, flags);
+    }
+    traceProbe(read_done, socketInfo->host, lastRead > 0 ? lastRead : 0, error);
+
+    return error;
+}
+
+void blockSigpipe(sigset_t *oldMask)
+{
+    sigset_t pipeMask;
+
+    sigemptyset(&pipeMask);
+    sigaddset(&pipeMask, SIGPIPE);
+    pthread_sigmask(SIG_BLOCK, &pipeMask, oldMask);
+}
+
+void restoreSigpipe(sigset_t *oldMask)
+{
+    sigset_t pipeMask, pending;
+    struct timespec noWait = {0, 0};
+
+    sigemptyset(&pipeMask);
+    sigaddset(&pipeMask, SIGPIPE);
+
+    sigpending(&pending);
+    if (sigismember(&pending, SIGPIPE) && !sigismember(oldMask, SIGPIPE))
+    {
+        sigtimedwait(&pipeMask, NULL, &noWait);
+    }
+
+    pthread_sigmask(SIG_SETMASK, oldMask, NULL);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// resolve host and connect to the first address that accepts
+httpError connectTcp(socketStruct *newSocket, char *port, socketProfileName profile)
+{
+    int i, count, connected;
+    char *host, address[INET_ADDRSTRLEN];
+    struct sockaddr_in *addresses;
+    httpError error;
+
+    host = newSocket->host;
+    logInfo("Resolving '%s'...", host);
+
+    // an answer prefetched or cached by another connection is used at once
+    traceProbe(dns_start, host);
+    error = resolveHost(host, port, &addresses, &count);
+    traceProbe(dns_done, host, error);
+    if (error != HTTP_OK)
+    {
+        logError("Could not resolve '%s'!", host);
+
+        return error;
+    }
+
+    for (i = 0; i < count; ++i)
+    {
+        // inet_ntoa returns a static buffer, not safe with other threads connecting
+        inet_ntop(AF_INET, &addresses[i].sin_addr, address, sizeof(address));
+        logVerbose("Resolved '%s' to '%s'", host, address);
+
+        newSocket->descriptor = socket(AF_INET, SOCK_STREAM, 0);
+        if (newSocket->descriptor == -1)
         {
             logWarn("Could not create socket, trying next address...");
 
             continue;
         }
 
-        if (connect(socketInfo->descriptor, result->ai_addr, result->ai_addrlen) != -1)
+        // buffer sizes must be set before connecting to affect the window scale
+        applyProfile(newSocket->descriptor, &socketProfiles[profile]);
+        newSocket->quickAck = socketProfiles[profile].quickAck;
+
+        traceProbe(connect_start, host, address);
+        connected = connect(newSocket->descriptor, (struct sockaddr *)&addresses[i], sizeof(struct sockaddr_in)) != -1;
+        traceProbe(connect_done, host, connected);
+        if (connected)
         {
             logInfo("Socket created and connected to '%s'!", host);
 
             break;
         }
 
-        logWarn("Could not connect to '%s', trying next address...",
-                inet_ntoa(((struct sockaddr_in *)result->ai_addr)->sin_addr));
+        logWarn("Could not connect to '%s', trying next address...", address);
+
+        close(newSocket->descriptor);
+        newSocket->descriptor = -1;
+    }
+
+    free(addresses);
+    if (newSocket->descriptor == -1)
+    {
+        logError("Could not create and connect socket to '%s'!", host);
+
+        return ERR_CONNECT;
+    }
+
+    return HTTP_OK;
+}
+
+// connect to a unix socket, @name is in the abstract namespace
+httpError connectUnix(socketStruct *newSocket)
+{
+    int connected, pathLength;
+    char *path = newSocket->unixPath;
+    socklen_t addressLength;
+    struct sockaddr_un address;
+
+    pathLength = strlen(path);
+    if (pathLength == 0 || pathLength >= (int)sizeof(address.sun_path))
+    {
+        logError("Invalid unix socket path '%s'!", path);
+
+        return ERR_INVALID;
+    }
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    memcpy(address.sun_path, path, pathLength);
+    // abstract names are not null terminated, the length tells where they end
+    addressLength = offsetof(struct sockaddr_un, sun_path) + pathLength + (path[0] != '@');
+    if (path[0] == '@')
+    {
+        address.sun_path[0] = '\0';
+    }
+
+    newSocket->descriptor = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (newSocket->descriptor == -1)
+    {
+        logError("Could not create unix socket!");
+
+        return ERR_CONNECT;
+    }
+
+    // the TCP options of the profiles mean nothing here
+    traceProbe(connect_start, newSocket->host, path);
+    connected = connect(newSocket->descriptor, (struct sockaddr *)&address, addressLength) != -1;
+    traceProbe(connect_done, newSocket->host, connected);
+    if (!connected)
+    {
+        logError("Could not connect to unix socket '%s': %s", path, strerror(errno));
+
+        return ERR_CONNECT;
+    }
+
+    logInfo("Socket connected to '%s' for '%s'!", path, newSocket->host);
+
+    return HTTP_OK;
+}
+
+void applyProfile(int descriptor, const socketProfile *profile)
+{
+    if (profile->noDelay)
+    {
+        setOption(descriptor, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+    if (profile->quickAck)
+    {
+        setOption(descriptor, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+    }
+    // connect returns at once and the first write goes out with the SYN,
+    // the kernel falls back to a normal handshake if the server has no cookie
+    if (profile->fastOpen)
+    {
+        setOption(descriptor, IPPROTO_TCP, TCP_FASTOPEN_CONNECT, 1, "TCP_FASTOPEN_CONNECT");
+    }
+    if (profile->receiveBuffer)
+    {
+        setOption(descriptor, SOL_SOCKET, SO_RCVBUF, profile->receiveBuffer, "SO_RCVBUF");
+    }
+    if (profile->sendBuffer)
+    {
+        setOption(descriptor, SOL_SOCKET, SO_SNDBUF, profile->sendBuffer, "SO_SNDBUF");
+    }
+    if (profile->busyPoll)
+    {
+        setOption(descriptor, SOL_SOCKET, SO_BUSY_POLL, profile->busyPoll, "SO_BUSY_POLL");
+    }
+}
+
+// options are only hints, an old kernel or missing privileges are not fatal
+void setOption(int descriptor, int level, int option, int value, char *optionName)
+{
+    if (setsockopt(descriptor, level, option, &value, sizeof(value)) == -1)
+    {
+        logVerbose("Could not set %s on the socket: %s", optionName, strerror(errno));
+    }
+}
+
+// once per message sent, not a setsockopt for every read of the answer
+void rearmQuickAck(socketStruct *socketInfo)
+{
+    if (socketInfo->quickAck && !socketInfo->quickAckArmed)
+    {
+        setOption(socketInfo->descriptor, IPPROTO_TCP, TCP_QUICKACK, 1, "TCP_QUICKACK");
+        socketInfo->quickAckArmed = 1;
+    }
+}
+
+httpError tcpConnect(socketStruct *socketInfo, socketProfileName profile)
+{
+    return connectTcp(socketInfo, HTTP_PORT, profile);
+}
 
+httpError unixConnect(socketStruct *socketInfo, socketProfileName profile)
+{
+    return connectUnix(socketInfo);
+}
+
+int plainRead(socketStruct *socketInfo, char *buffer, int length, int waitAll)
+{
+    int lastRead;
+
+    lastRead = recv(socketInfo->descriptor, buffer, length, waitAll ? MSG_WAITALL : 0);
+    countStat(recvCalls, 1);
+
+    return lastRead;
+}
+
+int plainWrite(socketStruct *socketInfo, char *data, int length)
+{
+    countStat(sendCalls, 1);
+
+    return send(socketInfo->descriptor, data, length, MSG_NOSIGNAL);
+}
+
+int plainWritev(socketStruct *socketInfo, struct iovec *parts, int count)
+{
+    struct msghdr message;
+
+    memset(&message, 0, sizeof(message));
+    message.msg_iov    = parts;
+    message.msg_iovlen = count;
+    countStat(sendCalls, 1);
+
+    return sendmsg(socketInfo->descriptor, &message, MSG_NOSIGNAL);
+}
+
+// nothing is kept in user space, poll tells the rest
+int plainPending(socketStruct *socketInfo)
+{
+    return 0;
+}
+
+void plainClose(socketStruct *socketInfo)
+{
+    if (socketInfo->descriptor != -1)
+    {
         close(socketInfo->descriptor);
     }
+}
 
-    freeaddrinfo(DNSresult);
-    if (socketInfo->descriptor == -1)
+httpError tlsConnect(socketStruct *socketInfo, socketProfileName profile)
+{
+    int result;
+    tlsSession *cachedSession;
+    httpError error;
+
+    error = socketInfo->unixPath != NULL ? connectUnix(socketInfo) : connectTcp(socketInfo, HTTPS_PORT, profile);
+    if (error != HTTP_OK)
     {
-        logPanic("Could not create and connect socket to '%s'!", host);
+        return error;
     }
 
-    // now TCP socket is created and connected
+    if (sharedTlsContext() == NULL)
+    {
+        return ERR_TLS;
+    }
 
-    if (secure)
+    socketInfo->tls = SSL_new(tlsContext);
+    if (socketInfo->tls == NULL)
+    {
+        logError("Could not initialize secure socket!");
+
+        return ERR_TLS;
+    }
+
+    // the descriptor stays in socketInfo too, to poll it
+    if (!SSL_set_fd(socketInfo->tls, socketInfo->descriptor))
     {
-        SSL_load_error_strings();
-        ERR_load_crypto_strings();
+        logError("Could not bind socket descriptor to secure socket!");
+
+        return ERR_TLS;
+    }
 
-        // called TlsContext because we only accept TLS 1.2 or up
-        tlsContext = SSL_CTX_new(TLS_client_method());
-        if (tlsContext == NULL)
+    // SNI, most virtual hosts refuse the handshake without it
+    SSL_set_tlsext_host_name(socketInfo->tls, socketInfo->host);
+
+    if (verifyPeer)
+    {
+        error = checkCertificate(socketInfo, socketInfo->host);
+        if (error != HTTP_OK)
         {
-            logPanic("Could not initialize secure context!");
+            return error;
         }
+    }
 
-        if (!SSL_CTX_set_min_proto_version(tlsContext, TLS1_2_VERSION))
+    // the session can be replaced by another thread as soon as the lock is released,
+    // SSL_set_session takes its own reference
+    pthread_mutex_lock(&tlsLock);
+    cachedSession = findTlsSession(socketInfo->host);
+    if (cachedSession != NULL)
+    {
+        SSL_set_session(socketInfo->tls, cachedSession->session);
+    }
+    pthread_mutex_unlock(&tlsLock);
+
+    traceProbe(tls_start, socketInfo->host);
+    result = SSL_connect(socketInfo->tls);
+    traceProbe(tls_done, socketInfo->host, result, SSL_session_reused(socketInfo->tls));
+    if (result <= 0)
+    {
+        if (verifyPeer && SSL_get_verify_result(socketInfo->tls) != X509_V_OK)
         {
-            logPanic("Could not set TLS1.2 as minimum version!");
+            logError("Certificate of '%s' not trusted: %s", socketInfo->host,
+                     X509_verify_cert_error_string(SSL_get_verify_result(socketInfo->tls)));
+
+            return ERR_CERTIFICATE;
         }
 
-        socketInfo->tls = SSL_new(tlsContext);
-        if (tlsContext == NULL)
+        // refused by checkStapledOcsp, the reason is already logged
+        if (ERR_GET_REASON(ERR_peek_error()) == SSL_R_INVALID_STATUS_RESPONSE)
         {
-            logPanic("Could not initialize secure socket!");
+            return ERR_CERTIFICATE;
         }
 
-        if (!SSL_set_fd(socketInfo->tls, socketInfo->descriptor))
+        logDebug("SSL_connect error: '%s'", ERR_reason_error_string(ERR_get_error()));
+        logError("Could not connect secure socket!");
+
+        return ERR_TLS;
+    }
+
+    logVerbose("TLS session %s", SSL_session_reused(socketInfo->tls) ? "resumed" : "negotiated");
+
+    return HTTP_OK;
+}
+
+// one record at most, waitAll is left to the caller
+int tlsRead(socketStruct *socketInfo, char *buffer, int length, int waitAll)
+{
+    int lastRead, error;
+
+    lastRead = SSL_read(socketInfo->tls, buffer, length);
+    countStat(sslReads, 1);
+    if (lastRead <= 0)
+    {
+        error = SSL_get_error(socketInfo->tls, lastRead);
+        if (error == SSL_ERROR_ZERO_RETURN)
         {
-            logPanic("Could not bind socket descriptor to secure socket!");
+            return 0;
         }
 
-        error = SSL_connect(socketInfo->tls);
-        if (error < 0)
+        // nothing but protocol records on a descriptor that does not block, told like recv does
+        if (error == SSL_ERROR_WANT_READ || error == SSL_ERROR_WANT_WRITE)
         {
-            logDebug("SSL_connect error: '%s'", ERR_reason_error_string(ERR_get_error()));
-            logPanic("Could not connect secure socket!");
+            errno = EAGAIN;
+        }
+        else if (error == SSL_ERROR_SSL)
+        {
+            errno = EPROTO;
         }
 
-        socketInfo->descriptor = -1;
+        return -1;
     }
 
-    return socketInfo;
+    return lastRead;
 }
 
-void closeSocket(socketStruct *socketInfo)
+int tlsWrite(socketStruct *socketInfo, char *data, int length)
+{
+    int written;
+
+    written = SSL_write(socketInfo->tls, data, length);
+    countStat(sslWrites, 1);
+
+    return written > 0 ? written : -1;
+}
+
+// records are encrypted one by one anyway, the parts are written in turn
+int tlsWritev(socketStruct *socketInfo, struct iovec *parts, int count)
+{
+    int i, written;
+
+    written = 0;
+    for (i = 0; i < count; ++i)
+    {
+        if (parts[i].iov_len > 0 && tlsWrite(socketInfo, parts[i].iov_base, parts[i].iov_len) == -1)
+        {
+            return written > 0 ? written : -1;
+        }
+        written += parts[i].iov_len;
+    }
+
+    return written;
+}
+
+// decrypted bytes the descriptor no longer shows
+int tlsPending(socketStruct *socketInfo)
+{
+    return SSL_pending(socketInfo->tls);
+}
+
+void tlsClose(socketStruct *socketInfo)
 {
+    sigset_t oldMask;
+
     if (socketInfo->tls != NULL)
     {
+        saveTlsSession(socketInfo);
+
+        blockSigpipe(&oldMask);
         SSL_shutdown(socketInfo->tls);
+        restoreSigpipe(&oldMask);
         SSL_free(socketInfo->tls);
     }
-    else
+
+    plainClose(socketInfo);
+}
+
+// the response starts over at its end, waitAll is always met
+int mockRead(socketStruct *socketInfo, char *buffer, int length, int waitAll)
+{
+    int step, copied;
+    mockReplies *replies = socketInfo->state;
+
+    for (copied = 0; copied < length; copied += step)
     {
-        close(socketInfo->descriptor);
+        step = replies->length - replies->offset;
+        step = step < length - copied ? step : length - copied;
+        memcpy(buffer + copied, replies->response + replies->offset, step);
+
+        replies->offset = (replies->offset + step) % replies->length;
     }
 
-    free(socketInfo);
+    return length;
 }
 
-void sendMessage(socketStruct *socketInfo, char *message, int length)
+int mockWrite(socketStruct *socketInfo, char *data, int length)
 {
-    logVerbose("Sending %s \n"
-               "%.*s \n"
-               "of size %d!",
-               socketInfo->descriptor != -1 ? "message" : "secure message",
-               length, message,
-               length);
+    return length;
+}
+
+int mockWritev(socketStruct *socketInfo, struct iovec *parts, int count)
+{
+    int i, written;
 
-    if (socketInfo->descriptor != -1 &&
-        send(socketInfo->descriptor, message, length, 0) == -1)
+    for (i = 0, written = 0; i < count; ++i)
     {
-        logDebug("Message send failed! Message: \n%.*s", length, message);
-        logPanic("Could not send message!");
+        written += parts[i].iov_len;
     }
-    else if (socketInfo->tls != NULL &&
-             SSL_write(socketInfo->tls, message, length) <= 0)
+
+    return written;
+}
+
+int mockPending(socketStruct *socketInfo)
+{
+    return 1;
+}
+
+void mockClose(socketStruct *socketInfo)
+{
+    mockReplies *replies = socketInfo->state;
+
+    if (replies != NULL)
     {
-        logDebug("Message send failed! Message: \n%.*s", length, message);
-        logPanic("Could not send secure message!");
+        free(replies->response);
+        free(replies);
     }
 }
 
-char *readSize(socketStruct *socketInfo, int size)
+// the context loads the error strings and settings once for the whole process
+SSL_CTX *sharedTlsContext()
 {
-    int readSize;
-    char *buffer;
+    SSL_CTX *context;
+
+    pthread_mutex_lock(&tlsLock);
+    context = createTlsContext();
+    pthread_mutex_unlock(&tlsLock);
+
+    return context;
+}
 
-    readSize = 0;
-    buffer   = malloc(size);
-    if (buffer == NULL)
+// called with tlsLock held
+SSL_CTX *createTlsContext()
+{
+    if (tlsContext != NULL)
     {
-        logPanic("Could not allocate buffer to recive message of %.2f KB", size / 1024);
+        return tlsContext;
     }
 
-    if (socketInfo->descriptor != -1)
+    SSL_load_error_strings();
+    ERR_load_crypto_strings();
+
+    // called TlsContext because we only accept TLS 1.2 or up
+    tlsContext = SSL_CTX_new(TLS_client_method());
+    if (tlsContext == NULL)
     {
-        readSize = recv(socketInfo->descriptor, buffer, size, MSG_WAITALL);
+        logError("Could not initialize secure context!");
+
+        return NULL;
+    }
+
+    if (!SSL_CTX_set_min_proto_version(tlsContext, TLS1_2_VERSION))
+    {
+        logError("Could not set TLS1.2 as minimum version!");
+        SSL_CTX_free(tlsContext);
+        tlsContext = NULL;
+
+        return NULL;
+    }
+
+    SSL_CTX_set_session_cache_mode(tlsContext, SSL_SESS_CACHE_CLIENT);
 
-        if (readSize == -1 || readSize != size)
+    if (verifyPeer)
+    {
+        if (!loadTrust(tlsContext))
         {
-            logPanic("Error while reading message of %.2f KB from socket!", size / 1024);
+            SSL_CTX_free(tlsContext);
+            tlsContext = NULL;
+
+            return NULL;
         }
+
+        SSL_CTX_set_verify(tlsContext, SSL_VERIFY_PEER, NULL);
+        SSL_CTX_set_tlsext_status_cb(tlsContext, checkStapledOcsp);
     }
     else
     {
-        do
+        logWarn("Server certificates are not verified!");
+    }
+
+    return tlsContext;
+}
+
+// called with tlsLock held, 0 if no certificate could be trusted
+int loadTrust(SSL_CTX *context)
+{
+    const char *directory;
+
+    if (trustFile != NULL || trustPath != NULL)
+    {
+        if (!SSL_CTX_load_verify_locations(context, trustFile, trustPath))
         {
-            readSize += SSL_read(socketInfo->tls, buffer + readSize, size - readSize);
+            logError("Could not load the trusted certificates from '%s'!", trustFile != NULL ? trustFile : trustPath);
 
-            logDebug("Read %d/%d from secure socket", readSize, size);
+            return 0;
+        }
 
-            if (readSize <= 0)
-            {
-                logPanic("Error while reading message of %.2f KB from socket!", size / 1024);
-            }
+        return 1;
+    }
 
-        } while (readSize != size);
+    // the hashed directory is looked up by issuer, only the certificates of the
+    // chains actually seen are parsed instead of the whole system bundle
+    directory = getenv(X509_get_default_cert_dir_env());
+    if (directory == NULL)
+    {
+        directory = X509_get_default_cert_dir();
+    }
+    if (access(directory, R_OK | X_OK) == 0)
+    {
+        logDebug("Trusting the certificates in '%s'", directory);
+
+        return SSL_CTX_set_default_verify_dir(context);
+    }
+
+    logDebug("Trusting the certificates in '%s'", X509_get_default_cert_file());
+    if (!SSL_CTX_set_default_verify_file(context))
+    {
+        logError("Could not load the system trusted certificates!");
+
+        return 0;
     }
 
-    return buffer;
+    return 1;
 }
 
-char *readUntilString(socketStruct *socketInfo, char *target, int targetLength, int caseInsensitive)
+// the certificate must be for host, and its OCSP status is asked to the server
+httpError checkCertificate(socketStruct *socketInfo, char *host)
 {
-    int bufferSize, readSize, targetOffset, notFound;
-    char *buffer;
+    int isAddress;
+    unsigned char address[sizeof(struct in6_addr)];
 
-    buffer     = NULL;
-    bufferSize = readSize = 0;
-    notFound              = 1;
-    do
+    isAddress = inet_pton(AF_INET, host, address) == 1 || inet_pton(AF_INET6, host, address) == 1;
+    if (isAddress ? !X509_VERIFY_PARAM_set1_ip_asc(SSL_get0_param(socketInfo->tls), host)
+                  : !SSL_set1_host(socketInfo->tls, host))
     {
-        // if buffer full we increase it (-1 to leave space for null termination)
-        if ((bufferSize - 1) == readSize || bufferSize == 0)
+        logError("Could not set '%s' as the name to verify!", host);
+
+        return ERR_CERTIFICATE;
+    }
+
+    SSL_set_tlsext_status_type(socketInfo->tls, TLSEXT_STATUSTYPE_ocsp);
+
+    return HTTP_OK;
+}
+
+/**
+ * Check the OCSP response stapled to the handshake, 0 to abort it.
+ * A server that staples nothing is accepted, a revoked certificate or a
+ * response that does not verify is not. Verified answers are cached until
+ * their next update, so the handshakes that follow skip the signature check.
+ */
+int checkStapledOcsp(SSL *tls, void *data)
+{
+    int i, status, revoked;
+    long length;
+    unsigned int digestLength;
+    unsigned char certificate[SHA256_DIGEST_LENGTH];
+    const unsigned char *response;
+    time_t validUntil;
+    struct tm nextTime;
+    X509 *leaf, *issuer;
+    STACK_OF(X509) *chain, *verified;
+    OCSP_RESPONSE *ocspResponse;
+    OCSP_BASICRESP *basic;
+    OCSP_CERTID *id;
+    ASN1_GENERALIZEDTIME *thisUpdate, *nextUpdate;
+    ocspStatus *cached;
+
+    thisUpdate = nextUpdate = NULL;
+
+    leaf = SSL_get0_peer_certificate(tls);
+    if (leaf == NULL || !X509_digest(leaf, EVP_sha256(), certificate, &digestLength))
+    {
+        return 1;
+    }
+
+    pthread_mutex_lock(&tlsLock);
+    cached  = findOcspStatus(certificate);
+    revoked = cached != NULL && cached->validUntil > time(NULL) ? cached->revoked : -1;
+    pthread_mutex_unlock(&tlsLock);
+    if (revoked != -1)
+    {
+        logDebug("OCSP status from cache: %s", revoked ? "revoked" : "good");
+        if (revoked)
         {
-            buffer = increaseBuffer(buffer, &bufferSize, bufferSize + 1);
+            logError("Certificate of the server is revoked!");
         }
 
-        if (socketInfo->descriptor != -1 &&
-            recv(socketInfo->descriptor, buffer + readSize, sizeof(char), 0) == -1)
+        return !revoked;
+    }
+
+    length = SSL_get_tlsext_status_ocsp_resp(tls, &response);
+    if (length <= 0 || response == NULL)
+    {
+        logDebug("No OCSP response stapled");
+
+        return 1;
+    }
+
+    // PARSE AND VERIFY, the response must be signed by the issuer or a responder it trusts
+    ocspResponse = d2i_OCSP_RESPONSE(NULL, &response, length);
+    basic        = ocspResponse != NULL && OCSP_response_status(ocspResponse) == OCSP_RESPONSE_STATUS_SUCCESSFUL
+                       ? OCSP_response_get1_basic(ocspResponse)
+                       : NULL;
+    chain        = SSL_get_peer_cert_chain(tls);
+
+    // the chain is verified before the callback, it ends with the trusted root the server may not send
+    verified = SSL_get0_verified_chain(tls);
+    issuer   = NULL;
+    for (i = 0; verified != NULL && i < sk_X509_num(verified) && issuer == NULL; ++i)
+    {
+        if (X509_check_issued(sk_X509_value(verified, i), leaf) == X509_V_OK)
         {
-            logPanic("Error while reading from socket!");
+            issuer = sk_X509_value(verified, i);
         }
+    }
 
-        else if (socketInfo->tls != NULL &&
-                 SSL_read(socketInfo->tls, buffer + readSize, sizeof(char)) <= 0)
+    id     = issuer != NULL ? OCSP_cert_to_id(NULL, leaf, issuer) : NULL;
+    status = -1;
+    if (basic != NULL && id != NULL && OCSP_basic_verify(basic, chain, SSL_CTX_get_cert_store(SSL_get_SSL_CTX(tls)), 0) > 0 &&
+        OCSP_resp_find_status(basic, id, &status, NULL, NULL, &thisUpdate, &nextUpdate) &&
+        !OCSP_check_validity(thisUpdate, nextUpdate, OCSP_CLOCK_SKEW, -1))
+    {
+        status = -1;
+    }
+
+    validUntil = time(NULL) + OCSP_DEFAULT_VALIDITY;
+    if (status != -1 && nextUpdate != NULL && ASN1_TIME_to_tm(nextUpdate, &nextTime))
+    {
+        validUntil = timegm(&nextTime);
+    }
+
+    OCSP_CERTID_free(id);
+    OCSP_BASICRESP_free(basic);
+    OCSP_RESPONSE_free(ocspResponse);
+
+    if (status == -1)
+    {
+        logError("The OCSP response stapled by the server could not be verified!");
+
+        return 0;
+    }
+
+    logVerbose("OCSP status: %s", OCSP_cert_status_str(status));
+
+    // SAVE, entries are replaced by the newer answers for the same certificate
+    pthread_mutex_lock(&tlsLock);
+    cached = findOcspStatus(certificate);
+    if (cached == NULL)
+    {
+        cached = calloc(1, sizeof(ocspStatus));
+        if (cached != NULL)
         {
-            logPanic("Error while reading from secure socket!");
+            memcpy(cached->certificate, certificate, SHA256_DIGEST_LENGTH);
+            cached->next = ocspCache;
+            ocspCache    = cached;
         }
+    }
+    if (cached != NULL)
+    {
+        cached->validUntil = validUntil;
+        cached->revoked    = status == V_OCSP_CERTSTATUS_REVOKED;
+    }
+    pthread_mutex_unlock(&tlsLock);
+
+    if (status == V_OCSP_CERTSTATUS_REVOKED)
+    {
+        logError("Certificate of the server is revoked!");
 
-        ++readSize;
-        *(buffer + readSize) = '\0';
+        return 0;
+    }
 
-        targetOffset = readSize - targetLength;
+    return 1;
+}
+
+// called with tlsLock held
+ocspStatus *findOcspStatus(unsigned char *certificate)
+{
+    ocspStatus *cached;
 
-        if (targetOffset > 0)
+    for (cached = ocspCache; cached != NULL; cached = cached->next)
+    {
+        if (!memcmp(cached->certificate, certificate, SHA256_DIGEST_LENGTH))
         {
-            if (caseInsensitive)
-            {
-                notFound = strncasecmp(buffer + targetOffset, target, targetLength);
-            }
-            else
-            {
-                notFound = strncmp(buffer + targetOffset, target, targetLength);
-            }
+            return cached;
+        }
+    }
+
+    return NULL;
+}
+
+tlsSession *findTlsSession(char *host)
+{
+    tlsSession *cached;
+
+    for (cached = tlsSessions; cached != NULL; cached = cached->next)
+    {
+        if (!strcasecmp(cached->host, host))
+        {
+            return cached;
         }
-    } while (notFound);
+    }
+
+    return NULL;
+}
+
+// saved on close, TLS 1.3 tickets only arrive after the handshake
+void saveTlsSession(socketStruct *socketInfo)
+{
+    SSL_SESSION *session;
+    tlsSession *cached;
+
+    session = SSL_get1_session(socketInfo->tls);
+    if (session == NULL || socketInfo->host == NULL)
+    {
+        return;
+    }
+
+    if (!SSL_SESSION_is_resumable(session))
+    {
+        SSL_SESSION_free(session);
+
+        return;
+    }
+
+    pthread_mutex_lock(&tlsLock);
+    cached = findTlsSession(socketInfo->host);
+    if (cached == NULL)
+    {
+        cached = calloc(1, sizeof(tlsSession));
+        if (cached == NULL)
+        {
+            pthread_mutex_unlock(&tlsLock);
+            SSL_SESSION_free(session);
+
+            return;
+        }
+
+        cached->host = strdup(socketInfo->host);
+        cached->next = tlsSessions;
+        tlsSessions  = cached;
+    }
+    else
+    {
+        SSL_SESSION_free(cached->session);
+    }
 
-    return buffer;
+    cached->session = session;
+    pthread_mutex_unlock(&tlsLock);
 }
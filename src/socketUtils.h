@@ -1,19 +1,154 @@
 #pragma once
 
+#include "byteBuffer.h"
+#include "httpError.h"
+#include "rateLimit.h"
 #include <openssl/ssl.h>
+#include <signal.h>
+#include <sys/uio.h>
 
-#define readLine(socketinfo)    readUntilString(socketinfo, CRLF, 2, 0)
-#define readHeaders(socketinfo) readUntilString(socketinfo, HEADERS_END, 4, 0)
+#define READ_AHEAD_SIZE (16 * 1024)
 
-typedef struct socketStruct
+// seconds of difference allowed between our clock and the OCSP responder
+#define OCSP_CLOCK_SKEW 300
+// seconds a good OCSP answer without a next update is trusted
+#define OCSP_DEFAULT_VALIDITY 3600
+
+// don't forget to update the const arrays in socketUtils.c
+typedef enum socketProfileName
+{
+    PROFILE_DEFAULT,
+    PROFILE_LOW_LATENCY,
+    PROFILE_BULK,
+    SOCKET_PROFILE_MAX
+} socketProfileName;
+
+/** Options set on a new socket before connecting, 0 leaves the system default */
+typedef struct socketProfile
+{
+    int noDelay;
+    /** re-armed before reading the answer to every message sent, the kernel clears it on its own */
+    int quickAck;
+    /** the first bytes written go out with the SYN, saving one RTT when the server supports it */
+    int fastOpen;
+    int receiveBuffer;
+    int sendBuffer;
+    /** microseconds spent busy polling the device queue on blocking reads */
+    int busyPoll;
+} socketProfile;
+
+extern const char *socketProfileNames[];
+extern const socketProfile socketProfiles[];
+
+typedef struct socketStruct socketStruct;
+
+/**
+ * How the bytes of a connection are carried: plain TCP, TLS, unix sockets or
+ * an in-memory mock. The socket functions only call these, a new backend is
+ * one more table.
+ */
+typedef struct socketTransport
 {
+    /** in the logs, e.g. "secure" */
+    const char *name;
+    /** 1 if the descriptor carries the bytes of the stream as they are, so splice can move them */
+    int spliceable;
+    /** connect socketInfo->host, or socketInfo->unixPath when set */
+    httpError (*connect)(socketStruct *socketInfo, socketProfileName profile);
+    /**
+     * @param waitAll 1 to wait for length bytes, transports that can not return less
+     * @return bytes read, 0 if the connection was closed, -1 on error
+     */
+    int (*read)(socketStruct *socketInfo, char *buffer, int length, int waitAll);
+    /** @return bytes written, -1 on error */
+    int (*write)(socketStruct *socketInfo, char *data, int length);
+    int (*writev)(socketStruct *socketInfo, struct iovec *parts, int count);
+    /** bytes already taken from the descriptor and waiting in the transport */
+    int (*pending)(socketStruct *socketInfo);
+    /** release what the transport holds, descriptor included */
+    void (*close)(socketStruct *socketInfo);
+} socketTransport;
+
+struct socketStruct
+{
+    const socketTransport *transport;
+    /** kept for the whole connection, TLS included, -1 for the mock */
     int descriptor;
     SSL *tls;
-} socketStruct;
+    /** private data of the transport, e.g. the response of the mock */
+    void *state;
+    char *host;
+    /** unix socket the connection goes to instead of host, NULL for TCP */
+    char *unixPath;
+    /** paces sendMessage and readInto, NULL for no limit */
+    rateLimiter *limiter;
+    int quickAck;
+    /** 1 while TCP_QUICKACK is set for the answer to the last message sent */
+    int quickAckArmed;
+    /** bytes read from the connection but not used yet, every read takes them first */
+    byteBuffer readAhead;
+};
 
-socketStruct *createSocket(char *host, int secure);
+/**
+ * Resolve host and open a connection to it, negotiating TLS if secure.
+ * The TLS context is shared by all the sockets of the process and sessions
+ * are cached per host, so later connections to the same host can resume them.
+ *
+ * @param socketInfo set to the new socket on success
+ * @param profile options of the new socket, options the system refuses are skipped
+ * @param unixPath unix socket to connect to instead of resolving host, which is
+ *                 still the TLS server name. @name is in the abstract namespace. NULL for TCP
+ *
+ * @return HTTP_OK or the reason of the failure
+ */
+httpError createSocket(socketStruct **socketInfo, char *host, int secure, socketProfileName profile, char *unixPath);
+/**
+ * Choose the certificates trusted by the TLS connections of the process, to
+ * call before the first one. By default server certificates are verified
+ * against the system store and must match the host they are connected to.
+ * The store is loaded once per process: a hashed directory (capath, or the
+ * system one) only has the certificates of the chains seen parsed, a bundle
+ * (cafile) is parsed whole. OCSP responses stapled by the servers are checked
+ * and cached, a revoked certificate fails with ERR_CERTIFICATE.
+ *
+ * @param caFile PEM bundle, NULL for none
+ * @param caPath directory hashed with 'openssl rehash', NULL for none
+ * @param verify 0 to accept any certificate
+ */
+httpError setTlsTrust(char *caFile, char *caPath, int verify);
+/**
+ * Connection that never leaves the process, for benchmarks of the layers above
+ * the network: writes are dropped and reads return the bytes of response over
+ * and over, as if the server answered every request with it. The body of
+ * response must have a length the parser can tell, not end with the connection.
+ */
+httpError createMockSocket(socketStruct **socketInfo, char *host, char *response, int length);
 void closeSocket(socketStruct *socketInfo);
 
-void sendMessage(socketStruct *socketInfo, char *message, int length);
-char *readSize(socketStruct *socketInfo, int size);
-char *readUntilString(socketStruct *socketInfo, char *target, int targetLength, int caseInsensitive);
+httpError sendMessage(socketStruct *socketInfo, char *message, int length);
+/** Send the parts in as few calls as the transport allows, parts is changed */
+httpError sendVector(socketStruct *socketInfo, struct iovec *parts, int count);
+/** Reads exactly size bytes into an existing buffer of at least size bytes */
+httpError readInto(socketStruct *socketInfo, char *buffer, int size);
+/**
+ * Read whatever the connection has ready, at least one byte, into socketInfo->readAhead.
+ * A single syscall takes a whole response head, and the bytes past it stay
+ * there for the next reads.
+ */
+httpError readAvailable(socketStruct *socketInfo);
+/**
+ * Same as readAvailable, giving up when nothing arrives in time. The
+ * descriptor is read without blocking, so a TLS record that brings no data,
+ * like a session ticket, does not leave the read waiting.
+ *
+ * @param timeout milliseconds to wait, set to the time left, 0 if it ran out and nothing was read
+ */
+httpError readAvailableWithin(socketStruct *socketInfo, int *timeout);
+
+/**
+ * OpenSSL writes with plain send, so a connection closed by the server would
+ * kill the process with SIGPIPE: library calls block it for the calling thread
+ * and discard any SIGPIPE raised in the meantime when restoring the mask.
+ */
+void blockSigpipe(sigset_t *oldMask);
+void restoreSigpipe(sigset_t *oldMask);
@@ -0,0 +1,68 @@
+#include "stats.h"
+#include <stdio.h>
+#include <sys/resource.h>
+
+transferStats processStats = {0};
+
+void readStats(transferStats *snapshot)
+{
+    struct rusage usage;
+
+    snapshot->allocations       = __atomic_load_n(&processStats.allocations, __ATOMIC_RELAXED);
+    snapshot->reallocations     = __atomic_load_n(&processStats.reallocations, __ATOMIC_RELAXED);
+    snapshot->bytesCopied       = __atomic_load_n(&processStats.bytesCopied, __ATOMIC_RELAXED);
+    snapshot->recvCalls         = __atomic_load_n(&processStats.recvCalls, __ATOMIC_RELAXED);
+    snapshot->sendCalls         = __atomic_load_n(&processStats.sendCalls, __ATOMIC_RELAXED);
+    snapshot->sslReads          = __atomic_load_n(&processStats.sslReads, __ATOMIC_RELAXED);
+    snapshot->sslWrites         = __atomic_load_n(&processStats.sslWrites, __ATOMIC_RELAXED);
+    snapshot->splicedBytes      = __atomic_load_n(&processStats.splicedBytes, __ATOMIC_RELAXED);
+    snapshot->coalescedRequests = __atomic_load_n(&processStats.coalescedRequests, __ATOMIC_RELAXED);
+
+    snapshot->peakRss = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+}
+
+void printStats(FILE *output, transferStats *snapshot)
+{
+    fprintf(output,
+            "Allocations:     %lld\n"
+            "Reallocations:   %lld\n"
+            "Bytes copied:    %lld\n"
+            "recv calls:      %lld\n"
+            "send calls:      %lld\n"
+            "SSL_read calls:  %lld\n"
+            "SSL_write calls: %lld\n"
+            "Bytes spliced:   %lld\n"
+            "Coalesced:       %lld\n"
+            "Peak RSS:        %ld KB\n",
+            snapshot->allocations, snapshot->reallocations, snapshot->bytesCopied,
+            snapshot->recvCalls, snapshot->sendCalls, snapshot->sslReads, snapshot->sslWrites,
+            snapshot->splicedBytes, snapshot->coalescedRequests, snapshot->peakRss);
+}
+
+void printStatsJson(FILE *output, transferStats *snapshot, int indent)
+{
+    fprintf(output,
+            "{\n"
+            "%*s  \"allocations\": %lld,\n"
+            "%*s  \"reallocations\": %lld,\n"
+            "%*s  \"bytesCopied\": %lld,\n"
+            "%*s  \"recvCalls\": %lld,\n"
+            "%*s  \"sendCalls\": %lld,\n"
+            "%*s  \"sslReads\": %lld,\n"
+            "%*s  \"sslWrites\": %lld,\n"
+            "%*s  \"splicedBytes\": %lld,\n"
+            "%*s  \"coalescedRequests\": %lld,\n"
+            "%*s  \"peakRssKb\": %ld\n"
+            "%*s}",
+            indent, "", snapshot->allocations,
+            indent, "", snapshot->reallocations,
+            indent, "", snapshot->bytesCopied,
+            indent, "", snapshot->recvCalls,
+            indent, "", snapshot->sendCalls,
+            indent, "", snapshot->sslReads,
+            indent, "", snapshot->sslWrites,
+            indent, "", snapshot->splicedBytes,
+            indent, "", snapshot->coalescedRequests,
+            indent, "", snapshot->peakRss,
+            indent, "");
+}
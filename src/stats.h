@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdio.h>
+
+// relaxed atomics, counting must stay cheap enough to be always on
+#define countStat(field, amount) __atomic_fetch_add(&processStats.field, (amount), __ATOMIC_RELAXED)
+
+/** Memory and I/O work done by the process, shown with --stats */
+typedef struct transferStats
+{
+    long long allocations;
+    long long reallocations;
+    /** bytes moved between buffers in user space, realloc moves included */
+    long long bytesCopied;
+
+    long long recvCalls;
+    long long sendCalls;
+    long long sslReads;
+    long long sslWrites;
+    /** bytes moved by splice, they never pass through user space */
+    long long splicedBytes;
+    /** requests of a batch served by the transfer of the same url */
+    long long coalescedRequests;
+
+    /** peak resident set size in KB, filled by readStats */
+    long peakRss;
+} transferStats;
+
+extern transferStats processStats;
+
+/** Copy the counters in snapshot, adding the current peak RSS */
+void readStats(transferStats *snapshot);
+/** Print the counters in a human readable table */
+void printStats(FILE *output, transferStats *snapshot);
+/**
+ * Print the counters as a JSON object.
+ *
+ * @param indent spaces before every line but the first, to nest the object in another one
+ */
+void printStatsJson(FILE *output, transferStats *snapshot, int indent);
@@ -0,0 +1,286 @@
+#define _GNU_SOURCE
+#include "stream.h"
+#include "eventStream.h"
+#include "httpHandle.h"
+#include "logger.h"
+#include "rateLimit.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct streamState
+{
+    httpRequest *req;
+    httpHandle *handle;
+    char *url;
+    eventParser events;
+
+    // CONNECTION IN PROGRESS
+    /** 1 once the headers announce a text/event-stream body */
+    int eventStream;
+    /** events printed since the request was sent */
+    long printed;
+    /** 1 when the stream must not be requested again */
+    int stop;
+} streamState;
+
+httpError setupStream(streamState *stream);
+int checkHeader(void *userData, char *line, int length);
+int printBody(void *userData, char *data, int length);
+int printEvent(void *userData, serverEvent *event);
+int writeOutput(char *data, int length);
+void waitRetry(long milliseconds);
+
+httpError runStream(httpRequest *req)
+{
+    int failures;
+    long retry;
+    streamState stream;
+    httpError error;
+
+    memset(&stream, 0, sizeof(stream));
+    stream.req = req;
+    error      = HTTP_OK;
+    initEvents(&stream.events);
+
+    stream.handle = createHandle();
+    if (stream.handle == NULL ||
+        asprintf(&stream.url, "%s://%s%s", req->secure ? "https" : "http", req->host, req->path) == -1)
+    {
+        stream.url = NULL;
+        error      = ERR_MEMORY;
+        logError("Could not start the stream: %s", errorDescription(error));
+    }
+
+    for (failures = 0; stream.url != NULL;)
+    {
+        stream.eventStream = 0;
+        stream.printed     = 0;
+
+        error = setupStream(&stream);
+        if (error == HTTP_OK)
+        {
+            logInfo("Streaming '%s'...", stream.url);
+
+            error = performRequest(stream.handle);
+        }
+
+        if (req->stream == STREAM_RAW || stream.stop)
+        {
+            break;
+        }
+
+        // a stream that keeps breaking before any event is not coming back
+        failures = stream.printed > 0 ? 0 : failures + 1;
+        if (failures > STREAM_MAX_RETRIES)
+        {
+            logError("No events from '%s' in %d attempts, giving up", stream.url, failures);
+
+            break;
+        }
+
+        retry = stream.events.retry >= 0 ? stream.events.retry : EVENT_RETRY_DEFAULT;
+        if (error == HTTP_OK)
+        {
+            logInfo("Stream ended, reconnecting in %ld ms", retry);
+        }
+        else
+        {
+            logWarn("Stream broken (%s), reconnecting in %ld ms", errorDescription(error), retry);
+        }
+
+        resetEvents(&stream.events);
+        waitRetry(retry);
+    }
+
+    if (error != HTTP_OK && error != ERR_ABORTED)
+    {
+        logError("Stream of '%s' failed: %s", stream.url, errorDescription(error));
+    }
+
+    if (stream.handle != NULL)
+    {
+        destroyHandle(stream.handle);
+    }
+    freeEvents(&stream.events);
+    free(stream.url);
+
+    return error;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+httpError setupStream(streamState *stream)
+{
+    int accept;
+    httpRequest *req = stream->req;
+    httpHeader *header;
+    httpError error;
+
+    resetHandle(stream->handle);
+    setHeaderCallback(stream->handle, checkHeader, stream);
+    setBodyCallback(stream->handle, printBody, stream);
+    setStreaming(stream->handle, 1);
+
+    error = setUrl(stream->handle, stream->url);
+    if (error == HTTP_OK)
+    {
+        error = setMethod(stream->handle, req->method);
+    }
+    if (error == HTTP_OK)
+    {
+        error = setSocketProfile(stream->handle, req->socketProfile);
+    }
+    if (error == HTTP_OK)
+    {
+        error = setUnixSocket(stream->handle, req->unixSocket);
+    }
+
+    accept = 0;
+    for (header = req->headers; header != NULL && error == HTTP_OK; header = header->next)
+    {
+        accept |= !strncasecmp(header->line, "Accept:", 7);
+        error = addRequestHeader(stream->handle, header->line);
+    }
+
+    if (error == HTTP_OK && req->stream == STREAM_EVENTS && !accept)
+    {
+        error = addRequestHeader(stream->handle, "Accept: text/event-stream");
+    }
+    // the server goes on from the last event printed, an empty id resets it and is not sent
+    if (error == HTTP_OK && req->stream == STREAM_EVENTS && stream->events.lastId != NULL &&
+        stream->events.lastId[0] != '\0')
+    {
+        error = addHeader(stream->handle->req, "Last-Event-ID: %s", stream->events.lastId);
+    }
+
+    if (error == HTTP_OK && req->text != NULL)
+    {
+        error = setBody(stream->handle, req->type, req->text);
+    }
+    if (error == HTTP_OK && (req->limitRate > 0 || globalRate() > 0))
+    {
+        error = setRateLimit(stream->handle, req->limitRate, req->rateWeight);
+    }
+
+    return error;
+}
+
+int checkHeader(void *userData, char *line, int length)
+{
+    streamState *stream = userData;
+    httpResponse *res   = stream->handle->res;
+
+    if (length > 0)
+    {
+        if (!strncasecmp(line, "Content-Type:", 13) && strcasestr(line, "text/event-stream") != NULL)
+        {
+            stream->eventStream = 1;
+        }
+
+        return 0;
+    }
+
+    // all the headers are parsed
+    logVerbose("Status %d: %s", res->status, statusCodeDescription(res->status));
+    if (stream->req->stream != STREAM_EVENTS)
+    {
+        return 0;
+    }
+
+    // how a server tells the client to stop reconnecting
+    if (res->status == 204)
+    {
+        logInfo("The server closed the event stream");
+        stream->stop = 1;
+
+        return 0;
+    }
+
+    if (res->status != 200 || !stream->eventStream)
+    {
+        logError("Status %d: '%s' is not an event stream!", res->status, stream->url);
+        stream->stop = 1;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int printBody(void *userData, char *data, int length)
+{
+    streamState *stream = userData;
+    httpError error;
+
+    if (stream->req->stream == STREAM_RAW)
+    {
+        error = writeOutput(data, length) == -1 ? ERR_FILE : HTTP_OK;
+    }
+    else
+    {
+        error = feedEvents(&stream->events, data, length, printEvent, stream);
+    }
+
+    if (error != HTTP_OK)
+    {
+        stream->stop = 1;
+
+        return 1;
+    }
+
+    return 0;
+}
+
+int printEvent(void *userData, serverEvent *event)
+{
+    streamState *stream = userData;
+
+    logVerbose("Event '%s', last id '%s'", event->type, event->id != NULL ? event->id : "");
+    ++stream->printed;
+
+    // the LF after the data ends the line, a single write for the whole event
+    return writeOutput(event->data, event->dataLength + 1) == -1;
+}
+
+// written straight to stdout, nothing waits in a stdio buffer
+int writeOutput(char *data, int length)
+{
+    int written;
+
+    while (length > 0)
+    {
+        written = write(STDOUT_FILENO, data, length);
+        if (written == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            logError("Could not write to stdout: %s", strerror(errno));
+
+            return -1;
+        }
+
+        data += written;
+        length -= written;
+    }
+
+    return 0;
+}
+
+void waitRetry(long milliseconds)
+{
+    struct timespec delay;
+
+    delay.tv_sec  = milliseconds / 1000;
+    delay.tv_nsec = (milliseconds % 1000) * 1000000;
+
+    while (nanosleep(&delay, &delay) == -1 && errno == EINTR)
+    {
+    }
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "httpLib.h"
+
+/** values of httpRequest.stream */
+#define STREAM_EVENTS 1
+#define STREAM_RAW    2
+
+/** connections in a row without a single event before an event stream is given up */
+#define STREAM_MAX_RETRIES 10
+
+/**
+ * Print the body of the url of req to stdout while it arrives, every piece
+ * is written as soon as the read that brought it returns.
+ *
+ * With req->stream STREAM_EVENTS the body must be a text/event-stream: the
+ * data of every event is printed on its own line, and when the stream ends or
+ * breaks the request is sent again with the Last-Event-ID of the last event,
+ * after the delay asked by the server. With STREAM_RAW the body is printed as
+ * it is decoded, once.
+ *
+ * @return HTTP_OK when the stream ended as the server asked
+ */
+httpError runStream(httpRequest *req);
@@ -0,0 +1,89 @@
+#include "summary.h"
+#include "logger.h"
+#include <stdio.h>
+#include <string.h>
+
+void writeJsonString(FILE *output, char *string);
+
+int writeSummary(char *path, transferSummary *summary)
+{
+    FILE *output;
+    int error;
+
+    output = strcmp(path, "-") ? fopen(path, "w") : stdout;
+    if (output == NULL)
+    {
+        logError("Could not open '%s' to write the summary!", path);
+
+        return -1;
+    }
+
+    fprintf(output, "{\n  \"url\": ");
+    writeJsonString(output, summary->url);
+    fprintf(output, ",\n  \"status\": %d,\n  \"size\": %lld,\n  \"resumedFrom\": %lld,\n  \"output\": ",
+            summary->status, summary->size, summary->resumedFrom);
+    writeJsonString(output, summary->outputPath);
+
+    if (summary->digest != NULL)
+    {
+        fprintf(output, ",\n  \"checksum\": {\n    \"algorithm\": \"%s\",\n    \"digest\": \"%s\",\n    \"verified\": %s\n  }",
+                checksumNames[summary->checksum], summary->digest,
+                summary->verified == -1 ? "null" : (summary->verified ? "true" : "false"));
+    }
+    if (summary->stats != NULL)
+    {
+        fprintf(output, ",\n  \"stats\": ");
+        printStatsJson(output, summary->stats, 2);
+    }
+    fprintf(output, "\n}\n");
+
+    error = ferror(output);
+    if (output != stdout)
+    {
+        error |= fclose(output);
+    }
+    else
+    {
+        fflush(output);
+    }
+
+    if (error)
+    {
+        logError("Could not write the summary to '%s'!", path);
+
+        return -1;
+    }
+
+    return 0;
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// quoted and escaped, null for a NULL string
+void writeJsonString(FILE *output, char *string)
+{
+    if (string == NULL)
+    {
+        fprintf(output, "null");
+
+        return;
+    }
+
+    fputc('"', output);
+    for (; *string != '\0'; ++string)
+    {
+        if (*string == '"' || *string == '\\')
+        {
+            fprintf(output, "\\%c", *string);
+        }
+        else if ((unsigned char)*string < 0x20)
+        {
+            fprintf(output, "\\u%04x", *string);
+        }
+        else
+        {
+            fputc(*string, output);
+        }
+    }
+    fputc('"', output);
+}
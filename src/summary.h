@@ -0,0 +1,34 @@
+#pragma once
+
+#include "checksum.h"
+#include "stats.h"
+
+/** What a transfer did, written as JSON for scripts with --summary */
+typedef struct transferSummary
+{
+    char *url;
+    int status;
+    /** body bytes recived by this transfer */
+    long long size;
+    /** bytes already on disk when the transfer continued a partial download */
+    long long resumedFrom;
+    /** file the body was saved to, NULL if there was no body */
+    char *outputPath;
+
+    checksumType checksum;
+    char *digest;
+    /** 1 if digest matched the expected one, 0 if it did not, -1 if not checked */
+    int verified;
+
+    /** NULL to leave the stats out */
+    transferStats *stats;
+} transferSummary;
+
+/**
+ * Write summary as a JSON object.
+ *
+ * @param path file to write, "-" for stdout
+ *
+ * @return 0 on success, -1 if path could not be written
+ */
+int writeSummary(char *path, transferSummary *summary);
@@ -0,0 +1,98 @@
+#include "urlSet.h"
+#include "stats.h"
+#include <stdlib.h>
+
+unsigned long long hashUrl(char *url);
+int insertHash(unsigned long long *hashes, int capacity, unsigned long long hash);
+
+void initUrlSet(urlSet *set)
+{
+    set->hashes   = NULL;
+    set->capacity = 0;
+    set->count    = 0;
+}
+
+int addUrl(urlSet *set, char *url)
+{
+    int i, capacity;
+    unsigned long long *hashes;
+
+    // kept at most half full, so probes stay short
+    if (set->count >= set->capacity / 2)
+    {
+        capacity = set->capacity > 0 ? set->capacity * 2 : URL_SET_MIN_CAPACITY;
+        hashes   = calloc(capacity, sizeof(unsigned long long));
+        if (hashes == NULL)
+        {
+            return -1;
+        }
+        countStat(allocations, 1);
+
+        for (i = 0; i < set->capacity; ++i)
+        {
+            if (set->hashes[i] != 0)
+            {
+                insertHash(hashes, capacity, set->hashes[i]);
+            }
+        }
+
+        free(set->hashes);
+        set->hashes   = hashes;
+        set->capacity = capacity;
+    }
+
+    if (!insertHash(set->hashes, set->capacity, hashUrl(url)))
+    {
+        return 0;
+    }
+    ++set->count;
+
+    return 1;
+}
+
+void freeUrlSet(urlSet *set)
+{
+    free(set->hashes);
+    initUrlSet(set);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// FNV-1a, finished with the splitmix64 mixer so that the low bits used as index are well spread
+unsigned long long hashUrl(char *url)
+{
+    unsigned long long hash;
+
+    hash = 14695981039346656037ULL;
+    for (; *url != '\0'; ++url)
+    {
+        hash ^= (unsigned char)*url;
+        hash *= 1099511628211ULL;
+    }
+
+    hash ^= hash >> 30;
+    hash *= 0xbf58476d1ce4e5b9ULL;
+    hash ^= hash >> 27;
+    hash *= 0x94d049bb133111ebULL;
+    hash ^= hash >> 31;
+
+    return hash != 0 ? hash : 1;
+}
+
+// capacity is a power of two, 1 if hash was added, 0 if already there
+int insertHash(unsigned long long *hashes, int capacity, unsigned long long hash)
+{
+    int i;
+
+    for (i = hash & (capacity - 1); hashes[i] != 0; i = (i + 1) & (capacity - 1))
+    {
+        if (hashes[i] == hash)
+        {
+            return 0;
+        }
+    }
+
+    hashes[i] = hash;
+
+    return 1;
+}
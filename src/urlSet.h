@@ -0,0 +1,22 @@
+#pragma once
+
+#define URL_SET_MIN_CAPACITY 1024
+
+/**
+ * Set of the urls already seen, storing only a 64 bit hash of each one:
+ * 16 bytes per url at worst, whatever their length. Two different urls with
+ * the same hash are taken for the same, with millions of urls the chance is
+ * still below one in a million.
+ */
+typedef struct urlSet
+{
+    /** open addressing table, 0 marks an empty slot */
+    unsigned long long *hashes;
+    int capacity;
+    int count;
+} urlSet;
+
+void initUrlSet(urlSet *set);
+/** @return 1 if url was added, 0 if it was already in the set, -1 if out of memory */
+int addUrl(urlSet *set, char *url);
+void freeUrlSet(urlSet *set);
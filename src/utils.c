@@ -1,52 +1,50 @@
 #include "utils.h"
+#include "byteBuffer.h"
 #include "httpLib.h"
 #include "logger.h"
+#include "stats.h"
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 const char *contentTypeToExtension[] = {
     [NONE]       = "txt",
     [TEXT_PLAIN] = "txt",
     [TEXT_HTML]  = "html",
     [FORM]       = "txt",
-    [JSON]       = "json"};
+    [JSON]       = "json",
+    [MULTIPART]  = "txt"};
 
 const int contentTypeToLength[] = {
     [NONE]       = 4,
     [TEXT_PLAIN] = 4,
     [TEXT_HTML]  = 5,
     [FORM]       = 4,
-    [JSON]       = 5};
+    [JSON]       = 5,
+    [MULTIPART]  = 4};
 
-char *increaseBuffer(char *buffer, int *bufferSize, int newSize)
-{
-    char *oldBuffer = buffer;
+// 1 for the bytes that are never escaped: ALPHA DIGIT - . _ ~ (RFC 3986), the rest is 0
+const unsigned char unreservedBytes[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 0,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 1,
+    0, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+    1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 1, 0};
 
-    while (newSize > *bufferSize)
-    {
-        *bufferSize += 1024;
-        buffer = realloc(buffer, *bufferSize);
-        if (buffer == NULL)
-        {
-            logPanic("Could not allocate new buffer of %d KB!", *bufferSize / 1024);
-        }
-    }
-    if (oldBuffer != buffer)
-    {
-        logDebug("Reallocated memory from %p to %p, requested at least %d bytes (current size %d)",
-                 oldBuffer, buffer, newSize, *bufferSize);
-    }
-    else
-    {
-        logDebug("Requested at least %d bytes (current size %d), no change",
-                 newSize, *bufferSize);
-    }
+const char hexDigits[] = "0123456789ABCDEF";
 
-    return buffer;
-}
+int unreservedRun(char *entry, int length);
+int hexValue(char digit);
+int hasScheme(char *link, int length);
+httpError appendNormalPath(byteBuffer *url, char *path, int length);
 
 // change all uppercase to lowercase in place
 char *lowerString(char *str)
@@ -61,7 +59,7 @@ char *lowerString(char *str)
     return str;
 }
 
-void parseUrl(char *uri, httpRequest *req)
+httpError parseUrl(char *uri, httpRequest *req)
 {
     char *hostStart;
     int protoLength, hostLength;
@@ -71,6 +69,13 @@ void parseUrl(char *uri, httpRequest *req)
     // PROTOCOL
     while (*(uri + protoLength) != ':')
     {
+        if (*(uri + protoLength) == '\0')
+        {
+            logError("'%s' is missing the protocol!", uri);
+
+            return ERR_INVALID;
+        }
+
         ++protoLength;
     }
 
@@ -84,7 +89,9 @@ void parseUrl(char *uri, httpRequest *req)
     }
     else
     {
-        logPanic("'%.s' invalid protocol! Only http/https allowed!", protoLength, uri);
+        logError("'%.*s' invalid protocol! Only http/https allowed!", protoLength, uri);
+
+        return ERR_INVALID;
     }
 
     logDebug("proto => %.*s", protoLength, uri);
@@ -99,6 +106,9 @@ void parseUrl(char *uri, httpRequest *req)
 
     logDebug("host  => %.*s (%d)", hostLength, hostStart, hostLength);
 
+    free(req->host);
+    free(req->path);
+
     req->hostLength = hostLength;
     req->host       = strndup(hostStart, hostLength);
 
@@ -113,45 +123,394 @@ void parseUrl(char *uri, httpRequest *req)
     {
         req->path = strdup(hostStart + hostLength);
     }
+
+    if (req->host == NULL || req->path == NULL)
+    {
+        return ERR_MEMORY;
+    }
+
+    return HTTP_OK;
+}
+
+char *resolveUrl(char *base, char *link, int linkLength)
+{
+    int queryStart;
+    char *fragment, *absolute;
+    byteBuffer url;
+    httpRequest parsed;
+    httpError error;
+
+    while (linkLength > 0 && isspace((unsigned char)*link))
+    {
+        ++link;
+        --linkLength;
+    }
+    while (linkLength > 0 && isspace((unsigned char)link[linkLength - 1]))
+    {
+        --linkLength;
+    }
+
+    fragment = memchr(link, '#', linkLength);
+    if (fragment != NULL)
+    {
+        linkLength = fragment - link;
+    }
+
+    // mailto:, javascript:, data: and the like are not followed
+    if (hasScheme(link, linkLength) &&
+        strncasecmp(link, "http:", 5) != 0 && strncasecmp(link, "https:", 6) != 0)
+    {
+        return NULL;
+    }
+
+    memset(&parsed, 0, sizeof(parsed));
+    initBuffer(&url);
+
+    // ABSOLUTE URL, resolved against the base
+    if (hasScheme(link, linkLength))
+    {
+        error = appendBuffer(&url, link, linkLength);
+    }
+    else if (parseUrl(base, &parsed) != HTTP_OK)
+    {
+        error = ERR_INVALID;
+    }
+    else if (linkLength >= 2 && link[0] == '/' && link[1] == '/')
+    {
+        error = appendFormat(&url, "%s:%.*s", parsed.secure ? "https" : "http", linkLength, link);
+    }
+    else
+    {
+        error = appendFormat(&url, "%s://%s", parsed.secure ? "https" : "http", parsed.host);
+
+        queryStart = strcspn(parsed.path, "?#");
+        if (error == HTTP_OK && linkLength == 0)
+        {
+            error = appendBuffer(&url, parsed.path, strcspn(parsed.path, "#"));
+        }
+        else if (error == HTTP_OK && link[0] == '?')
+        {
+            error = appendBuffer(&url, parsed.path, queryStart);
+        }
+        // relative to the directory of the base path
+        else if (error == HTTP_OK && link[0] != '/')
+        {
+            while (queryStart > 0 && parsed.path[queryStart - 1] != '/')
+            {
+                --queryStart;
+            }
+            error = appendBuffer(&url, parsed.path, queryStart);
+        }
+
+        if (error == HTTP_OK)
+        {
+            error = appendBuffer(&url, link, linkLength);
+        }
+    }
+    free(parsed.host);
+    free(parsed.path);
+
+    // NORMALIZATION, the same page is always written the same way
+    memset(&parsed, 0, sizeof(parsed));
+    if (error == HTTP_OK)
+    {
+        error = parseUrl(bufferData(&url), &parsed);
+    }
+    freeBuffer(&url);
+
+    if (error == HTTP_OK && parsed.hostLength == 0)
+    {
+        error = ERR_INVALID;
+    }
+    if (error == HTTP_OK)
+    {
+        error = appendFormat(&url, "%s://%s", parsed.secure ? "https" : "http", lowerString(parsed.host));
+    }
+    if (error == HTTP_OK)
+    {
+        error = appendNormalPath(&url, parsed.path, parsed.pathLength);
+    }
+    free(parsed.host);
+    free(parsed.path);
+
+    if (error != HTTP_OK)
+    {
+        freeBuffer(&url);
+
+        return NULL;
+    }
+
+    absolute = detachBuffer(&url);
+
+    return absolute;
+}
+
+int urlEncodedLength(char *entry, int length)
+{
+    int i, end, encodedLength, foundEqual;
+
+    for (i = encodedLength = foundEqual = 0; i < length;)
+    {
+        end = unreservedRun(entry + i, length - i);
+        encodedLength += end;
+        i += end;
+
+        // the next block holds a byte to escape, it goes through the table one byte at a time
+        for (end = i + 16 < length ? i + 16 : length; i < end; ++i)
+        {
+            if (unreservedBytes[(unsigned char)entry[i]] || (!foundEqual && entry[i] == '='))
+            {
+                foundEqual |= entry[i] == '=';
+                encodedLength += 1;
+            }
+            else
+            {
+                encodedLength += 3;
+            }
+        }
+    }
+
+    return encodedLength;
+}
+
+int urlEncodeInto(char *destination, char *entry, int length)
+{
+    int i, end, cursor, foundEqual;
+    unsigned char byte;
+
+    for (i = cursor = foundEqual = 0; i < length;)
+    {
+        end = unreservedRun(entry + i, length - i);
+        memcpy(destination + cursor, entry + i, end);
+        cursor += end;
+        i += end;
+
+        for (end = i + 16 < length ? i + 16 : length; i < end; ++i)
+        {
+            byte = entry[i];
+            if (unreservedBytes[byte] || (!foundEqual && byte == '='))
+            {
+                foundEqual |= byte == '=';
+                destination[cursor++] = byte;
+            }
+            else
+            {
+                destination[cursor++] = '%';
+                destination[cursor++] = hexDigits[byte >> 4];
+                destination[cursor++] = hexDigits[byte & 0x0F];
+            }
+        }
+    }
+
+    return cursor;
 }
 
 char *urlEncode(char *entry)
 {
-    int i, foundEqual, cursor;
+    int length, encodedLength;
+    char *buffer;
+
+    length        = strlen(entry);
+    encodedLength = urlEncodedLength(entry, length);
+
+    buffer = malloc(encodedLength + 1);
+    if (buffer == NULL)
+    {
+        logError("Could not allocate url encoding buffer of %d bytes!", encodedLength + 1);
+
+        return NULL;
+    }
+    countStat(allocations, 1);
+
+    urlEncodeInto(buffer, entry, length);
+    buffer[encodedLength] = '\0';
+
+    return buffer;
+}
+
+char *urlDecode(char *entry, int *decodedLength)
+{
+    int i, cursor, high, low;
     char *buffer;
 
-    buffer = malloc(strlen(entry) * 3 + 1);
+    // decoding never makes the string longer
+    buffer = malloc(strlen(entry) + 1);
     if (buffer == NULL)
     {
-        logPanic("Could not allocate initial url encoding buffer!");
+        logError("Could not allocate url decoding buffer!");
+
+        return NULL;
     }
 
-    for (i = cursor = foundEqual = 0; i < strlen(entry); ++i, ++cursor)
+    for (i = cursor = 0; entry[i] != '\0'; ++i, ++cursor)
     {
-        if ((entry[i] >= '1' && entry[i] <= '9') ||
-            (entry[i] >= 'A' && entry[i] <= 'Z') ||
-            (entry[i] >= 'a' && entry[i] <= 'z') ||
-            (!foundEqual && entry[i] == '='))
+        if (entry[i] == '%')
         {
-            if (entry[i] == '=')
+            high = hexValue(entry[i + 1]);
+            low  = high != -1 ? hexValue(entry[i + 2]) : -1;
+            if (low == -1)
             {
-                foundEqual = 1;
+                logError("Invalid escape sequence in '%s'!", entry);
+                free(buffer);
+
+                return NULL;
             }
-            sprintf(buffer + cursor, "%c", entry[i]);
+
+            buffer[cursor] = high << 4 | low;
+            i += 2;
         }
         else
         {
-            sprintf(buffer + cursor, "%%%02X", entry[i]);
-            // 2 extra char for the hex encoding
-            cursor += 2;
+            buffer[cursor] = entry[i] == '+' ? ' ' : entry[i];
         }
     }
+    buffer[cursor] = '\0';
 
-    buffer = realloc(buffer, sizeof(char) * (cursor + 1));
-    if (buffer == NULL)
+    if (decodedLength != NULL)
     {
-        logPanic("Could not reallocate url encoding buffer!");
+        *decodedLength = cursor;
     }
 
     return buffer;
 }
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// length of the 16 byte blocks at the start of entry that need no escaping, 0 without SSE2
+int unreservedRun(char *entry, int length)
+{
+    int run = 0;
+#ifdef __SSE2__
+    __m128i block, lower, digit, alpha, mark;
+
+    while (run + 16 <= length)
+    {
+        block = _mm_loadu_si128((__m128i *)(entry + run));
+
+        // bytes above 0x7F are negative for the signed compares, so they are never accepted
+        digit = _mm_and_si128(_mm_cmpgt_epi8(block, _mm_set1_epi8('0' - 1)),
+                              _mm_cmplt_epi8(block, _mm_set1_epi8('9' + 1)));
+        lower = _mm_or_si128(block, _mm_set1_epi8(0x20));
+        alpha = _mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a' - 1)),
+                              _mm_cmplt_epi8(lower, _mm_set1_epi8('z' + 1)));
+        mark  = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('-')),
+                                          _mm_cmpeq_epi8(block, _mm_set1_epi8('.'))),
+                             _mm_or_si128(_mm_cmpeq_epi8(block, _mm_set1_epi8('_')),
+                                          _mm_cmpeq_epi8(block, _mm_set1_epi8('~'))));
+
+        if (_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(digit, alpha), mark)) != 0xFFFF)
+        {
+            break;
+        }
+
+        run += 16;
+    }
+#endif
+
+    return run;
+}
+
+int hexValue(char digit)
+{
+    if (digit >= '0' && digit <= '9')
+    {
+        return digit - '0';
+    }
+    else if (digit >= 'A' && digit <= 'F')
+    {
+        return digit - 'A' + 10;
+    }
+    else if (digit >= 'a' && digit <= 'f')
+    {
+        return digit - 'a' + 10;
+    }
+
+    return -1;
+}
+
+// a scheme is a letter followed by letters, digits, '+', '-' or '.' up to a ':'
+int hasScheme(char *link, int length)
+{
+    int i;
+
+    if (length == 0 || !isalpha((unsigned char)link[0]))
+    {
+        return 0;
+    }
+
+    for (i = 1; i < length && (isalnum((unsigned char)link[i]) || link[i] == '+' || link[i] == '-' || link[i] == '.'); ++i)
+    {
+    }
+
+    return i < length && link[i] == ':';
+}
+
+// remove the '.' and '..' segments (RFC 3986 section 5.2.4) and escape spaces and control bytes
+httpError appendNormalPath(byteBuffer *url, char *path, int length)
+{
+    int start, segmentEnd, isDot, isDotDot, isLast;
+    unsigned char byte;
+    httpError error;
+
+    start = url->length;
+    while (length > 0 && *path != '?')
+    {
+        // every segment starts with its '/'
+        for (segmentEnd = 1; segmentEnd < length && path[segmentEnd] != '/' && path[segmentEnd] != '?'; ++segmentEnd)
+        {
+        }
+        isDot    = segmentEnd == 2 && path[1] == '.';
+        isDotDot = segmentEnd == 3 && path[1] == '.' && path[2] == '.';
+        isLast   = segmentEnd == length || path[segmentEnd] == '?';
+
+        if (isDotDot)
+        {
+            // back to the '/' of the previous segment
+            while (url->length > start && url->data[--url->length] != '/')
+            {
+            }
+            url->data[url->length] = '\0';
+        }
+
+        error = HTTP_OK;
+        if (!isDot && !isDotDot)
+        {
+            error = appendBuffer(url, path, segmentEnd);
+        }
+        // the path ends in a directory
+        else if (isLast)
+        {
+            error = appendBuffer(url, "/", 1);
+        }
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+
+        path += segmentEnd;
+        length -= segmentEnd;
+    }
+
+    if (url->length == start)
+    {
+        error = appendBuffer(url, "/", 1);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    // the query is kept as it is, only bytes that would break the request line are escaped
+    for (; length > 0; ++path, --length)
+    {
+        byte  = *path;
+        error = byte > ' ' && byte < 0x7f ? appendBuffer(url, path, 1)
+                                          : appendFormat(url, "%%%c%c", hexDigits[byte >> 4], hexDigits[byte & 0x0f]);
+        if (error != HTTP_OK)
+        {
+            return error;
+        }
+    }
+
+    return HTTP_OK;
+}
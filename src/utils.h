@@ -7,17 +7,6 @@
 extern const char *contentTypeToExtension[];
 extern const int contentTypeToLength[];
 
-/**
- * Increase buffer, using 1Kb increments and reallocating only if needed,
- * to be big enough to contain newSize.
- * @param buffer can be a pointer to an existing array o NULL to allocate a new one
- * @param bufferSize is an integer passed by referene that keeps track of the size
- * @param newSize is an integer indicating the minimum new size
- *
- * @return New buffer pointer
- */
-char *increaseBuffer(char *buffer, int *bufferSize, int newSize);
-
 char *lowerString(char *str);
 
 /**
@@ -26,7 +15,37 @@ char *lowerString(char *str);
  *
  * @param uri Pointer to the char array containing the uri to parse
  * @param req Pointer to the request struct that will be populated parsing the uri
+ *
+ * @return HTTP_OK or ERR_INVALID if the uri is not a valid http/https url
  */
-void parseUrl(char *uri, httpRequest *req);
+httpError parseUrl(char *uri, httpRequest *req);
 
+/**
+ * Resolve link, as found in the page at base, to an absolute url: relative
+ * paths, '.' and '..' segments, scheme relative and query only links are
+ * resolved, the fragment is dropped and scheme and host are lowercased.
+ *
+ * @return Newly allocated url, NULL if link is not an http/https url or on error
+ */
+char *resolveUrl(char *base, char *link, int linkLength);
+
+/**
+ * Url encoding keeps the unreserved bytes and the first '=' (the key value
+ * separator of a form entry), everything else is escaped as %XX.
+ * Runs of unreserved bytes are checked 16 at a time when SSE2 is available.
+ *
+ * @return Bytes needed to url encode the first length bytes of entry
+ */
+int urlEncodedLength(char *entry, int length);
+/** @param destination must have room for urlEncodedLength bytes, no null termination is added
+ *  @return Bytes written to destination */
+int urlEncodeInto(char *destination, char *entry, int length);
+/** Returns a newly allocated url encoded copy of entry, NULL on error */
 char *urlEncode(char *entry);
+/**
+ * Returns a newly allocated decoded copy of entry, with %XX escapes and '+'
+ * replaced, NULL on invalid escapes or error.
+ *
+ * @param decodedLength set to the decoded length if not NULL, the result can contain null bytes
+ */
+char *urlDecode(char *entry, int *decodedLength);
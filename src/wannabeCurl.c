@@ -1,20 +1,41 @@
 #include "argParser.h"
+#include "batch.h"
+#include "daemon.h"
 #include "httpLib.h"
 #include "logger.h"
+#include "rangeFetch.h"
+#include "rateLimit.h"
+#include "resume.h"
 #include "socketUtils.h"
+#include "stats.h"
+#include "stream.h"
+#include "summary.h"
 #include "utils.h"
 #include <errno.h>
+#include <signal.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <unistd.h>
 
+void showStats();
+
+// read by showStats, which runs at exit and takes no arguments
+int statsFormat = 0;
+
 int main(int argc, char **argv)
 {
     socketStruct *socketInfo;
     httpRequest *req;
     httpResponse *res;
+    char *outputPath, *digest;
+    long long resumeOffset, hashedLength;
+    int daemonSocket, verified, failed;
+    transferSummary summary;
+    transferStats snapshot;
+    struct stat outputInfo;
+    httpError error;
 
     // This are calloc so we don't have to manually set all pointers/lengths to NULL/0
     req = calloc(1, sizeof(httpRequest));
@@ -24,12 +45,35 @@ int main(int argc, char **argv)
         logPanic("Could not allocate request/response structure in memory!");
     }
 
+    // a closed connection is reported by send, not by killing the process
+    signal(SIGPIPE, SIG_IGN);
+
     // DEFAULTS SETTINGS
-    req->method = GET;
-    req->type   = NONE;
+    req->method      = GET;
+    req->type        = NONE;
+    req->mirrorDepth = -1;
 
     parseArguments(argc, argv, req);
-    generateHeaders(req);
+
+    // printed on every exit, failed transfers included
+    statsFormat = req->stats;
+    if (statsFormat)
+    {
+        atexit(showStats);
+    }
+
+    // the daemon always verifies the servers with the system certificates, see parseArguments
+    error = setTlsTrust(req->caFile, req->caPath, !req->insecure);
+    if (error != HTTP_OK)
+    {
+        logPanic("Could not set the trusted certificates: %s", errorDescription(error));
+    }
+
+    if (req->daemon == 1)
+    {
+        error = runDaemon();
+        logPanic("Could not start the daemon: %s", errorDescription(error));
+    }
 
     // setup output directory
     if (mkdir("./out", 0755) == -1)
@@ -39,6 +83,43 @@ int main(int argc, char **argv)
             logPanic("Could not create './out' directory!");
         }
     }
+
+    if (req->urlList != NULL || req->mirrorDepth >= 0 || req->templateData != NULL)
+    {
+        failed = runBatch(req);
+        freeHttp(req, res);
+
+        return failed == 0 ? 0 : 1;
+    }
+
+    if (req->stream != 0)
+    {
+        error = runStream(req);
+        freeHttp(req, res);
+
+        return error == HTTP_OK ? 0 : 1;
+    }
+
+    if (req->ranges != NULL)
+    {
+        error = runRanges(req);
+        freeHttp(req, res);
+
+        return error == HTTP_OK ? 0 : 1;
+    }
+
+    error = generateHeaders(req);
+    if (error != HTTP_OK)
+    {
+        logPanic("Could not generate request headers: %s", errorDescription(error));
+    }
+
+    resumeOffset = 0;
+    if (req->resume)
+    {
+        resumeOffset = prepareResume(req, req->outputPath);
+    }
+
     res->filename       = strdup(req->host);
     res->filenameLength = req->hostLength;
 
@@ -60,35 +141,239 @@ int main(int argc, char **argv)
                req->text,
                req->form);
 
-    socketInfo = createSocket(req->host, req->secure);
-
     logInfo("Building and sending HTTP payload...");
 
-    buildRequest(req);
-    logFile(DEBUG, res->filename, res->filenameLength,
-            "req.txt", 7, "%.*s", req->payloadSize, req->payload);
+    error = buildRequest(req);
+    if (error != HTTP_OK)
+    {
+        logPanic("Could not build the request: %s", errorDescription(error));
+    }
+    logFileData(DEBUG, res->filename, res->filenameLength,
+                "req.txt", 7, req->payload, req->payloadSize);
+
+    // a running daemon already has warm connections, hand it the request
+    // unless there are files to upload, those are only read by this process,
+    // or the servers must be verified with other certificates or reached differently
+    socketInfo   = NULL;
+    daemonSocket = req->daemon == -1 || req->type == MULTIPART || req->caFile != NULL || req->caPath != NULL || req->insecure ||
+                           req->unixSocket != NULL
+                       ? -1
+                       : connectDaemon();
+    if (daemonSocket != -1)
+    {
+        error = daemonSendRequest(daemonSocket, req);
+    }
+    else
+    {
+        error = createSocket(&socketInfo, req->host, req->secure, req->socketProfile, req->unixSocket);
+        if (error != HTTP_OK)
+        {
+            logPanic("Could not connect to '%s': %s", req->host, errorDescription(error));
+        }
+
+        if (req->limitRate > 0 || globalRate() > 0)
+        {
+            socketInfo->limiter = createLimiter(req->limitRate, req->rateWeight);
+        }
 
-    sendMessage(socketInfo, req->payload, req->payloadSize);
+        error = sendRequest(socketInfo, req);
+    }
+    if (error != HTTP_OK)
+    {
+        logPanic("Could not send the request: %s", errorDescription(error));
+    }
 
     logInfo("Request sent! Size: %d bytes.", req->payloadSize);
 
     logInfo("Reciving data and saving to file...");
 
-    reciveResponse(socketInfo, res);
+    if (daemonSocket != -1)
+    {
+        error = daemonReciveHeaders(daemonSocket, res);
+    }
+    else
+    {
+        error = reciveHeaders(socketInfo, res);
+    }
+    if (error != HTTP_OK)
+    {
+        logPanic("Could not recive the response headers: %s", errorDescription(error));
+    }
+
+    // HEAD responses announce the length of a body that is never sent
+    if (req->method == HEAD || res->status == 204 || res->status == 304)
+    {
+        res->contentLength = 0;
+    }
+
+    if (req->resume)
+    {
+        // an error page must not overwrite what was already downloaded
+        if (res->status != 416 && (res->status < 200 || res->status > 299))
+        {
+            logPanic("Status %d: %s, '%s' left untouched to be continued later",
+                     res->status, statusCodeDescription(res->status), req->outputPath);
+        }
+        else if (res->status == 206 && res->rangeStart == -1)
+        {
+            logPanic("Server sent a range without its Content-Range!");
+        }
+        else if (res->status == 206 && res->rangeStart != resumeOffset)
+        {
+            logPanic("Server sent a range starting at %lld instead of %lld!", res->rangeStart, resumeOffset);
+        }
+        else if (resumeOffset > 0 && res->status == 200)
+        {
+            logInfo("Remote file changed or ranges not supported, restarting download from scratch");
+            resumeOffset = 0;
+        }
+        else if (res->status == 416)
+        {
+            logWarn("'%s' is bigger than the remote file, leaving it untouched", req->outputPath);
+            res->contentLength = 0;
+        }
+    }
+
+    // a partial download is hashed from disk once, the rest is hashed as it arrives.
+    // A 416 leaves the file of a resume as it is, the whole of it is checked
+    hashedLength = resumeOffset;
+    if (req->resume && res->status == 416)
+    {
+        hashedLength = stat(req->outputPath, &outputInfo) == 0 ? outputInfo.st_size : -1;
+    }
+    if (req->checksum != CHECKSUM_NONE && (res->status != 416 || hashedLength > 0))
+    {
+        res->digest = createDigest(req->checksum);
+        if (res->digest == NULL)
+        {
+            logPanic("Could not start %s checksum!", checksumNames[req->checksum]);
+        }
+
+        if (hashedLength > 0 && hashFilePrefix(res->digest, req->outputPath, hashedLength) == -1)
+        {
+            logPanic("Could not hash the download in '%s'!", req->outputPath);
+        }
+    }
+
+    outputPath = NULL;
+    if (res->contentLength != 0)
+    {
+        // the body is streamed to the output file as it arrives
+        if (req->outputPath != NULL)
+        {
+            outputPath = strdup(req->outputPath);
+            if (strcmp(outputPath, SINK_STDOUT))
+            {
+                saveResumeState(res, outputPath);
+            }
+        }
+        else
+        {
+            outputPath = logFilename(res->filename, res->filenameLength,
+                                     contentTypeToExtension[res->type], contentTypeToLength[res->type]);
+        }
+
+        res->sink = openSink(outputPath, resumeOffset, res->contentLength, req->durable ? SINK_DURABLE : 0);
+        if (res->sink == NULL)
+        {
+            logPanic("Could not open '%s' to save the response!", outputPath);
+        }
+
+        logInfo("Done! Now reciving response body..");
+        if (daemonSocket != -1)
+        {
+            error = daemonReciveBody(daemonSocket, res);
+        }
+        else
+        {
+            error = reciveBody(socketInfo, res);
+        }
+
+        if (closeSink(res->sink) == -1 && error == HTTP_OK)
+        {
+            error = ERR_FILE;
+        }
+        if (error != HTTP_OK)
+        {
+            logPanic("Could not save the response to '%s': %s", outputPath, errorDescription(error));
+        }
+        res->sink = NULL;
+
+        if (req->outputPath != NULL && strcmp(outputPath, SINK_STDOUT))
+        {
+            clearResumeState(outputPath);
+        }
+    }
+
+    digest   = NULL;
+    verified = -1;
+    if (res->digest != NULL)
+    {
+        digest      = finishDigest(res->digest);
+        res->digest = NULL;
+        if (digest == NULL)
+        {
+            logPanic("Could not compute %s checksum!", checksumNames[req->checksum]);
+        }
+
+        logInfo("%s: %s", checksumNames[req->checksum], digest);
+
+        if (req->expectedChecksum != NULL)
+        {
+            verified = !strcasecmp(digest, req->expectedChecksum);
+        }
+    }
+    // nothing hashed, the expected checksum can't be taken as verified
+    else if (req->expectedChecksum != NULL)
+    {
+        verified = 0;
+    }
+
+    if (req->summaryPath != NULL)
+    {
+        memset(&summary, 0, sizeof(summary));
+        if (req->stats)
+        {
+            readStats(&snapshot);
+            summary.stats = &snapshot;
+        }
+        summary.url = malloc((req->secure ? 5 : 4) + 3 + req->hostLength + req->pathLength + 1);
+        if (summary.url != NULL)
+        {
+            sprintf(summary.url, "%s://%s%s", req->secure ? "https" : "http", req->host, req->path);
+        }
+        summary.status      = res->status;
+        summary.size        = res->contentLength;
+        summary.resumedFrom = res->status == 206 ? resumeOffset : 0;
+        summary.outputPath  = outputPath;
+        summary.checksum    = req->checksum;
+        summary.digest      = digest;
+        summary.verified    = verified;
+
+        writeSummary(req->summaryPath, &summary);
+        free(summary.url);
+    }
+
+    if (verified == 0 && digest == NULL)
+    {
+        logPanic("%s not verified, nothing was downloaded!", checksumNames[req->checksum]);
+    }
+    if (verified == 0)
+    {
+        logPanic("%s mismatch! Expected %s, got %s", checksumNames[req->checksum], req->expectedChecksum, digest);
+    }
+    free(digest);
+    free(outputPath);
 
     logVerbose("Response info: \n\t"
                "Content type: %s \n\t"
-               "Content length: %d",
+               "Content length: %lld",
                contentTypeValue[res->type],
                res->contentLength);
 
     if (res->contentLength != 0)
     {
-        // using panic to ensure that the response is saved even if logger is quiet
-        logFile(PANIC, res->filename, res->filenameLength,
-                contentTypeToExtension[res->type], contentTypeToLength[res->type],
-                "%.*s", res->contentLength, res->content);
-        logInfo("Response successfully recived! Size: %d bytes.", res->contentLength);
+        logInfo("Response successfully recived! Size: %lld bytes.", res->contentLength);
     }
     else
     {
@@ -112,7 +397,35 @@ int main(int argc, char **argv)
     }
 
     freeHttp(req, res);
-    closeSocket(socketInfo);
+    if (daemonSocket != -1)
+    {
+        close(daemonSocket);
+    }
+    else
+    {
+        destroyLimiter(socketInfo->limiter);
+        closeSocket(socketInfo);
+    }
 
     return 0;
 }
+
+// ==================== LOCAL FUNCTIONS ====================
+
+// stderr keeps the stats apart from a body written to stdout
+void showStats()
+{
+    transferStats snapshot;
+
+    readStats(&snapshot);
+    if (statsFormat == 2)
+    {
+        printStatsJson(stderr, &snapshot, 0);
+        fprintf(stderr, "\n");
+    }
+    else
+    {
+        fprintf(stderr, "\nStats:\n");
+        printStats(stderr, &snapshot);
+    }
+}
@@ -0,0 +1,147 @@
+#include "workQueue.h"
+#include "stats.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+void *takeFront(workDeque *deque);
+void *takeBack(workDeque *deque);
+
+workQueue *createWorkQueue(int workers)
+{
+    int i;
+    workQueue *queue;
+
+    queue = calloc(1, sizeof(workQueue));
+    if (queue == NULL)
+    {
+        return NULL;
+    }
+
+    queue->deques = calloc(workers, sizeof(workDeque));
+    if (queue->deques == NULL)
+    {
+        free(queue);
+
+        return NULL;
+    }
+
+    queue->workers = workers;
+    for (i = 0; i < workers; ++i)
+    {
+        pthread_mutex_init(&queue->deques[i].lock, NULL);
+    }
+
+    return queue;
+}
+
+httpError pushWork(workQueue *queue, int worker, void *item)
+{
+    int capacity;
+    void **items;
+    workDeque *deque;
+
+    deque = &queue->deques[worker];
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->back == deque->capacity)
+    {
+        // slide the items to the start when half of the array was already taken
+        if (deque->front > deque->capacity / 2)
+        {
+            memmove(deque->items, deque->items + deque->front, (deque->back - deque->front) * sizeof(void *));
+            deque->back -= deque->front;
+            deque->front = 0;
+        }
+        else
+        {
+            capacity = deque->capacity > 0 ? deque->capacity * 2 : WORK_DEQUE_MIN_CAPACITY;
+            items    = realloc(deque->items, capacity * sizeof(void *));
+            if (items == NULL)
+            {
+                pthread_mutex_unlock(&deque->lock);
+
+                return ERR_MEMORY;
+            }
+            countStat(reallocations, 1);
+
+            deque->items    = items;
+            deque->capacity = capacity;
+        }
+    }
+
+    deque->items[deque->back++] = item;
+    pthread_mutex_unlock(&deque->lock);
+
+    return HTTP_OK;
+}
+
+void *takeWork(workQueue *queue, int worker)
+{
+    int i;
+    void *item;
+
+    item = takeFront(&queue->deques[worker]);
+
+    // start from the next worker, so the thieves spread over all the victims
+    for (i = 1; i < queue->workers && item == NULL; ++i)
+    {
+        item = takeBack(&queue->deques[(worker + i) % queue->workers]);
+    }
+
+    return item;
+}
+
+void destroyWorkQueue(workQueue *queue)
+{
+    int i;
+
+    if (queue == NULL)
+    {
+        return;
+    }
+
+    for (i = 0; i < queue->workers; ++i)
+    {
+        pthread_mutex_destroy(&queue->deques[i].lock);
+        free(queue->deques[i].items);
+    }
+
+    free(queue->deques);
+    free(queue);
+}
+
+// ==================== LOCAL FUNCTIONS ====================
+
+void *takeFront(workDeque *deque)
+{
+    void *item;
+
+    item = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back)
+    {
+        item = deque->items[deque->front++];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return item;
+}
+
+// the thief takes the job the owner would have reached last
+void *takeBack(workDeque *deque)
+{
+    void *item;
+
+    item = NULL;
+
+    pthread_mutex_lock(&deque->lock);
+    if (deque->front < deque->back)
+    {
+        item = deque->items[--deque->back];
+    }
+    pthread_mutex_unlock(&deque->lock);
+
+    return item;
+}
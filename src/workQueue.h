@@ -0,0 +1,39 @@
+#pragma once
+
+#include "httpError.h"
+#include <pthread.h>
+
+#define WORK_DEQUE_MIN_CAPACITY 16
+
+/** Items of one worker: taken by the owner from the front and stolen by the others from the back */
+typedef struct workDeque
+{
+    pthread_mutex_t lock;
+    void **items;
+    int front;
+    int back;
+    int capacity;
+} workDeque;
+
+/**
+ * Job queue split per worker, so the workers do not fight over a single lock.
+ * A worker that runs out of jobs steals from the others, so a few slow jobs
+ * on one worker do not leave the rest idle.
+ */
+typedef struct workQueue
+{
+    workDeque *deques;
+    int workers;
+} workQueue;
+
+/** @return New empty queue for workers workers, NULL if out of memory */
+workQueue *createWorkQueue(int workers);
+/** Give item to worker, any thread can push to any worker */
+httpError pushWork(workQueue *queue, int worker, void *item);
+/**
+ * Next item for worker, its own first and then stolen from the others.
+ *
+ * @return NULL when every worker ran out of items
+ */
+void *takeWork(workQueue *queue, int worker);
+void destroyWorkQueue(workQueue *queue);